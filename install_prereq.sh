@@ -1,3 +1,3 @@
 #!/bin/bash
 
-apt-get install make clang clang-format clang-tidy gdb libfuse-dev protobuf-compiler libprotobuf-dev libsodium-dev libsodium-dbg
+apt-get install make clang clang-format clang-tidy gdb libfuse-dev protobuf-compiler libprotobuf-dev libsodium-dev libsodium-dbg liblz4-dev libzstd-dev
@@ -0,0 +1,227 @@
+#include "cache_store.h"
+
+#include "fetch_hints.h"
+
+#include <cstring>
+
+namespace{
+
+//Larger objects are file data, which File_Data and Readahead already cache
+const size_t MAX_CACHED_OBJECT = 1024 * 1024;
+
+}
+
+Cache_Store::Cache_Store(const std::shared_ptr<Object_Store> &backend, const size_t &max_bytes, const std::chrono::milliseconds &lease):
+    _backend(backend),
+    _max_bytes(max_bytes),
+    _lease(lease)
+{
+}
+
+void Cache_Store::store(const Ref &ref, const Object &obj){
+    const Ref_Key key = ref_key(ref);
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _epochs[_slot(key)]++;
+        _writing[_slot(key)]++;
+        const auto e = _entries.find(key);
+        if(e != _entries.end()){
+            _erase(e);
+        }
+    }
+
+    try{
+        _backend->store(ref, obj);
+    }
+    catch(...){
+        _written(key);
+        throw;
+    }
+    _written(key);
+}
+
+Object Cache_Store::fetch(const Ref &ref){
+    if(!Immutable_Fetch::active()){
+        return _backend->fetch(ref);
+    }
+
+    const Ref_Key key = ref_key(ref);
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        const auto e = _entries.find(key);
+        if( (e != _entries.end()) && !e->second.tail ){
+            _lru.splice(_lru.begin(), _lru, e->second.lru);
+            return Object(e->second.data);
+        }
+        epoch = _epoch(key);
+    }
+
+    const Object o = _backend->fetch(ref);
+    if(o.data().size() <= MAX_CACHED_OBJECT){
+        _put(key, epoch, o.data(), false);
+    }
+    return o;
+}
+
+Object Cache_Store::fetch(const Ref &ref, const size_t &start, const size_t &end){
+    const Ref_Key key = ref_key(ref);
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        const auto e = _entries.find(key);
+        if( (e != _entries.end()) && !e->second.tail && (end <= e->second.data.size()) && (start <= end) ){
+            _lru.splice(_lru.begin(), _lru, e->second.lru);
+            return Object(e->second.data.substr(start, end - start));
+        }
+    }
+    return _backend->fetch(ref, start, end);
+}
+
+Object Cache_Store::fetch_tail(const Ref &ref, const size_t &num_bytes){
+    std::string tail(num_bytes, '\0');
+    fetch_tail(ref, num_bytes, &tail[0]);
+    return Object(tail);
+}
+
+void Cache_Store::fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf){
+    const Ref_Key key = ref_key(ref);
+    uint64_t epoch;
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        if(_get_tail(key, num_bytes, buf)){
+            return;
+        }
+        epoch = _epoch(key);
+    }
+
+    {
+        //A tail is trusted for a lease anyway, a replica a little behind
+        //the primary will do
+        const Stale_Fetch hint;
+        _backend->fetch_tail(ref, num_bytes, buf);
+    }
+    _put(key, epoch, std::string(buf, num_bytes), true);
+}
+
+void Cache_Store::append(const Ref &ref, const char *data, const size_t &size){
+    const Ref_Key key = ref_key(ref);
+    {
+        //Fetches already in flight may complete after the append lands, with
+        //or without it
+        std::lock_guard<std::mutex> l(_lock);
+        _epochs[_slot(key)]++;
+        _writing[_slot(key)]++;
+    }
+
+    try{
+        _backend->append(ref, data, size);
+    }
+    catch(...){
+        //The append may or may not have landed
+        _written(key);
+        std::lock_guard<std::mutex> l(_lock);
+        const auto e = _entries.find(key);
+        if(e != _entries.end()){
+            _erase(e);
+        }
+        throw;
+    }
+
+    std::lock_guard<std::mutex> l(_lock);
+    _epochs[_slot(key)]++;
+    _writing[_slot(key)]--;
+    //Nothing was cached during the append, so this predates it
+    const auto e = _entries.find(key);
+    if(e == _entries.end()){
+        return;
+    }
+
+    //What we hold is still the end of the object, so the new end is simply
+    //the old one followed by data
+    Entry &entry = e->second;
+    const size_t old_size = entry.data.size();
+    entry.data.append(data, size);
+    if(entry.tail){
+        entry.data.erase(0, entry.data.size() - old_size);
+        //Whatever else was appended before, the tail is now all our own
+        if(size >= old_size){
+            entry.checked = std::chrono::steady_clock::now();
+        }
+    }
+    _bytes = _bytes + entry.data.size() - old_size;
+    if( (!entry.tail && (entry.data.size() > MAX_CACHED_OBJECT)) || (_bytes > _max_bytes) ){
+        _erase(e);
+    }
+}
+
+size_t Cache_Store::size(){
+    std::lock_guard<std::mutex> l(_lock);
+    return _bytes;
+}
+
+size_t Cache_Store::_slot(const Ref_Key &key) const{
+    //Refs are random or hashes, any byte will do
+    return (unsigned char)key[0];
+}
+
+uint64_t Cache_Store::_epoch(const Ref_Key &key){
+    return _epochs[_slot(key)];
+}
+
+void Cache_Store::_written(const Ref_Key &key){
+    std::lock_guard<std::mutex> l(_lock);
+    _epochs[_slot(key)]++;
+    _writing[_slot(key)]--;
+}
+
+bool Cache_Store::_get_tail(const Ref_Key &key, const size_t &num_bytes, char *buf){
+    const auto e = _entries.find(key);
+    if( (e == _entries.end()) || (e->second.data.size() < num_bytes) ){
+        return false;
+    }
+    if( e->second.tail && (std::chrono::steady_clock::now() - e->second.checked > _lease) ){
+        return false;
+    }
+    const std::string &data = e->second.data;
+    std::memcpy(buf, data.data() + data.size() - num_bytes, num_bytes);
+    _lru.splice(_lru.begin(), _lru, e->second.lru);
+    return true;
+}
+
+void Cache_Store::_put(const Ref_Key &key, const uint64_t &epoch, const std::string &data, const bool &tail){
+    if(data.size() > _max_bytes){
+        return;
+    }
+
+    std::lock_guard<std::mutex> l(_lock);
+    if( (_epoch(key) != epoch) || (_writing[_slot(key)] > 0) ){
+        return;
+    }
+
+    auto e = _entries.find(key);
+    if(e != _entries.end()){
+        //Never replace a whole object with a tail of it
+        if(tail && !e->second.tail){
+            return;
+        }
+        _erase(e);
+    }
+
+    _lru.push_front(key);
+    Entry &entry = _entries[key];
+    entry.data = data;
+    entry.tail = tail;
+    entry.checked = std::chrono::steady_clock::now();
+    entry.lru = _lru.begin();
+    _bytes += data.size();
+
+    while(_bytes > _max_bytes){
+        _erase(_entries.find(_lru.back()));
+    }
+}
+
+void Cache_Store::_erase(const std::unordered_map<Ref_Key, Entry, Ref_Key_Hash>::iterator &e){
+    _bytes -= e->second.data.size();
+    _lru.erase(e->second.lru);
+    _entries.erase(e);
+}
@@ -0,0 +1,82 @@
+#ifndef __CACHE_STORE_H__
+#define __CACHE_STORE_H__
+
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+#include "ref_cache.h"
+
+/* Object_Store decorator keeping a bounded LRU of recently used objects and
+ * object tails in memory.
+ *
+ * Whole objects up to a size limit are cached by fetch(ref) under an
+ * Immutable_Fetch, and the tails of inode logs by fetch_tail(ref, n). Writes
+ * through this store update or drop what it holds, so it is coherent with
+ * itself.
+ *
+ * Other writers, e.g. other mounts, can only append to logs, every other
+ * object is stored under a new ref when it changes. So whole objects are
+ * always current, and tails are only trusted for lease after they were
+ * fetched or written, then fetched again. A node changed elsewhere is
+ * therefore seen within lease, along with the directories, xattrs and chunk
+ * lists its new generation points at.
+ *
+ * Tails are fetched under a Stale_Fetch, so a Hedged_Store below may answer
+ * from a replica when the primary stalls. Callers about to append on top of
+ * a tail must read it through a store without this one.
+ */
+class Cache_Store : public Object_Store {
+
+    public:
+        Cache_Store(const std::shared_ptr<Object_Store> &backend, const size_t &max_bytes, const std::chrono::milliseconds &lease);
+
+        void store(const Ref &ref, const Object &obj);
+        Object fetch(const Ref &ref);
+        Object fetch(const Ref &ref, const size_t &start, const size_t &end);
+        Object fetch_tail(const Ref &ref, const size_t &num_bytes);
+        void fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf);
+        void append(const Ref &ref, const char *data, const size_t &size);
+
+        //Bytes of object data held
+        size_t size();
+
+    private:
+        struct Entry {
+            std::string data;
+            //data is only the last data.size() bytes of the object
+            bool tail;
+            //When a tail was last known to be the end of the object
+            std::chrono::steady_clock::time_point checked;
+            std::list<Ref_Key>::iterator lru;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        const size_t _max_bytes;
+        const std::chrono::milliseconds _lease;
+
+        std::mutex _lock;
+        std::unordered_map<Ref_Key, Entry, Ref_Key_Hash> _entries;
+        std::list<Ref_Key> _lru;
+        size_t _bytes = 0;
+        //Bumped by every write to a ref hashing to the slot before it is
+        //sent, a fetch that raced with a write must not be cached
+        uint64_t _epochs[256] = {};
+        //Writes to refs hashing to the slot in flight, nothing is cached
+        //meanwhile as it may or may not include them
+        size_t _writing[256] = {};
+
+        size_t _slot(const Ref_Key &key) const;
+        uint64_t _epoch(const Ref_Key &key);
+        void _written(const Ref_Key &key);
+        bool _get_tail(const Ref_Key &key, const size_t &num_bytes, char *buf);
+        void _put(const Ref_Key &key, const uint64_t &epoch, const std::string &data, const bool &tail);
+        void _erase(const std::unordered_map<Ref_Key, Entry, Ref_Key_Hash>::iterator &e);
+
+};
+
+#endif
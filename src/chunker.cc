@@ -0,0 +1,62 @@
+#include "chunker.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace{
+
+struct Gear_Table{
+    uint64_t gear[256];
+
+    Gear_Table(){
+        //splitmix64 from a fixed seed
+        uint64_t x = 0x72746f7366736364;
+        for(size_t i = 0; i < 256; i++){
+            x += 0x9e3779b97f4a7c15;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            gear[i] = z ^ (z >> 31);
+        }
+    }
+};
+
+const Gear_Table table;
+
+}
+
+Chunker::Chunker(const size_t &min_size, const size_t &avg_size, const size_t &max_size):
+    _min_size(min_size),
+    _max_size(max_size)
+{
+    assert(min_size <= avg_size);
+    assert(avg_size <= max_size);
+
+    //Use the top bits of the hash, the low bits only depend on the last few bytes
+    size_t bits = 0;
+    while(((size_t)1 << (bits + 1)) <= avg_size){
+        bits++;
+    }
+    _mask = bits == 0 ? 0 : (~(uint64_t)0) << (64 - bits);
+}
+
+size_t Chunker::cut(const char *data, const size_t &size) const{
+    if(size <= _min_size){
+        return size;
+    }
+
+    const size_t end = std::min(size, _max_size);
+    const unsigned char *bytes = (const unsigned char *)data;
+    uint64_t hash = 0;
+    for(size_t i = _min_size; i < end; i++){
+        hash = (hash << 1) + table.gear[bytes[i]];
+        if(!(hash & _mask)){
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+size_t Chunker::max_size() const{
+    return _max_size;
+}
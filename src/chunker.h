@@ -0,0 +1,33 @@
+#ifndef __CHUNKER_H__
+#define __CHUNKER_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/* Content defined chunking using a gear rolling hash.
+ *
+ * Cut points depend only on the bytes near them, so inserting or removing
+ * data only changes the chunks around the edit and identical content is cut
+ * into identical chunks wherever it appears. The gear table is fixed, cut
+ * points must never change between versions or existing chunks stop
+ * deduplicating.
+ */
+class Chunker {
+
+    public:
+        Chunker(const size_t &min_size, const size_t &avg_size, const size_t &max_size);
+
+        //Length of the first chunk in data, which is all of it if the data
+        //ends before a cut point is found
+        size_t cut(const char *data, const size_t &size) const;
+
+        size_t max_size() const;
+
+    private:
+        const size_t _min_size;
+        const size_t _max_size;
+        uint64_t _mask;
+
+};
+
+#endif
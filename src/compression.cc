@@ -0,0 +1,82 @@
+#include "compression.h"
+
+#include <lz4.h>
+#include <zstd.h>
+
+namespace{
+
+const int ZSTD_LEVEL = 3;
+
+}
+
+CODEC codec_from_name(const std::string &name){
+    if(name == "none"){
+        return CODEC_NONE;
+    }
+    else if(name == "lz4"){
+        return CODEC_LZ4;
+    }
+    else if(name == "zstd"){
+        return CODEC_ZSTD;
+    }
+    else{
+        throw E_BAD_CODEC();
+    }
+}
+
+std::string codec_name(const CODEC &codec){
+    if(codec == CODEC_LZ4){
+        return "lz4";
+    }
+    else if(codec == CODEC_ZSTD){
+        return "zstd";
+    }
+    else{
+        return "none";
+    }
+}
+
+std::string compress(const CODEC &codec, const char *data, const size_t &size){
+    std::string compressed;
+    if(codec == CODEC_LZ4){
+        compressed.resize(LZ4_compressBound(size));
+        const int r = LZ4_compress_default(data, &compressed[0], size, compressed.size());
+        compressed.resize(r > 0 ? r : 0);
+    }
+    else if(codec == CODEC_ZSTD){
+        compressed.resize(ZSTD_compressBound(size));
+        const size_t r = ZSTD_compress(&compressed[0], compressed.size(), data, size, ZSTD_LEVEL);
+        compressed.resize(ZSTD_isError(r) ? 0 : r);
+    }
+    else{
+        compressed.assign(data, size);
+    }
+    return compressed;
+}
+
+std::string decompress(const CODEC &codec, const std::string &data, const size_t &length){
+    if(codec == CODEC_NONE){
+        if(data.size() != length){
+            throw E_BAD_CHUNK();
+        }
+        return data;
+    }
+
+    std::string decompressed(length, '\0');
+    if(codec == CODEC_LZ4){
+        const int r = LZ4_decompress_safe(data.c_str(), &decompressed[0], data.size(), length);
+        if( (r < 0) || ((size_t)r != length) ){
+            throw E_BAD_CHUNK();
+        }
+    }
+    else if(codec == CODEC_ZSTD){
+        const size_t r = ZSTD_decompress(&decompressed[0], length, data.c_str(), data.size());
+        if( ZSTD_isError(r) || (r != length) ){
+            throw E_BAD_CHUNK();
+        }
+    }
+    else{
+        throw E_BAD_CHUNK();
+    }
+    return decompressed;
+}
@@ -0,0 +1,25 @@
+#ifndef __COMPRESSION_H__
+#define __COMPRESSION_H__
+
+#include <string>
+
+//Values are stored in rtosfs::Chunk and rtosfs::Chunk_List, never renumber
+enum CODEC{
+    CODEC_NONE = 0,
+    CODEC_LZ4 = 1,
+    CODEC_ZSTD = 2
+};
+
+class E_BAD_CODEC {};
+class E_BAD_CHUNK {};
+
+//Throws E_BAD_CODEC for names other than none, lz4 and zstd
+CODEC codec_from_name(const std::string &name);
+std::string codec_name(const CODEC &codec);
+
+std::string compress(const CODEC &codec, const char *data, const size_t &size);
+
+//Throws E_BAD_CHUNK if data does not decompress to exactly length bytes
+std::string decompress(const CODEC &codec, const std::string &data, const size_t &length);
+
+#endif
@@ -0,0 +1,228 @@
+#include "dir_commit.h"
+
+#include "fetch_hints.h"
+#include "file_system.h"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <exception>
+#include <thread>
+#include <unordered_map>
+
+Dir_Committer::Dir_Committer(const std::shared_ptr<Object_Store> &backend, const std::shared_ptr<Object_Store> &latest, const std::chrono::microseconds &window):
+    _backend(backend),
+    _latest(latest),
+    _window(window)
+{
+}
+
+int Dir_Committer::commit(const Ref &dir_log, Dir_Op &op){
+    op.result = 0;
+    op.done = false;
+
+    const std::string key(dir_log.buf(), 32);
+    std::shared_ptr<Dir_Queue> queue;
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        auto &q = _queues[key];
+        if(!q){
+            q = std::make_shared<Dir_Queue>();
+        }
+        queue = q;
+    }
+
+    std::unique_lock<std::mutex> l(queue->lock);
+    queue->pending.push_back(&op);
+
+    while(!op.done){
+        if(queue->committing){
+            queue->done.wait(l);
+            continue;
+        }
+
+        //Nobody is committing this directory, so we do, taking every
+        //mutation that has queued up so far
+        queue->committing = true;
+        if(_window.count() > 0){
+            l.unlock();
+            std::this_thread::sleep_for(_window);
+            l.lock();
+        }
+
+        std::vector<Dir_Op *> batch;
+        batch.swap(queue->pending);
+        l.unlock();
+
+        //_apply handles backend failures itself, anything else is a bug, but
+        //the other callers in the batch must not wait on it forever
+        std::exception_ptr failure;
+        try{
+            _apply(dir_log, batch);
+        }
+        catch(...){
+            failure = std::current_exception();
+            for(auto &b: batch){
+                b->result = -EIO;
+            }
+        }
+
+        l.lock();
+        for(auto &b: batch){
+            b->done = true;
+        }
+        queue->committing = false;
+        queue->done.notify_all();
+
+        if(failure){
+            l.unlock();
+            _release(key, queue);
+            std::rethrow_exception(failure);
+        }
+    }
+    l.unlock();
+
+    _release(key, queue);
+    return op.result;
+}
+
+void Dir_Committer::_release(const std::string &key, const std::shared_ptr<Dir_Queue> &queue){
+    //Drop the queue once nobody else holds it, new arrivals can only get it
+    //under _lock
+    std::lock_guard<std::mutex> m(_lock);
+    const auto q = _queues.find(key);
+    if( (q != _queues.end()) && (q->second == queue) && (queue.use_count() == 2) ){
+        _queues.erase(q);
+    }
+}
+
+void Dir_Committer::_apply(const Ref &dir_log, const std::vector<Dir_Op *> &batch){
+    try{
+        Node dir_node(dir_log, _backend, _latest);
+        Inode dir_inode = dir_node.latest_inode();
+        if(dir_inode.type != NODE_DIR){
+            for(auto &op: batch){
+                op->result = -ENOTDIR;
+            }
+            return;
+        }
+
+        rtosfs::Directory dir;
+        dir.ParseFromString(fetch_immutable(*_backend, Ref(dir_inode.data_ref, 32)).data());
+
+        std::unordered_map<std::string, int> index;
+        for(int i = 0; i < dir.entries_size(); i++){
+            index[dir.entries(i).name()] = i;
+        }
+
+        const auto remove = [&](const std::string &name, rtosfs::Entry *removed){
+            const auto e = index.find(name);
+            const int i = e->second;
+            const int last = dir.entries_size() - 1;
+            if(removed != nullptr){
+                *removed = dir.entries(i);
+            }
+            if(i != last){
+                dir.mutable_entries()->SwapElements(i, last);
+                index[dir.entries(i).name()] = i;
+            }
+            dir.mutable_entries()->RemoveLast();
+            index.erase(e);
+        };
+
+        const auto add = [&](const rtosfs::Entry &entry, const std::string &name){
+            auto new_entry = dir.add_entries();
+            *new_entry = entry;
+            new_entry->set_name(name);
+            index[name] = dir.entries_size() - 1;
+        };
+
+        bool dirty = false;
+        for(auto &op: batch){
+            const std::string &name = op->entry.name();
+            const bool exists = index.count(name) > 0;
+
+            if(op->type == DIR_ADD){
+                if(exists){
+                    op->result = -EEXIST;
+                }
+                else{
+                    add(op->entry, name);
+                    op->result = 0;
+                }
+            }
+            else if(op->type == DIR_REPLACE){
+                if(exists){
+                    remove(name, &op->removed);
+                }
+                add(op->entry, name);
+                op->result = 0;
+            }
+            else if(op->type == DIR_REMOVE){
+                if(exists){
+                    remove(name, &op->removed);
+                    op->result = 0;
+                }
+                else{
+                    op->result = -ENOENT;
+                }
+            }
+            else if(op->type == DIR_SET_MODE){
+                //The entry may have been renamed or replaced since the
+                //caller looked it up, in which case there is nothing to do
+                op->result = 0;
+                if(exists){
+                    auto entry = dir.mutable_entries(index[name]);
+                    if( (entry->inode_ref() == op->entry.inode_ref()) && (entry->mode() != op->entry.mode()) ){
+                        entry->set_mode(op->entry.mode());
+                        dirty = true;
+                    }
+                }
+                continue;
+            }
+            else if(op->type == DIR_RENAME){
+                if(!exists){
+                    op->result = -ENOENT;
+                }
+                else{
+                    rtosfs::Entry moved;
+                    remove(name, &moved);
+                    if(index.count(op->new_name) > 0){
+                        remove(op->new_name, &op->removed);
+                    }
+                    add(moved, op->new_name);
+                    op->result = 0;
+                }
+            }
+            else{
+                assert(false);
+            }
+
+            dirty = dirty || (op->result == 0);
+        }
+
+        if(dirty){
+            std::string serialized_dir;
+            dir.SerializeToString(&serialized_dir);
+            const Ref new_dir_ref = Ref();
+            _backend->store(new_dir_ref, Object(serialized_dir));
+
+            const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
+            std::memcpy(dir_inode.data_ref, new_dir_ref.buf(), 32);
+            dir_inode.st_size = serialized_dir.size();
+            dir_inode.st_mtim = current_time;
+            dir_inode.st_ctim = current_time;
+            dir_node.update_inode(dir_inode);
+        }
+    }
+    catch(E_OBJECT_DNE e){
+        for(auto &op: batch){
+            op->result = -EIO;
+        }
+    }
+    catch(E_BAD_INODE e){
+        for(auto &op: batch){
+            op->result = -EIO;
+        }
+    }
+}
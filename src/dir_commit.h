@@ -0,0 +1,76 @@
+#ifndef __DIR_COMMIT_H__
+#define __DIR_COMMIT_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <rtos/object_store.h>
+
+#include "disk_format.pb.h"
+
+enum DIR_OP_TYPE{
+    DIR_ADD,        //Add entry, -EEXIST if the name is taken
+    DIR_REPLACE,    //Add entry, replacing any entry with the same name
+    DIR_REMOVE,     //Remove entry, -ENOENT if the name does not exist
+    DIR_RENAME,     //Rename entry.name() to new_name, replacing any entry called new_name
+    DIR_SET_MODE    //Set the mode of entry.name() if it still refers to entry.inode_ref()
+};
+
+struct Dir_Op{
+    DIR_OP_TYPE type;
+    rtosfs::Entry entry;
+    std::string new_name;
+
+    //Set by the committer
+    int result;
+    rtosfs::Entry removed;
+    bool done;
+};
+
+/* Group commit of directory mutations.
+ *
+ * Every mutation of a directory goes through commit(). Mutations of the same
+ * directory that arrive while a commit of that directory is in flight, or
+ * within window of the first pending mutation, are applied together to one
+ * fetched copy of the directory, which is then stored once with a single new
+ * generation appended to the directory's inode log. Each caller still gets
+ * the result of its own mutation.
+ *
+ * Callers are responsible for permission checks, as the commit may be
+ * performed on another caller's thread. The directory's inode is read from
+ * latest, which must not cache inode tails, so a commit never builds on a
+ * generation another mount has already replaced.
+ */
+class Dir_Committer {
+
+    public:
+        Dir_Committer(const std::shared_ptr<Object_Store> &backend, const std::shared_ptr<Object_Store> &latest, const std::chrono::microseconds &window);
+
+        //Returns 0 or -errno, op.result is set to the same value
+        int commit(const Ref &dir_log, Dir_Op &op);
+
+    private:
+        struct Dir_Queue{
+            std::mutex lock;
+            std::condition_variable done;
+            bool committing = false;
+            std::vector<Dir_Op *> pending;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        std::shared_ptr<Object_Store> _latest;
+        const std::chrono::microseconds _window;
+
+        std::mutex _lock;
+        std::map<std::string, std::shared_ptr<Dir_Queue>> _queues;
+
+        void _apply(const Ref &dir_log, const std::vector<Dir_Op *> &batch);
+        void _release(const std::string &key, const std::shared_ptr<Dir_Queue> &queue);
+
+};
+
+#endif
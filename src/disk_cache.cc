@@ -0,0 +1,278 @@
+#include "disk_cache.h"
+
+#include "fetch_hints.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sodium.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace{
+
+const char CACHE_MAGIC[8] = {'R', 'T', 'O', 'S', 'D', 'C', '0', '1'};
+
+struct Cache_Header{
+    char magic[8];
+    uint64_t length;
+    unsigned char checksum[crypto_generichash_BYTES];
+};
+
+bool read_all(const int &fd, char *buf, size_t size){
+    while(size > 0){
+        const ssize_t r = ::read(fd, buf, size);
+        if(r < 0 && errno == EINTR){
+            continue;
+        }
+        if(r <= 0){
+            return false;
+        }
+        buf += r;
+        size -= r;
+    }
+    return true;
+}
+
+bool write_all(const int &fd, const char *buf, size_t size){
+    while(size > 0){
+        const ssize_t r = ::write(fd, buf, size);
+        if(r < 0 && errno == EINTR){
+            continue;
+        }
+        if(r <= 0){
+            return false;
+        }
+        buf += r;
+        size -= r;
+    }
+    return true;
+}
+
+void checksum(const std::string &data, unsigned char *out){
+    crypto_generichash(out, crypto_generichash_BYTES, (const unsigned char *)data.data(), data.size(), nullptr, 0);
+}
+
+bool make_directory(const std::string &path){
+    return (mkdir(path.c_str(), 0700) == 0) || (errno == EEXIST);
+}
+
+}
+
+Disk_Cache::Disk_Cache(const std::shared_ptr<Object_Store> &backend, const std::string &directory, const size_t &max_bytes):
+    _backend(backend),
+    _directory(directory),
+    _max_bytes(max_bytes)
+{
+    if(sodium_init() < 0){
+        throw E_BAD_CACHE_DIR();
+    }
+    if(!make_directory(_directory)){
+        throw E_BAD_CACHE_DIR();
+    }
+    _load_index();
+}
+
+void Disk_Cache::store(const Ref &ref, const Object &obj){
+    _remove(ref.base16());
+    _backend->store(ref, obj);
+}
+
+Object Disk_Cache::fetch(const Ref &ref){
+    if(!Immutable_Fetch::active()){
+        return _backend->fetch(ref);
+    }
+
+    const std::string name = ref.base16();
+    std::string data;
+    if(_read(name, data)){
+        return Object(data);
+    }
+
+    const Object o = _backend->fetch(ref);
+    _write(name, o.data());
+    return o;
+}
+
+Object Disk_Cache::fetch(const Ref &ref, const size_t &start, const size_t &end){
+    return _backend->fetch(ref, start, end);
+}
+
+Object Disk_Cache::fetch_tail(const Ref &ref, const size_t &num_bytes){
+    return _backend->fetch_tail(ref, num_bytes);
+}
+
+void Disk_Cache::fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf){
+    _backend->fetch_tail(ref, num_bytes, buf);
+}
+
+void Disk_Cache::append(const Ref &ref, const char *data, const size_t &size){
+    _remove(ref.base16());
+    _backend->append(ref, data, size);
+}
+
+std::string Disk_Cache::_path(const std::string &name) const{
+    //Fan out over 256 subdirectories so no one directory gets huge
+    return _directory + "/" + name.substr(0, 2) + "/" + name;
+}
+
+void Disk_Cache::_load_index(){
+    struct Found{
+        std::string name;
+        size_t size;
+        timespec used;
+    };
+    std::vector<Found> found;
+
+    DIR *top = opendir(_directory.c_str());
+    if(top == nullptr){
+        throw E_BAD_CACHE_DIR();
+    }
+    for(struct dirent *d = readdir(top); d != nullptr; d = readdir(top)){
+        const std::string sub_name(d->d_name);
+        if( (sub_name == ".") || (sub_name == "..") ){
+            continue;
+        }
+        const std::string sub_path = _directory + "/" + sub_name;
+
+        //Left behind by a crash part way through a write
+        if(sub_name.compare(0, 4, "tmp.") == 0){
+            unlink(sub_path.c_str());
+            continue;
+        }
+
+        DIR *sub = opendir(sub_path.c_str());
+        if(sub == nullptr){
+            continue;
+        }
+        for(struct dirent *e = readdir(sub); e != nullptr; e = readdir(sub)){
+            const std::string name(e->d_name);
+            struct stat st;
+            if( (name == ".") || (name == "..") || (stat((sub_path + "/" + name).c_str(), &st) != 0) ){
+                continue;
+            }
+            found.push_back(Found{name, (size_t)st.st_size, st.st_mtim});
+        }
+        closedir(sub);
+    }
+    closedir(top);
+
+    std::sort(found.begin(), found.end(), [](const Found &a, const Found &b){
+        return (a.used.tv_sec != b.used.tv_sec) ? (a.used.tv_sec > b.used.tv_sec) : (a.used.tv_nsec > b.used.tv_nsec);
+    });
+
+    std::lock_guard<std::mutex> l(_lock);
+    for(const auto &f: found){
+        _lru.push_back(f.name);
+        _entries[f.name] = std::make_pair(f.size, std::prev(_lru.end()));
+        _bytes += f.size;
+    }
+    while( (_bytes > _max_bytes) && !_lru.empty() ){
+        const std::string victim = _lru.back();
+        unlink(_path(victim).c_str());
+        _forget(victim);
+    }
+}
+
+bool Disk_Cache::_read(const std::string &name, std::string &data){
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        const auto e = _entries.find(name);
+        if(e == _entries.end()){
+            return false;
+        }
+        _lru.splice(_lru.begin(), _lru, e->second.second);
+    }
+
+    const std::string path = _path(name);
+    const int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        std::lock_guard<std::mutex> l(_lock);
+        _forget(name);
+        return false;
+    }
+
+    Cache_Header header;
+    bool good = read_all(fd, (char *)&header, sizeof(header)) && (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0);
+    if(good){
+        //Never trust the length of a torn or corrupt entry with an allocation
+        struct stat st;
+        good = (fstat(fd, &st) == 0) && (header.length == (uint64_t)st.st_size - sizeof(header));
+    }
+    if(good){
+        data.resize(header.length);
+        good = read_all(fd, &data[0], header.length);
+    }
+    if(good){
+        unsigned char sum[crypto_generichash_BYTES];
+        checksum(data, sum);
+        good = std::memcmp(sum, header.checksum, sizeof(sum)) == 0;
+    }
+    if(good){
+        //Record the use so the LRU order survives remounts
+        futimens(fd, nullptr);
+    }
+    close(fd);
+
+    if(!good){
+        _remove(name);
+    }
+    return good;
+}
+
+void Disk_Cache::_write(const std::string &name, const std::string &data){
+    const size_t size = sizeof(Cache_Header) + data.size();
+    if(size > _max_bytes / 8){
+        return;
+    }
+
+    Cache_Header header;
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.length = data.size();
+    checksum(data, header.checksum);
+
+    const std::string tmp_path = _directory + "/tmp." + Ref().base16();
+    const int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0600);
+    if(fd < 0){
+        return;
+    }
+    const bool good = write_all(fd, (const char *)&header, sizeof(header)) && write_all(fd, data.data(), data.size());
+    close(fd);
+
+    const std::string path = _path(name);
+    if( !good || !make_directory(_directory + "/" + name.substr(0, 2)) || (rename(tmp_path.c_str(), path.c_str()) != 0) ){
+        unlink(tmp_path.c_str());
+        return;
+    }
+
+    std::lock_guard<std::mutex> l(_lock);
+    _forget(name);
+    _lru.push_front(name);
+    _entries[name] = std::make_pair(size, _lru.begin());
+    _bytes += size;
+    while(_bytes > _max_bytes){
+        const std::string victim = _lru.back();
+        unlink(_path(victim).c_str());
+        _forget(victim);
+    }
+}
+
+void Disk_Cache::_remove(const std::string &name){
+    std::lock_guard<std::mutex> l(_lock);
+    if(_entries.count(name) > 0){
+        unlink(_path(name).c_str());
+        _forget(name);
+    }
+}
+
+void Disk_Cache::_forget(const std::string &name){
+    const auto e = _entries.find(name);
+    if(e != _entries.end()){
+        _bytes -= e->second.first;
+        _lru.erase(e->second.second);
+        _entries.erase(e);
+    }
+}
@@ -0,0 +1,58 @@
+#ifndef __DISK_CACHE_H__
+#define __DISK_CACHE_H__
+
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+class E_BAD_CACHE_DIR {};
+
+/* Object_Store decorator keeping whole objects fetched by fetch(ref) under an
+ * Immutable_Fetch in files under a local directory, so they survive remounts.
+ *
+ * Callers only give that hint for objects that are never appended to, so
+ * entries never go stale. Every other fetch goes to the backend. Stores and
+ * appends through this store drop any entry for their ref regardless.
+ *
+ * Each entry is written to a temporary file and renamed into place, and
+ * carries the length and BLAKE2b hash of its contents. Entries that fail to
+ * verify, e.g. after a crash, are deleted and fetched again. Least recently
+ * used entries are deleted to keep the directory under max_bytes, last use
+ * is kept in the file's mtime so the order survives remounts.
+ */
+class Disk_Cache : public Object_Store {
+
+    public:
+        //Throws E_BAD_CACHE_DIR if directory cannot be created or read
+        Disk_Cache(const std::shared_ptr<Object_Store> &backend, const std::string &directory, const size_t &max_bytes);
+
+        void store(const Ref &ref, const Object &obj);
+        Object fetch(const Ref &ref);
+        Object fetch(const Ref &ref, const size_t &start, const size_t &end);
+        Object fetch_tail(const Ref &ref, const size_t &num_bytes);
+        void fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf);
+        void append(const Ref &ref, const char *data, const size_t &size);
+
+    private:
+        std::shared_ptr<Object_Store> _backend;
+        const std::string _directory;
+        const size_t _max_bytes;
+
+        std::mutex _lock;
+        std::list<std::string> _lru;
+        std::unordered_map<std::string, std::pair<size_t, std::list<std::string>::iterator>> _entries;
+        size_t _bytes = 0;
+
+        std::string _path(const std::string &name) const;
+        void _load_index();
+        bool _read(const std::string &name, std::string &data);
+        void _write(const std::string &name, const std::string &data);
+        void _remove(const std::string &name);
+        void _forget(const std::string &name);
+
+};
+
+#endif
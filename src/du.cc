@@ -0,0 +1,186 @@
+#include "du.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <vector>
+
+#include "disk_format.pb.h"
+#include "fetch_hints.h"
+#include "path.h"
+
+namespace{
+
+std::string join(const std::string &dir, const std::string &name){
+    return (dir == "/") ? dir + name : dir + "/" + name;
+}
+
+}
+
+Usage &Usage::operator+=(const Usage &other){
+    logical += other.logical;
+    backend += other.backend;
+    files += other.files;
+    directories += other.directories;
+    return *this;
+}
+
+Du::Du(const std::shared_ptr<Object_Store> &backend, const size_t &threads):
+    _backend(backend),
+    _threads(threads)
+{
+}
+
+Usage Du::walk(const std::string &prefix, const std::string &path){
+    const std::string log_ref = _resolve(prefix, path);
+    {
+        Work_Pool pool(_threads);
+        _node(pool, -1, path, log_ref);
+        pool.wait();
+    }
+
+    //Directories are always added after their parent, so going backwards
+    //every directory is complete before it is added to its parent
+    for(size_t i = _directories.size(); i-- > 0;){
+        const auto &d = _directories[i];
+        if(d.parent >= 0){
+            _directories[d.parent].usage += d.usage;
+        }
+    }
+    return _directories.empty() ? Usage() : _directories.front().usage;
+}
+
+void Du::report(std::ostream &out, const size_t &n) const{
+    std::vector<const Directory_Usage *> heaviest;
+    for(const auto &d: _directories){
+        heaviest.push_back(&d);
+    }
+    const size_t top = std::min(n, heaviest.size());
+    std::partial_sort(heaviest.begin(), heaviest.begin() + top, heaviest.end(), [](const Directory_Usage *a, const Directory_Usage *b){
+        return a->usage.backend > b->usage.backend;
+    });
+
+    out << std::setw(16) << "backend" << std::setw(16) << "logical" << std::setw(12) << "files" << std::setw(12) << "dirs" << "  path" << std::endl;
+    for(size_t i = 0; i < top; i++){
+        const Usage &u = heaviest[i]->usage;
+        out << std::setw(16) << u.backend << std::setw(16) << u.logical << std::setw(12) << u.files << std::setw(12) << u.directories << "  " << heaviest[i]->path << std::endl;
+    }
+}
+
+void Du::_node(Work_Pool &pool, const int64_t &parent, const std::string &path, const std::string &log_ref){
+    Usage usage;
+    std::string log;
+    try{
+        log = _backend->fetch(Ref(log_ref.c_str(), 32)).data();
+    }
+    catch(E_OBJECT_DNE e){
+        return;
+    }
+    Inode inode;
+    try{
+        inode = last_inode(log);
+    }
+    catch(E_BAD_INODE e){
+        return;
+    }
+
+    {
+        //Hard links only count once
+        uint64_t key;
+        std::memcpy(&key, log_ref.data(), sizeof(key));
+        std::lock_guard<std::mutex> l(_lock);
+        if(!_seen.insert(key).second){
+            return;
+        }
+    }
+
+    usage.backend += log.size();
+    try{
+        if(!null_ref(inode.xattr_ref)){
+            usage.backend += fetch_immutable(*_backend, Ref(inode.xattr_ref, 32)).data().size();
+        }
+
+        if(inode.type == NODE_DIR){
+            const std::string raw = fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data();
+            usage.backend += raw.size();
+            usage.directories++;
+
+            rtosfs::Directory dir;
+            dir.ParseFromString(raw);
+
+            int64_t index;
+            {
+                std::lock_guard<std::mutex> l(_lock);
+                index = _directories.size();
+                _directories.push_back(Directory_Usage{path, parent, usage});
+            }
+            for(const auto &e: dir.entries()){
+                const std::string entry_path = join(path, e.name());
+                const std::string entry_ref = e.inode_ref();
+                pool.submit([this, &pool, index, entry_path, entry_ref](){
+                    _node(pool, index, entry_path, entry_ref);
+                });
+            }
+            return;
+        }
+        else if(inode.type == NODE_CHUNKED){
+            const std::string raw = fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data();
+            usage.backend += raw.size();
+
+            rtosfs::Chunk_List list;
+            list.ParseFromString(raw);
+            for(const auto &c: list.chunks()){
+                if(c.stored_length() > 0){
+                    usage.backend += c.stored_length();
+                }
+                else if(!c.ref().empty()){
+                    //Extents are uncompressed ranges of their object, older
+                    //chunks may have been compressed but have no stored size
+                    usage.backend += c.length();
+                }
+            }
+        }
+        else{
+            usage.backend += inode.st_size;
+        }
+    }
+    catch(E_OBJECT_DNE e){
+        //Counted as far as it goes, fsck reports what is missing
+    }
+    usage.logical += inode.st_size;
+    usage.files++;
+
+    std::lock_guard<std::mutex> l(_lock);
+    if(parent >= 0){
+        _directories[parent].usage += usage;
+    }
+    else{
+        //The walk was of a single file
+        _directories.push_back(Directory_Usage{path, parent, usage});
+    }
+}
+
+std::string Du::_resolve(const std::string &prefix, const std::string &path){
+    std::string log_ref(Ref(prefix).buf(), 32);
+    for(const auto &name: Path(path.c_str())){
+        const Inode inode = fetch_inode(*_backend, Ref(log_ref.c_str(), 32));
+        if(inode.type != NODE_DIR){
+            throw E_OBJECT_DNE();
+        }
+
+        rtosfs::Directory dir;
+        dir.ParseFromString(fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data());
+        bool found = false;
+        for(const auto &e: dir.entries()){
+            if(name == e.name()){
+                log_ref = e.inode_ref();
+                found = true;
+                break;
+            }
+        }
+        if(!found){
+            throw E_OBJECT_DNE();
+        }
+    }
+    return log_ref;
+}
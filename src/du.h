@@ -0,0 +1,70 @@
+#ifndef __DU_H__
+#define __DU_H__
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_set>
+#include <rtos/object_store.h>
+
+#include "inode.h"
+#include "work_pool.h"
+
+struct Usage {
+    //Sum of st_size of files and symlinks
+    uint64_t logical = 0;
+    //Node logs including every dead generation, directories, xattrs, chunk
+    //lists and file data. Compressed chunks count as stored, except those
+    //written before their stored size was recorded, which count as their
+    //uncompressed length.
+    uint64_t backend = 0;
+    uint64_t files = 0;
+    uint64_t directories = 0;
+
+    Usage &operator+=(const Usage &other);
+};
+
+/* Usage accounting of a subtree, walked directly against the object store.
+ *
+ * Directories are walked in parallel by a pool of workers, then the usage of
+ * every directory is summed up into its ancestors. Nodes linked more than
+ * once are counted at the first link found. Chunks shared between files are
+ * counted for every file referencing them.
+ */
+class Du {
+
+    public:
+        Du(const std::shared_ptr<Object_Store> &backend, const size_t &threads);
+
+        //Walks the subtree at path of the File System at prefix, throws
+        //E_OBJECT_DNE if path does not exist
+        Usage walk(const std::string &prefix, const std::string &path);
+
+        //Writes the top n directories by backend bytes, after walk
+        void report(std::ostream &out, const size_t &n) const;
+
+    private:
+        struct Directory_Usage {
+            std::string path;
+            //Index of the parent, or -1 for the top of the walk
+            int64_t parent;
+            //Of this directory's own entries, before summing up
+            Usage usage;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        const size_t _threads;
+
+        std::mutex _lock;
+        std::deque<Directory_Usage> _directories;
+        std::unordered_set<uint64_t> _seen;
+
+        void _node(Work_Pool &pool, const int64_t &parent, const std::string &path, const std::string &log_ref);
+        std::string _resolve(const std::string &prefix, const std::string &path);
+
+};
+
+#endif
@@ -0,0 +1,367 @@
+#include "export.h"
+
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include <sys/stat.h>
+
+#include "fetch_hints.h"
+#include "path.h"
+
+namespace{
+
+const size_t TAR_BLOCK = 512;
+
+//Unit files are fetched in, File_Data::read is called once per block
+const size_t EXPORT_BLOCK = 1024 * 1024;
+
+//Writes value as a NUL terminated octal field, or in the GNU base-256 form
+//if it does not fit
+void octal(char *field, const size_t &width, uint64_t value){
+    if(value >= (1ull << (3 * (width - 1)))){
+        std::memset(field, 0, width);
+        for(size_t i = width; (i-- > 1) && (value > 0);){
+            field[i] = value & 0xff;
+            value >>= 8;
+        }
+        field[0] = (char)0x80;
+        return;
+    }
+    field[width - 1] = '\0';
+    for(size_t i = width - 1; i-- > 0;){
+        field[i] = '0' + (value & 7);
+        value >>= 3;
+    }
+}
+
+}
+
+Export::Export(const std::shared_ptr<Object_Store> &backend, const size_t &window, std::ostream &out, std::ostream &err):
+    _backend(backend),
+    _window(window),
+    _out(out),
+    _err(err),
+    _file_data(backend, false)
+{
+}
+
+uint64_t Export::run(const std::string &prefix, const std::string &path){
+    const Path top_path(path.c_str());
+    auto top = std::make_shared<Entry_Fetch>();
+    top->name = top_path.empty() ? "." : top_path.last().str();
+    top->log_ref = _resolve(prefix, path);
+
+    Work_Pool pool(_window);
+
+    //Entries are fetched up to window ahead of the one being written. The
+    //walk can only go into a directory once it has been fetched, as its
+    //children come next, but entries whose recorded mode says they are not
+    //directories are passed at once, and while a directory is fetched the
+    //entries after it in the directories above are fetched early. Only the
+    //directories on the path to the last entry walked are held, however
+    //wide the tree is.
+    struct Frame {
+        std::shared_ptr<Entry_Fetch> dir;
+        int next;
+        //Children from next on fetched before the walk got to them
+        std::deque<std::shared_ptr<Entry_Fetch>> early;
+    };
+    std::vector<Frame> frames;
+    std::deque<std::shared_ptr<Entry_Fetch>> ahead;
+    size_t early = 0;
+    std::shared_ptr<Entry_Fetch> last = top;
+    bool last_walked = false;
+    //Set when the walk stopped at a directory still being fetched
+    bool blocked = false;
+    ahead.push_back(top);
+    pool.submit([this, top](){
+        _fetch(*top);
+    });
+
+    const auto start = [&](const rtosfs::Entry &c, const std::string &dir_name){
+        auto child = std::make_shared<Entry_Fetch>();
+        child->name = dir_name + "/" + c.name();
+        child->log_ref = c.inode_ref();
+        child->mode = c.mode();
+        pool.submit([this, child](){
+            _fetch(*child);
+        });
+        return child;
+    };
+
+    const auto fetch_early = [&](){
+        for(auto f = frames.rbegin(); f != frames.rend(); ++f){
+            const int i = f->next + f->early.size();
+            if(i < f->dir->dir.entries_size()){
+                f->early.push_back(start(f->dir->dir.entries(i), f->dir->name));
+                early++;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    const auto fetch_ahead = [&](){
+        blocked = false;
+        while(ahead.size() + early < _window){
+            if(!last_walked){
+                //Legacy entries record no mode, so may be directories
+                const bool maybe_dir = (last->mode == 0) || S_ISDIR(last->mode);
+                if(maybe_dir){
+                    bool ready;
+                    {
+                        std::lock_guard<std::mutex> l(_lock);
+                        ready = last->ready;
+                    }
+                    if(!ready){
+                        if(!fetch_early()){
+                            blocked = true;
+                            return;
+                        }
+                        continue;
+                    }
+                    if( last->ok && (last->inode.type == NODE_DIR) ){
+                        frames.push_back(Frame{last, 0, {}});
+                    }
+                }
+                last_walked = true;
+            }
+
+            while( !frames.empty() && (frames.back().next >= frames.back().dir->dir.entries_size()) ){
+                frames.pop_back();
+            }
+            if(frames.empty()){
+                return;
+            }
+
+            Frame &f = frames.back();
+            std::shared_ptr<Entry_Fetch> child;
+            if(!f.early.empty()){
+                child = f.early.front();
+                f.early.pop_front();
+                early--;
+            }
+            else{
+                child = start(f.dir->dir.entries(f.next), f.dir->name);
+            }
+            f.next++;
+            ahead.push_back(child);
+            last = child;
+            last_walked = false;
+        }
+    };
+
+    for(;;){
+        //The entry just written is always fetched, so this only comes back
+        //empty once the walk is done
+        fetch_ahead();
+        if(ahead.empty()){
+            break;
+        }
+
+        //The walk goes on as soon as the directory it stopped at is in
+        const auto e = ahead.front();
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _ready.wait(l, [&](){ return e->ready || (blocked && last->ready); });
+            if(!e->ready){
+                continue;
+            }
+        }
+        ahead.pop_front();
+
+        if(!e->ok){
+            _errors++;
+            _err << e->name << ": cannot read node" << std::endl;
+            continue;
+        }
+
+        if(e->inode.type == NODE_DIR){
+            _header(e->name + "/", e->inode, '5', 0, "");
+        }
+        else if(e->inode.type == NODE_SYM){
+            _header(e->name, e->inode, '2', 0, e->target);
+        }
+        else{
+            if(e->inode.st_nlink > 1){
+                const auto first = _linked.find(e->log_ref);
+                if(first != _linked.end()){
+                    _header(e->name, e->inode, '1', 0, first->second);
+                    continue;
+                }
+                _linked[e->log_ref] = e->name;
+            }
+            _write_file(pool, *e);
+        }
+    }
+
+    const char end[2 * TAR_BLOCK] = {};
+    _out.write(end, sizeof(end));
+    _out.flush();
+    return _errors;
+}
+
+void Export::_fetch(Entry_Fetch &e){
+    try{
+        e.inode = fetch_inode(*_backend, Ref(e.log_ref.c_str(), 32));
+        if(e.inode.type == NODE_DIR){
+            e.dir.ParseFromString(fetch_immutable(*_backend, Ref(e.inode.data_ref, 32)).data());
+        }
+        else if(e.inode.type == NODE_SYM){
+            e.target = fetch_immutable(*_backend, Ref(e.inode.data_ref, 32)).data();
+        }
+        else{
+            try{
+                e.first_block.resize(std::min((uint64_t)e.inode.st_size, (uint64_t)EXPORT_BLOCK));
+                const size_t read = _file_data.read(e.inode, &e.first_block[0], e.first_block.size(), 0);
+                e.data_ok = (read == e.first_block.size());
+            }
+            catch(...){
+                e.data_ok = false;
+            }
+        }
+        e.ok = true;
+    }
+    catch(...){
+        e.ok = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        e.ready = true;
+    }
+    _ready.notify_all();
+}
+
+void Export::_fetch_block(const Inode &inode, Block_Fetch &b){
+    try{
+        b.data.resize(b.size);
+        b.ok = (_file_data.read(inode, &b.data[0], b.size, b.off) == b.size);
+    }
+    catch(...){
+        b.ok = false;
+    }
+
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        b.ready = true;
+    }
+    _ready.notify_all();
+}
+
+void Export::_write_file(Work_Pool &pool, Entry_Fetch &e){
+    const uint64_t size = e.inode.st_size;
+    _header(e.name, e.inode, '0', size, "");
+
+    bool ok = e.data_ok;
+    _out.write(e.first_block.data(), e.first_block.size());
+    uint64_t written = e.first_block.size();
+    std::string().swap(e.first_block);
+
+    const Inode inode = e.inode;
+    std::deque<std::shared_ptr<Block_Fetch>> blocks;
+    uint64_t next = written;
+    while(written < size){
+        for(; (blocks.size() < _window) && (next < size); next += blocks.back()->size){
+            auto b = std::make_shared<Block_Fetch>();
+            b->off = next;
+            b->size = std::min(size - next, (uint64_t)EXPORT_BLOCK);
+            blocks.push_back(b);
+            pool.submit([this, inode, b](){
+                _fetch_block(inode, *b);
+            });
+        }
+
+        const auto b = blocks.front();
+        blocks.pop_front();
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _ready.wait(l, [&b](){ return b->ready; });
+        }
+        if(!b->ok){
+            //The header is already out, so the size has to be made up
+            ok = false;
+            b->data.assign(b->size, '\0');
+        }
+        _out.write(b->data.data(), b->size);
+        written += b->size;
+    }
+    _pad(size);
+
+    if(!ok){
+        _errors++;
+        _err << e.name << ": data could not be read in full, missing parts are zeros" << std::endl;
+    }
+}
+
+void Export::_header(const std::string &name, const Inode &inode, const char &type, const uint64_t &size, const std::string &link){
+    if(name.size() > 100){
+        _long_name('L', name);
+    }
+    if(link.size() > 100){
+        _long_name('K', link);
+    }
+
+    char h[TAR_BLOCK] = {};
+    std::memcpy(h, name.data(), std::min(name.size(), (size_t)100));
+    octal(h + 100, 8, inode.st_mode & 07777);
+    octal(h + 108, 8, inode.st_uid);
+    octal(h + 116, 8, inode.st_gid);
+    octal(h + 124, 12, size);
+    octal(h + 136, 12, std::max(inode.st_mtim.tv_sec, (time_t)0));
+    h[156] = type;
+    std::memcpy(h + 157, link.data(), std::min(link.size(), (size_t)100));
+    std::memcpy(h + 257, "ustar", 6);
+    std::memcpy(h + 263, "00", 2);
+
+    std::memset(h + 148, ' ', 8);
+    uint64_t sum = 0;
+    for(const auto &c: h){
+        sum += (unsigned char)c;
+    }
+    octal(h + 148, 7, sum);
+    h[155] = ' ';
+
+    _out.write(h, sizeof(h));
+}
+
+void Export::_long_name(const char &type, const std::string &name){
+    Inode inode;
+    std::memset(&inode, 0, sizeof(inode));
+    _header("././@LongLink", inode, type, name.size() + 1, "");
+    _out.write(name.c_str(), name.size() + 1);
+    _pad(name.size() + 1);
+}
+
+void Export::_pad(const uint64_t &size){
+    const char zeros[TAR_BLOCK] = {};
+    const size_t rem = size % TAR_BLOCK;
+    if(rem != 0){
+        _out.write(zeros, TAR_BLOCK - rem);
+    }
+}
+
+std::string Export::_resolve(const std::string &prefix, const std::string &path){
+    std::string log_ref(Ref(prefix).buf(), 32);
+    for(const auto &name: Path(path.c_str())){
+        const Inode inode = fetch_inode(*_backend, Ref(log_ref.c_str(), 32));
+        if(inode.type != NODE_DIR){
+            throw E_OBJECT_DNE();
+        }
+
+        rtosfs::Directory dir;
+        dir.ParseFromString(fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data());
+        bool found = false;
+        for(const auto &e: dir.entries()){
+            if(name == e.name()){
+                log_ref = e.inode_ref();
+                found = true;
+                break;
+            }
+        }
+        if(!found){
+            throw E_OBJECT_DNE();
+        }
+    }
+    return log_ref;
+}
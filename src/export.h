@@ -0,0 +1,100 @@
+#ifndef __EXPORT_H__
+#define __EXPORT_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+#include "disk_format.pb.h"
+#include "file_data.h"
+#include "inode.h"
+#include "work_pool.h"
+
+/* Streams a subtree as a tar archive, read directly from the object store.
+ *
+ * Entries are written depth first. Inodes, directories, symlink targets
+ * and the first block of each file are fetched by a pool of workers up to
+ * window entries ahead of the one being written, and the rest of a file is
+ * fetched up to window blocks ahead, so at most about 2 * window requests
+ * and blocks are outstanding however large the tree and its files are.
+ * Entries the parent directory records as not being directories are
+ * passed without waiting for their inodes, and while the walk waits for a
+ * directory the entries after it are fetched, so a wide directory keeps
+ * the window full. Besides those only the directories on the path being
+ * walked are held.
+ *
+ * The archive is ustar with the GNU extensions for long names and sizes
+ * over 8GiB. Nodes linked more than once in the subtree are written once
+ * followed by hard links to the first path.
+ */
+class Export {
+
+    public:
+        Export(const std::shared_ptr<Object_Store> &backend, const size_t &window, std::ostream &out, std::ostream &err);
+
+        //Writes the subtree at path of the File System at prefix to out,
+        //returns the number of entries that could not be read in full. Throws
+        //E_OBJECT_DNE if path does not exist.
+        uint64_t run(const std::string &prefix, const std::string &path);
+
+    private:
+        struct Entry_Fetch {
+            std::string name;
+            std::string log_ref;
+            //As recorded in the parent's entry, 0 if unknown
+            uint32_t mode = 0;
+
+            //Set by the fetch
+            bool ready = false;
+            bool ok = false;
+            Inode inode;
+            rtosfs::Directory dir;
+            std::string target;
+            std::string first_block;
+            bool data_ok = true;
+        };
+
+        struct Block_Fetch {
+            uint64_t off;
+            size_t size;
+
+            //Set by the fetch
+            bool ready = false;
+            bool ok = false;
+            std::string data;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        const size_t _window;
+        std::ostream &_out;
+        std::ostream &_err;
+        File_Data _file_data;
+
+        //Fetches signal completion through one condition variable, only
+        //the writer waits on it
+        std::mutex _lock;
+        std::condition_variable _ready;
+
+        //First name written for each node linked more than once
+        std::unordered_map<std::string, std::string> _linked;
+        uint64_t _errors = 0;
+
+        void _fetch(Entry_Fetch &e);
+        void _fetch_block(const Inode &inode, Block_Fetch &b);
+        void _write_file(Work_Pool &pool, Entry_Fetch &e);
+
+        void _header(const std::string &name, const Inode &inode, const char &type, const uint64_t &size, const std::string &link);
+        void _long_name(const char &type, const std::string &name);
+        void _pad(const uint64_t &size);
+
+        std::string _resolve(const std::string &prefix, const std::string &path);
+
+};
+
+#endif
@@ -0,0 +1,164 @@
+#include "fault_store.h"
+
+#include <algorithm>
+#include <thread>
+
+namespace{
+
+//Sleeps overshoot by tens of microseconds, the last of a delay is spun
+const std::chrono::microseconds SPIN(100);
+
+}
+
+LATENCY_DISTRIBUTION distribution_from_name(const std::string &name){
+    if(name == "constant"){
+        return LATENCY_CONSTANT;
+    }
+    else if(name == "uniform"){
+        return LATENCY_UNIFORM;
+    }
+    else if(name == "exponential"){
+        return LATENCY_EXPONENTIAL;
+    }
+    else if(name == "normal"){
+        return LATENCY_NORMAL;
+    }
+    else{
+        throw E_BAD_DISTRIBUTION();
+    }
+}
+
+bool Fault_Options::enabled() const{
+    return (latency.count() > 0) || (jitter.count() > 0) || (bandwidth > 0) || (fetch_errors > 0.0) || (write_errors > 0.0);
+}
+
+Fault_Arguments::Fault_Arguments(boost::program_options::options_description &desc, const std::string &target){
+    namespace po = boost::program_options;
+    desc.add_options()
+        ("fault-latency", po::value<uint64_t>(&_latency), ("Microseconds added to every request to " + target + ", for testing").c_str())
+        ("fault-jitter", po::value<uint64_t>(&_jitter), "Microseconds of variation in --fault-latency, its meaning depends on --fault-distribution")
+        ("fault-distribution", po::value<std::string>(&_distribution), "Distribution of added latency, constant, uniform, exponential or normal")
+        ("fault-bandwidth", po::value<uint64_t>(&_options.bandwidth), ("Bytes per second all requests to " + target + " share, 0 is unlimited").c_str())
+        ("fault-fetch-errors", po::value<double>(&_options.fetch_errors), "Fraction of fetches that fail")
+        ("fault-write-errors", po::value<double>(&_options.write_errors), "Fraction of stores and appends that fail")
+        ("fault-seed", po::value<uint64_t>(&_options.seed), "Seed for added latency and failures")
+    ;
+}
+
+Fault_Options Fault_Arguments::options() const{
+    Fault_Options options = _options;
+    options.latency = std::chrono::microseconds(_latency);
+    options.jitter = std::chrono::microseconds(_jitter);
+    options.distribution = distribution_from_name(_distribution);
+    return options;
+}
+
+Fault_Store::Fault_Store(const std::shared_ptr<Object_Store> &backend, const Fault_Options &options):
+    _backend(backend),
+    _options(options),
+    _random(options.seed),
+    _link_free(std::chrono::steady_clock::now())
+{
+}
+
+void Fault_Store::store(const Ref &ref, const Object &obj){
+    const bool fail = _fail(_options.write_errors);
+    if(!fail){
+        _backend->store(ref, obj);
+    }
+    _delay(obj.data().size());
+    if(fail){
+        throw E_OBJECT_DNE();
+    }
+}
+
+Object Fault_Store::fetch(const Ref &ref){
+    if(_fail(_options.fetch_errors)){
+        _delay(0);
+        throw E_OBJECT_DNE();
+    }
+    const Object o = _backend->fetch(ref);
+    _delay(o.data().size());
+    return o;
+}
+
+Object Fault_Store::fetch(const Ref &ref, const size_t &start, const size_t &end){
+    if(_fail(_options.fetch_errors)){
+        _delay(0);
+        throw E_OBJECT_DNE();
+    }
+    const Object o = _backend->fetch(ref, start, end);
+    _delay(o.data().size());
+    return o;
+}
+
+Object Fault_Store::fetch_tail(const Ref &ref, const size_t &num_bytes){
+    if(_fail(_options.fetch_errors)){
+        _delay(0);
+        throw E_OBJECT_DNE();
+    }
+    const Object o = _backend->fetch_tail(ref, num_bytes);
+    _delay(o.data().size());
+    return o;
+}
+
+void Fault_Store::fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf){
+    if(_fail(_options.fetch_errors)){
+        _delay(0);
+        throw E_OBJECT_DNE();
+    }
+    _backend->fetch_tail(ref, num_bytes, buf);
+    _delay(num_bytes);
+}
+
+void Fault_Store::append(const Ref &ref, const char *data, const size_t &size){
+    const bool fail = _fail(_options.write_errors);
+    if(!fail){
+        _backend->append(ref, data, size);
+    }
+    _delay(size);
+    if(fail){
+        throw E_OBJECT_DNE();
+    }
+}
+
+bool Fault_Store::_fail(const double &rate){
+    if(rate <= 0.0){
+        return false;
+    }
+    std::lock_guard<std::mutex> l(_lock);
+    return std::uniform_real_distribution<double>(0.0, 1.0)(_random) < rate;
+}
+
+void Fault_Store::_delay(const size_t &bytes){
+    const auto now = std::chrono::steady_clock::now();
+    auto deadline = now;
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        if( (_options.bandwidth > 0) && (bytes > 0) ){
+            const std::chrono::nanoseconds transfer((uint64_t)((double)bytes / _options.bandwidth * 1e9));
+            _link_free = std::max(_link_free, now) + transfer;
+            deadline = _link_free;
+        }
+
+        const double latency = _options.latency.count();
+        const double jitter = _options.jitter.count();
+        double delay = latency;
+        if( (_options.distribution == LATENCY_UNIFORM) && (jitter > 0.0) ){
+            delay += std::uniform_real_distribution<double>(0.0, jitter)(_random);
+        }
+        else if( (_options.distribution == LATENCY_EXPONENTIAL) && (jitter > 0.0) ){
+            delay += std::exponential_distribution<double>(1.0 / jitter)(_random);
+        }
+        else if( (_options.distribution == LATENCY_NORMAL) && (jitter > 0.0) ){
+            delay = std::max(0.0, std::normal_distribution<double>(latency, jitter)(_random));
+        }
+        deadline += std::chrono::nanoseconds((uint64_t)(delay * 1000.0));
+    }
+
+    if(deadline - now > SPIN){
+        std::this_thread::sleep_until(deadline - SPIN);
+    }
+    while(std::chrono::steady_clock::now() < deadline){
+    }
+}
@@ -0,0 +1,104 @@
+#ifndef __FAULT_STORE_H__
+#define __FAULT_STORE_H__
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <boost/program_options.hpp>
+#include <rtos/object_store.h>
+
+enum LATENCY_DISTRIBUTION{
+    LATENCY_CONSTANT,       //latency
+    LATENCY_UNIFORM,        //latency plus up to jitter
+    LATENCY_EXPONENTIAL,    //latency plus exponential with mean jitter
+    LATENCY_NORMAL          //mean latency, standard deviation jitter
+};
+
+class E_BAD_DISTRIBUTION {};
+
+//Throws E_BAD_DISTRIBUTION for names other than constant, uniform,
+//exponential and normal
+LATENCY_DISTRIBUTION distribution_from_name(const std::string &name);
+
+struct Fault_Options {
+    LATENCY_DISTRIBUTION distribution = LATENCY_CONSTANT;
+    std::chrono::microseconds latency = std::chrono::microseconds(0);
+    std::chrono::microseconds jitter = std::chrono::microseconds(0);
+
+    //Bytes per second all requests share, 0 is unlimited
+    uint64_t bandwidth = 0;
+
+    //Chance each fetch or fetch_tail, and each store or append, fails
+    double fetch_errors = 0.0;
+    double write_errors = 0.0;
+
+    //Same seed, same delays and failures for the same sequence of requests
+    uint64_t seed = 0;
+
+    //False if a Fault_Store would change nothing
+    bool enabled() const;
+};
+
+/* The --fault-* command line options of every program that can run over a
+ * Fault_Store.
+ *
+ * Options are added to desc on construction and parsed into this object, so
+ * it must outlive po::notify. target names what requests are sent to in the
+ * help text.
+ */
+class Fault_Arguments {
+
+    public:
+        Fault_Arguments(boost::program_options::options_description &desc, const std::string &target);
+
+        //Throws E_BAD_DISTRIBUTION for an unknown --fault-distribution
+        Fault_Options options() const;
+
+    private:
+        Fault_Options _options;
+        uint64_t _latency = 0;
+        uint64_t _jitter = 0;
+        std::string _distribution = "constant";
+
+};
+
+/* Object_Store decorator slowing down and failing requests to its backend,
+ * to measure how the File System behaves over a slower or less reliable
+ * rtosd than the one at hand.
+ *
+ * Every request is delayed by a latency drawn from the configured
+ * distribution, after the backend has served it. With a bandwidth, requests
+ * also queue for a single link shared by all of them and take as long as
+ * their bytes need to cross it. Failed requests never reach the backend,
+ * they cost the same latency and throw E_OBJECT_DNE, which is all rtosd
+ * reports besides losing the connection.
+ */
+class Fault_Store : public Object_Store {
+
+    public:
+        Fault_Store(const std::shared_ptr<Object_Store> &backend, const Fault_Options &options);
+
+        void store(const Ref &ref, const Object &obj);
+        Object fetch(const Ref &ref);
+        Object fetch(const Ref &ref, const size_t &start, const size_t &end);
+        Object fetch_tail(const Ref &ref, const size_t &num_bytes);
+        void fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf);
+        void append(const Ref &ref, const char *data, const size_t &size);
+
+    private:
+        std::shared_ptr<Object_Store> _backend;
+        const Fault_Options _options;
+
+        std::mutex _lock;
+        std::mt19937_64 _random;
+        //When the link is done with every transfer queued on it so far
+        std::chrono::steady_clock::time_point _link_free;
+
+        bool _fail(const double &rate);
+        void _delay(const size_t &bytes);
+
+};
+
+#endif
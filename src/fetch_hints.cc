@@ -0,0 +1,41 @@
+#include "fetch_hints.h"
+
+namespace{
+
+thread_local bool immutable = false;
+thread_local bool stale = false;
+
+}
+
+Immutable_Fetch::Immutable_Fetch():
+    _outer(immutable)
+{
+    immutable = true;
+}
+
+Immutable_Fetch::~Immutable_Fetch(){
+    immutable = _outer;
+}
+
+bool Immutable_Fetch::active(){
+    return immutable;
+}
+
+Stale_Fetch::Stale_Fetch():
+    _outer(stale)
+{
+    stale = true;
+}
+
+Stale_Fetch::~Stale_Fetch(){
+    stale = _outer;
+}
+
+bool Stale_Fetch::active(){
+    return stale;
+}
+
+Object fetch_immutable(Object_Store &backend, const Ref &ref){
+    const Immutable_Fetch hint;
+    return backend.fetch(ref);
+}
@@ -0,0 +1,56 @@
+#ifndef __FETCH_HINTS_H__
+#define __FETCH_HINTS_H__
+
+#include <rtos/object_store.h>
+
+/* What a caller allows the stores below it to do with a fetch, which
+ * Object_Store has no way to say.
+ *
+ * Hints apply to the fetches the calling thread makes while a hint object
+ * exists. Decorators read them on the caller's thread before doing anything
+ * else. A fetch made without a hint is served by the primary, and never
+ * from a copy kept from before.
+ */
+class Immutable_Fetch {
+
+    public:
+        //Whole objects fetched meanwhile are never appended to, so they may
+        //be kept indefinitely and read from any replica that has them
+        Immutable_Fetch();
+        ~Immutable_Fetch();
+
+        Immutable_Fetch(const Immutable_Fetch &) = delete;
+        Immutable_Fetch &operator=(const Immutable_Fetch &) = delete;
+
+        static bool active();
+
+    private:
+        const bool _outer;
+
+};
+
+class Stale_Fetch {
+
+    public:
+        //Tails fetched meanwhile may be as old as a cache lease allows, so
+        //may be read from any replica that has the object, even one that
+        //has not caught up with the latest appends yet
+        Stale_Fetch();
+        ~Stale_Fetch();
+
+        Stale_Fetch(const Stale_Fetch &) = delete;
+        Stale_Fetch &operator=(const Stale_Fetch &) = delete;
+
+        static bool active();
+
+    private:
+        const bool _outer;
+
+};
+
+//Fetches ref whole under an Immutable_Fetch. Directories, xattr
+//dictionaries, chunk lists, chunks and symlink targets are never appended
+//to, inode logs, plain file data and superblock logs are.
+Object fetch_immutable(Object_Store &backend, const Ref &ref);
+
+#endif
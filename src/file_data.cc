@@ -0,0 +1,542 @@
+#include "file_data.h"
+
+#include "fetch_hints.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <sodium.h>
+
+namespace{
+
+const size_t CHUNK_MIN = 16 * 1024;
+const size_t CHUNK_AVG = 64 * 1024;
+const size_t CHUNK_MAX = 256 * 1024;
+
+static_assert(crypto_generichash_BYTES == 32, "Chunk refs are BLAKE2b-256 hashes");
+
+//Chunk refs are BLAKE2b keyed by the codec the chunk is stored with, so no
+//two encodings share a ref. Keyed hashes never match the unkeyed ones
+//older chunks were stored under, whatever their contents.
+const char CHUNK_KEY_DOMAIN[] = "rtosfs-chunk-v2";
+
+std::string chunk_key(const CODEC &codec){
+    std::string key(CHUNK_KEY_DOMAIN, sizeof(CHUNK_KEY_DOMAIN) - 1);
+    key.push_back((char)codec);
+    return key;
+}
+
+static_assert(sizeof(CHUNK_KEY_DOMAIN) >= crypto_generichash_KEYBYTES_MIN, "Chunk keys are too short for BLAKE2b");
+
+//Holes have no object at all, extents are part of a larger object. Both
+//can be cut anywhere without touching their data.
+bool is_hole(const rtosfs::Chunk &c){
+    return c.ref().empty();
+}
+
+bool splittable(const rtosfs::Chunk &c){
+    return c.extent() || is_hole(c);
+}
+
+rtosfs::Chunk hole(const uint64_t &length){
+    rtosfs::Chunk c;
+    c.set_length(length);
+    return c;
+}
+
+std::shared_ptr<Chunk_Map> make_chunk_map(const rtosfs::Chunk_List &list){
+    std::shared_ptr<Chunk_Map> map(new Chunk_Map());
+    map->list = list;
+    map->starts.reserve(list.chunks_size() + 1);
+    uint64_t start = 0;
+    for(const auto &c: list.chunks()){
+        map->starts.push_back(start);
+        start += c.length();
+        if(!is_hole(c)){
+            map->allocated += c.length();
+        }
+    }
+    map->starts.push_back(start);
+    return map;
+}
+
+}
+
+size_t Chunk_Map::find(const uint64_t &off) const{
+    if(off >= starts.back()){
+        return list.chunks_size();
+    }
+    const auto i = std::upper_bound(starts.begin(), starts.end() - 1, off);
+    return (i - starts.begin()) - 1;
+}
+
+uint64_t Pending_Appends::end() const{
+    return start + chunked + tail.size();
+}
+
+File_Data::File_Data(const std::shared_ptr<Object_Store> &backend, const bool &chunking):
+    _backend(backend),
+    _chunking(chunking),
+    _chunker(CHUNK_MIN, CHUNK_AVG, CHUNK_MAX),
+    _chunk_maps(1024),
+    _chunks(64),
+    _known_chunks(65536)
+{
+    const auto r = sodium_init();
+    assert(r >= 0);
+    (void)r;
+}
+
+void File_Data::init(Inode &inode, const CODEC &codec){
+    inode.st_size = 0;
+    if(_chunking || (codec != CODEC_NONE)){
+        inode.type = NODE_CHUNKED;
+        rtosfs::Chunk_List list;
+        list.set_codec(codec);
+        _store_chunk_map(inode, list);
+    }
+    else{
+        inode.type = NODE_FILE;
+        const Ref new_file_ref = Ref();
+        _backend->store(new_file_ref, Object(""));
+        std::memcpy(inode.data_ref, new_file_ref.buf(), 32);
+    }
+}
+
+size_t File_Data::read(const Inode &inode, char *buf, const size_t &size, const off_t &off){
+    if(inode.type != NODE_CHUNKED){
+        if(inode.st_size <= off){
+            return 0;
+        }
+        //Only fetch the range being read, readahead relies on this being cheap
+        const size_t bytes_to_copy = std::min(size, (size_t)(inode.st_size - off));
+        const Object range = _backend->fetch(Ref(inode.data_ref, 32), off, off + bytes_to_copy);
+        if(range.data().size() != bytes_to_copy){
+            throw E_BAD_CHUNK();
+        }
+        std::memcpy(buf, range.data().data(), bytes_to_copy);
+        return bytes_to_copy;
+    }
+
+    return _read_chunked(*_chunk_map(inode), buf, size, off);
+}
+
+uint64_t File_Data::allocated(const Inode &inode){
+    if(inode.type != NODE_CHUNKED){
+        return inode.st_size;
+    }
+    return _chunk_map(inode)->allocated;
+}
+
+size_t File_Data::_read_chunked(const Chunk_Map &map, char *buf, const size_t &size, const uint64_t &off){
+    const uint64_t end = std::min(off + size, map.starts.back());
+    uint64_t pos = off;
+    size_t copied = 0;
+    for(size_t i = map.find(pos); pos < end; i++){
+        const auto &c = map.list.chunks(i);
+        const uint64_t in_chunk = pos - map.starts[i];
+        const size_t n = std::min(end - pos, c.length() - in_chunk);
+        if(is_hole(c)){
+            std::memset(buf + copied, 0, n);
+        }
+        else if(c.extent()){
+            const uint64_t start = c.offset() + in_chunk;
+            const std::string range = _backend->fetch(Ref(c.ref().c_str(), 32), start, start + n).data();
+            if(range.size() != n){
+                throw E_BAD_CHUNK();
+            }
+            std::memcpy(buf + copied, range.data(), n);
+        }
+        else{
+            const auto chunk = _chunk(c);
+            std::memcpy(buf + copied, chunk->data() + in_chunk, n);
+        }
+        copied += n;
+        pos += n;
+    }
+    return copied;
+}
+
+void File_Data::write(Inode &inode, const char *buf, const size_t &size, const off_t &off){
+    if(size == 0){
+        return;
+    }
+
+    if(inode.type != NODE_CHUNKED){
+        if(off == inode.st_size){
+            //TODO: Possible security hole, re-using the ref when appending can leak information if we allow the fetching of underlying ref via xattr and subsequent direct queries of the object store
+            //A straight append
+            _backend->append(Ref(inode.data_ref, 32), buf, size);
+            inode.st_size = inode.st_size + size;
+            return;
+        }
+        else if(off < inode.st_size){
+            //Rewriting a portion of the file
+            std::string current_file = _backend->fetch(Ref(inode.data_ref, 32), 0, inode.st_size).data();
+            current_file.resize(std::max(off + size, current_file.size()));
+            std::memcpy(&current_file[off], buf, size);
+
+            const Ref new_data_ref = Ref();
+            _backend->store(new_data_ref, Object(current_file));
+
+            inode.st_size = current_file.size();
+            std::memcpy(inode.data_ref, new_data_ref.buf(), 32);
+            return;
+        }
+        else{
+            //Writing past the end leaves a hole, which only chunked files can record
+            _to_chunked(inode);
+        }
+    }
+
+    const auto map = _chunk_map(inode);
+    const uint64_t file_size = map->starts.back();
+    if((uint64_t)off > file_size){
+        _splice(inode, *map, file_size, file_size, off - file_size, std::string(buf, size));
+    }
+    else{
+        _splice(inode, *map, off, std::min(file_size, (uint64_t)off + size), 0, std::string(buf, size));
+    }
+    inode.st_size = std::max((uint64_t)inode.st_size, (uint64_t)off + size);
+}
+
+void File_Data::truncate(Inode &inode, const off_t &size){
+    if(inode.type != NODE_CHUNKED){
+        if(size < inode.st_size){
+            //TODO:Replace with Object Store mutation tech?
+            std::string file = _backend->fetch(Ref(inode.data_ref, 32), 0, inode.st_size).data();
+            file.resize(size);
+
+            Ref new_data_ref = Ref();
+            _backend->store(new_data_ref, Object(file));
+            std::memcpy(inode.data_ref, new_data_ref.buf(), 32);
+
+            inode.st_size = size;
+            return;
+        }
+        _to_chunked(inode);
+    }
+
+    const auto map = _chunk_map(inode);
+    const uint64_t file_size = map->starts.back();
+    if((uint64_t)size < file_size){
+        _splice(inode, *map, size, file_size, 0, "");
+    }
+    else{
+        _splice(inode, *map, file_size, file_size, size - file_size, "");
+    }
+    inode.st_size = size;
+}
+
+void File_Data::begin_appends(const Inode &inode, Pending_Appends &pending){
+    assert(inode.type == NODE_CHUNKED);
+    const auto map = _chunk_map(inode);
+    const size_t count = map->list.chunks_size();
+
+    pending = Pending_Appends();
+    pending.base.assign(inode.data_ref, 32);
+    pending.codec = (CODEC)map->list.codec();
+    pending.first = count;
+    pending.start = map->starts.back();
+
+    //As in _splice, so files built by appending are cut the same way as
+    //files written in one go
+    if( (count > 0) && !splittable(map->list.chunks(count - 1)) ){
+        pending.first = count - 1;
+        pending.start = map->starts[count - 1];
+        pending.tail = *_chunk(map->list.chunks(count - 1));
+    }
+}
+
+void File_Data::append(Pending_Appends &pending, const char *buf, const size_t &size){
+    pending.tail.append(buf, size);
+
+    //A cut point found before the end of the data never moves whatever is
+    //appended after it, and there is always one within max_size
+    size_t pos = 0;
+    while(pending.tail.size() - pos >= _chunker.max_size()){
+        const size_t length = _chunker.cut(pending.tail.data() + pos, pending.tail.size() - pos);
+        pending.chunks.push_back(_store_chunk(pending.tail.data() + pos, length, pending.codec));
+        pending.chunked += length;
+        pos += length;
+    }
+    pending.tail.erase(0, pos);
+}
+
+void File_Data::commit_appends(Inode &inode, Pending_Appends &pending){
+    assert(inode.type == NODE_CHUNKED);
+    const auto map = _chunk_map(inode);
+    if( (pending.base.compare(0, std::string::npos, inode.data_ref, 32) == 0) && (pending.first <= (size_t)map->list.chunks_size()) ){
+        std::vector<rtosfs::Chunk> replacement(pending.chunks);
+        _chunk_region(pending.tail, pending.codec, replacement);
+        _rewrite(inode, *map, pending.first, map->list.chunks_size(), replacement);
+        inode.st_size = pending.end();
+    }
+    else{
+        //Another mount rewrote the file since, write the appends over whatever
+        //it has now like any other write
+        std::string data;
+        for(const auto &c: pending.chunks){
+            data.append(*_chunk(c));
+        }
+        data.append(pending.tail);
+        write(inode, data.data(), data.size(), pending.start);
+    }
+    begin_appends(inode, pending);
+}
+
+void File_Data::zero(Inode &inode, const off_t &off, const off_t &length, const bool &keep_size){
+    if(inode.type != NODE_CHUNKED){
+        _to_chunked(inode);
+    }
+
+    const auto map = _chunk_map(inode);
+    const uint64_t file_size = map->starts.back();
+    const uint64_t end = keep_size ? std::min(file_size, (uint64_t)(off + length)) : off + length;
+    if((uint64_t)off >= end){
+        return;
+    }
+
+    if((uint64_t)off > file_size){
+        _splice(inode, *map, file_size, file_size, end - file_size, "");
+    }
+    else{
+        _splice(inode, *map, off, std::min(file_size, end), end - off, "");
+    }
+    inode.st_size = std::max((uint64_t)inode.st_size, end);
+}
+
+void File_Data::clone(const Inode &source, Inode &clone){
+    clone.type = source.type;
+    clone.st_size = source.st_size;
+    std::memcpy(clone.data_ref, source.data_ref, 32);
+
+    //Chunk lists are never modified, so chunked files simply share one until
+    //either is written
+    if(clone.type != NODE_CHUNKED){
+        _to_chunked(clone);
+    }
+}
+
+std::string File_Data::stats() const{
+    const uint64_t written = _stats.bytes_written;
+    const uint64_t uncompressed = _stats.bytes_uncompressed;
+    const uint64_t stored = _stats.bytes_stored;
+
+    std::stringstream out;
+    out << "chunks_written: " << _stats.chunks_written << std::endl;
+    out << "chunks_deduplicated: " << _stats.chunks_deduplicated << std::endl;
+    out << "bytes_written: " << written << std::endl;
+    out << "chunks_compressed: " << _stats.chunks_compressed << std::endl;
+    out << "bytes_uncompressed: " << uncompressed << std::endl;
+    out << "bytes_stored: " << stored << std::endl;
+    out << "dedup_ratio: " << (uncompressed == 0 ? 0.0 : (double)written / uncompressed) << std::endl;
+    out << "compression_ratio: " << (stored == 0 ? 0.0 : (double)uncompressed / stored) << std::endl;
+    return out.str();
+}
+
+std::shared_ptr<const Chunk_Map> File_Data::_chunk_map(const Inode &inode){
+    const Ref list_ref(inode.data_ref, 32);
+    auto map = _chunk_maps.get(list_ref);
+    if(!map){
+        rtosfs::Chunk_List list;
+        list.ParseFromString(fetch_immutable(*_backend, list_ref).data());
+        map = make_chunk_map(list);
+        _chunk_maps.put(list_ref, map);
+    }
+    return map;
+}
+
+std::shared_ptr<const std::string> File_Data::_chunk(const rtosfs::Chunk &chunk){
+    const Ref chunk_ref(chunk.ref().c_str(), 32);
+    auto data = _chunks.get(chunk_ref);
+    if(!data){
+        data = std::make_shared<const std::string>(decompress((CODEC)chunk.codec(), fetch_immutable(*_backend, chunk_ref).data(), chunk.length()));
+        _chunks.put(chunk_ref, data);
+    }
+    return data;
+}
+
+rtosfs::Chunk File_Data::_store_chunk(const char *data, const size_t &size, const CODEC &codec){
+    //Only keep the compressed form if it is actually smaller
+    std::string stored;
+    CODEC stored_codec = CODEC_NONE;
+    if(codec != CODEC_NONE){
+        stored = compress(codec, data, size);
+        if( (stored.size() > 0) && (stored.size() < size) ){
+            stored_codec = codec;
+        }
+    }
+    if(stored_codec == CODEC_NONE){
+        stored.assign(data, size);
+    }
+
+    //A chunk found by its ref must hold the encoding this one is stored in
+    unsigned char hash[crypto_generichash_BYTES];
+    {
+        const std::string key = chunk_key(stored_codec);
+        crypto_generichash(hash, sizeof(hash), (const unsigned char *)data, size, (const unsigned char *)key.data(), key.size());
+    }
+    const Ref chunk_ref((const char *)hash, 32);
+
+    _stats.chunks_written++;
+    _stats.bytes_written += size;
+
+    bool present = _known_chunks.get(chunk_ref) != nullptr;
+    if(!present){
+        //Asking for a single byte is far cheaper than sending the chunk
+        try{
+            _backend->fetch_tail(chunk_ref, 1);
+            present = true;
+        }
+        catch(E_OBJECT_DNE e){
+            _backend->store(chunk_ref, Object(stored));
+            _stats.bytes_uncompressed += size;
+            _stats.bytes_stored += stored.size();
+            if(stored_codec != CODEC_NONE){
+                _stats.chunks_compressed++;
+            }
+        }
+        _known_chunks.put(chunk_ref, std::make_shared<const bool>(true));
+    }
+    if(present){
+        _stats.chunks_deduplicated++;
+    }
+
+    rtosfs::Chunk chunk;
+    chunk.set_ref((const char *)hash, 32);
+    chunk.set_length(size);
+    chunk.set_codec(stored_codec);
+    chunk.set_stored_length(stored.size());
+    return chunk;
+}
+
+void File_Data::_store_chunk_map(Inode &inode, const rtosfs::Chunk_List &list){
+    std::string serialized_list;
+    list.SerializeToString(&serialized_list);
+    const Ref list_ref = Ref();
+    _backend->store(list_ref, Object(serialized_list));
+    _chunk_maps.put(list_ref, make_chunk_map(list));
+
+    std::memcpy(inode.data_ref, list_ref.buf(), 32);
+}
+
+void File_Data::_to_chunked(Inode &inode){
+    //Plain files are only ever appended to in place, so the range of the
+    //object the file currently covers never changes under the extent
+    rtosfs::Chunk_List list;
+    if(inode.st_size > 0){
+        auto extent = list.add_chunks();
+        extent->set_ref(inode.data_ref, 32);
+        extent->set_length(inode.st_size);
+        extent->set_extent(true);
+        extent->set_offset(0);
+    }
+    inode.type = NODE_CHUNKED;
+    _store_chunk_map(inode, list);
+}
+
+void File_Data::_splice(Inode &inode, const Chunk_Map &map, const uint64_t &from, const uint64_t &to, const uint64_t &hole_length, const std::string &data){
+    const size_t count = map.list.chunks_size();
+    const uint64_t file_size = map.starts.back();
+    const CODEC codec = (CODEC)map.list.codec();
+    assert(from <= to);
+    assert(to <= file_size);
+
+    //Only the chunks around [from, to) are rechunked. Writes at the end also
+    //take the last chunk, which is usually a short tail, so files built by
+    //appending are cut the same way as files written in one go.
+    size_t first = map.find(from);
+    if( (first == count) && (count > 0) && !splittable(map.list.chunks(count - 1)) ){
+        first = count - 1;
+    }
+    size_t last = map.find(to);
+    if( (last < count) && (to > map.starts[last]) ){
+        last++;
+    }
+    last = std::max(last, first);
+
+    //Holes and extents are cut in place, the parts of other chunks outside
+    //[from, to) are rechunked along with the new data
+    std::vector<rtosfs::Chunk> replacement;
+    std::string region;
+    if( (first < count) && (from > map.starts[first]) ){
+        const auto &c = map.list.chunks(first);
+        const uint64_t length = from - map.starts[first];
+        if(splittable(c)){
+            replacement.push_back(c);
+            replacement.back().set_length(length);
+        }
+        else{
+            region.resize(length);
+            _read_chunked(map, &region[0], length, map.starts[first]);
+        }
+    }
+    if(hole_length > 0){
+        _chunk_region(region, codec, replacement);
+        region.clear();
+        replacement.push_back(hole(hole_length));
+    }
+    region.append(data);
+    if( (last > 0) && (to < map.starts[last]) ){
+        const auto &c = map.list.chunks(last - 1);
+        const uint64_t length = map.starts[last] - to;
+        if(splittable(c)){
+            _chunk_region(region, codec, replacement);
+            region.clear();
+            replacement.push_back(c);
+            if(c.extent()){
+                replacement.back().set_offset(c.offset() + (to - map.starts[last - 1]));
+            }
+            replacement.back().set_length(length);
+        }
+        else{
+            const size_t region_size = region.size();
+            region.resize(region_size + length);
+            _read_chunked(map, &region[region_size], length, to);
+        }
+    }
+    _chunk_region(region, codec, replacement);
+
+    _rewrite(inode, map, first, last, replacement);
+}
+
+void File_Data::_chunk_region(const std::string &region, const CODEC &codec, std::vector<rtosfs::Chunk> &chunks){
+    for(size_t pos = 0; pos < region.size();){
+        const size_t length = _chunker.cut(region.data() + pos, region.size() - pos);
+        chunks.push_back(_store_chunk(region.data() + pos, length, codec));
+        pos += length;
+    }
+}
+
+void File_Data::_rewrite(Inode &inode, const Chunk_Map &map, const size_t &first, const size_t &last, const std::vector<rtosfs::Chunk> &replacement){
+    rtosfs::Chunk_List list;
+    list.set_codec(map.list.codec());
+
+    //Adjacent holes are merged into one
+    const auto add = [&](const rtosfs::Chunk &c){
+        if(c.length() == 0){
+            return;
+        }
+        const int n = list.chunks_size();
+        if( is_hole(c) && (n > 0) && is_hole(list.chunks(n - 1)) ){
+            auto previous = list.mutable_chunks(n - 1);
+            previous->set_length(previous->length() + c.length());
+        }
+        else{
+            *list.add_chunks() = c;
+        }
+    };
+
+    for(size_t i = 0; i < first; i++){
+        add(map.list.chunks(i));
+    }
+    for(const auto &c: replacement){
+        add(c);
+    }
+    for(size_t i = last; i < (size_t)map.list.chunks_size(); i++){
+        add(map.list.chunks(i));
+    }
+    _store_chunk_map(inode, list);
+}
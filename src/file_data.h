@@ -0,0 +1,149 @@
+#ifndef __FILE_DATA_H__
+#define __FILE_DATA_H__
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <rtos/object_store.h>
+
+#include "chunker.h"
+#include "compression.h"
+#include "disk_format.pb.h"
+#include "inode.h"
+#include "ref_cache.h"
+
+struct Dedup_Stats {
+    std::atomic<uint64_t> chunks_written{0};
+    std::atomic<uint64_t> chunks_deduplicated{0};
+    std::atomic<uint64_t> bytes_written{0};
+    std::atomic<uint64_t> chunks_compressed{0};
+    //Size of the chunks that were actually stored, before and after compression
+    std::atomic<uint64_t> bytes_uncompressed{0};
+    std::atomic<uint64_t> bytes_stored{0};
+};
+
+//A parsed Chunk_List along with the file offset each chunk starts at
+struct Chunk_Map {
+    rtosfs::Chunk_List list;
+    //starts[i] is the offset of chunk i, starts.back() is the file size
+    std::vector<uint64_t> starts;
+    //Bytes of the file that are not holes
+    uint64_t allocated = 0;
+
+    //Index of the chunk containing off, or chunk count if off is at or past the end
+    size_t find(const uint64_t &off) const;
+};
+
+/* Appends to the end of a chunked file that are not in its chunk list yet.
+ *
+ * Whole chunks are stored as the data arrives, but the chunk list and inode
+ * are only rewritten when the appends are committed, so a file written a
+ * little at a time does not store a complete new chunk list for every write.
+ */
+struct Pending_Appends {
+    //Chunk list the appends continue and the first of its chunks they
+    //replace, a short tail chunk is cut again along with the new data
+    std::string base;
+    size_t first = 0;
+    uint64_t start = 0;
+    CODEC codec = CODEC_NONE;
+    //Chunks already stored, followed by data not yet long enough to cut
+    std::vector<rtosfs::Chunk> chunks;
+    uint64_t chunked = 0;
+    std::string tail;
+
+    //Size of the file once the appends are committed
+    uint64_t end() const;
+};
+
+/* Reads and writes the contents of regular files.
+ *
+ * NODE_FILE nodes keep their contents in a single object at data_ref which is
+ * appended to in place.
+ *
+ * NODE_CHUNKED nodes keep their contents as content defined chunks, each
+ * stored under the BLAKE2b hash of its contents keyed by the codec it is
+ * stored with, listed in order by an
+ * rtosfs::Chunk_List at data_ref. Chunks already in the backend are not
+ * stored again, so identical files and unchanged regions of edited files
+ * share storage. Chunk lists are stored under a new ref on every change and
+ * never mutated, like directories.
+ *
+ * Chunks may also be extents of another object, which is how plain files
+ * are cloned without copying their data, or holes with no object at all,
+ * which read as zeros. Plain files become chunked when a hole is made in them.
+ *
+ * Chunked files may also have a codec in their Chunk_List, in which case
+ * each new chunk is compressed on its own so random reads only decompress
+ * the chunks they touch. Chunks that do not shrink are stored uncompressed.
+ */
+class File_Data {
+
+    public:
+        File_Data(const std::shared_ptr<Object_Store> &backend, const bool &chunking);
+
+        //Stores the contents of a new empty file and sets inode.type and data_ref,
+        //files compressed with codec are always chunked
+        void init(Inode &inode, const CODEC &codec);
+
+        //Returns the number of bytes read into buf
+        size_t read(const Inode &inode, char *buf, const size_t &size, const off_t &off);
+
+        //Bytes of the file that are not holes
+        uint64_t allocated(const Inode &inode);
+
+        //Updates data_ref and st_size of inode, caller appends the new inode
+        void write(Inode &inode, const char *buf, const size_t &size, const off_t &off);
+        void truncate(Inode &inode, const off_t &size);
+
+        //Start buffering appends to inode, which must be chunked
+        void begin_appends(const Inode &inode, Pending_Appends &pending);
+        void append(Pending_Appends &pending, const char *buf, const size_t &size);
+
+        //Store the chunk list with pending in it and start pending again
+        //after it, updates data_ref and st_size of inode like write
+        void commit_appends(Inode &inode, Pending_Appends &pending);
+
+        //Make [off, off + length) a hole, extending the file unless keep_size
+        void zero(Inode &inode, const off_t &off, const off_t &length, const bool &keep_size);
+
+        //Makes clone a copy of source without copying any data, later writes
+        //to either never affect the other
+        void clone(const Inode &source, Inode &clone);
+
+        std::string stats() const;
+
+    private:
+        std::shared_ptr<Object_Store> _backend;
+        const bool _chunking;
+        const Chunker _chunker;
+        Dedup_Stats _stats;
+
+        Ref_Cache<Chunk_Map> _chunk_maps;
+        Ref_Cache<std::string> _chunks;
+        //Chunks we have seen in the backend, which never need storing again
+        Ref_Cache<bool> _known_chunks;
+
+        std::shared_ptr<const Chunk_Map> _chunk_map(const Inode &inode);
+        size_t _read_chunked(const Chunk_Map &map, char *buf, const size_t &size, const uint64_t &off);
+        std::shared_ptr<const std::string> _chunk(const rtosfs::Chunk &chunk);
+        rtosfs::Chunk _store_chunk(const char *data, const size_t &size, const CODEC &codec);
+        void _store_chunk_map(Inode &inode, const rtosfs::Chunk_List &list);
+
+        //Turn a plain file into a chunk list with a single extent of its data
+        void _to_chunked(Inode &inode);
+
+        //Replace bytes [from, to) of the file with a hole of hole_length
+        //followed by data
+        void _splice(Inode &inode, const Chunk_Map &map, const uint64_t &from, const uint64_t &to, const uint64_t &hole_length, const std::string &data);
+
+        //Chunk and store region, appending the chunks to chunks
+        void _chunk_region(const std::string &region, const CODEC &codec, std::vector<rtosfs::Chunk> &chunks);
+
+        //Replace chunks [first, last) of map with replacement
+        void _rewrite(Inode &inode, const Chunk_Map &map, const size_t &first, const size_t &last, const std::vector<rtosfs::Chunk> &replacement);
+
+};
+
+#endif
@@ -1,18 +1,43 @@
 #include "file_system.h"
 
+#include "cache_store.h"
 #include "debug.h"
+#include "fetch_hints.h"
 #include "disk_format.pb.h"
+#include "rtosfs_ioctl.h"
+#include "scratch.h"
 
 #include <cassert>
+#include <linux/falloc.h>
 #include <sys/types.h>
 #include <sys/xattr.h>
 
-#include <boost/algorithm/string.hpp>
 #include <deque>
 #include <string>
 
 #include <ctgmath>
 
+//Threads fetching data ahead of sequential readers, shared by all handles
+const size_t READAHEAD_THREADS = 4;
+//Size of the first prefetch once a handle is read sequentially
+const size_t READAHEAD_MIN = 128 * 1024;
+
+//Appends to a chunked file are committed at least this often while it stays open
+const uint64_t APPEND_COMMIT_SIZE = 64 * 1024 * 1024;
+
+//Block size statfs reports usage in
+const uint64_t STATFS_BLOCK_SIZE = 4096;
+//How often usage counters are flushed and other mounts' counters read
+const std::chrono::milliseconds USAGE_FLUSH_INTERVAL(5000);
+
+//Parsed directories kept, and the largest serialized one kept. Larger ones
+//are parsed into scratch space on every lookup instead.
+const size_t DIR_CACHE_ENTRIES = 1024;
+const size_t MAX_CACHED_DIR = 64 * 1024;
+
+//Directories with this xattr compress new files with the codec it names
+const std::string COMPRESSION_XATTR = "user.rtosfs.compression";
+
 bool has_access(const Inode &inode, const int mode){
     const auto context = fuse_get_context();
     if(mode & R_OK){
@@ -67,16 +92,26 @@ Node::Node(const Ref &log, const std::shared_ptr<Object_Store> &backend):
     _log(log.buf(), 32)
 {
     _backend = backend;
+    _latest = backend;
+}
+
+Node::Node(const Ref &log, const std::shared_ptr<Object_Store> &backend, const std::shared_ptr<Object_Store> &latest):
+    _log(log.buf(), 32)
+{
+    _backend = backend;
+    _latest = latest;
 }
 
 Inode Node::inode(){
-    struct Inode i;
-    _backend->fetch_tail(_log, sizeof(Inode), (char *)(&i));
-    return i;
+    return fetch_inode(*_backend, _log);
+}
+
+Inode Node::latest_inode(){
+    return fetch_inode(*_latest, _log);
 }
 
 void Node::update_inode(const Inode &inode){
-    _backend->append(_log, (const char *)(&inode), sizeof(Inode));
+    append_inode(*_backend, _log, inode);
 }
 
 Ref Node::ref() const{
@@ -84,14 +119,9 @@ Ref Node::ref() const{
 }
 
 std::deque<std::string> decompose_path(const char *path){
-    //TODO: be less lazy about this, boost split will return empty strings as well
-    std::vector<std::string> d;
     std::deque<std::string> decomposed;
-    split(d, path, boost::is_any_of("/"));
-    for(const auto &e: d){
-        if(e.size() != 0){
-            decomposed.push_back(e);
-        }
+    for(const auto &e: Path(path)){
+        decomposed.push_back(e.str());
     }
     return decomposed;
 }
@@ -100,12 +130,25 @@ std::deque<std::string> decompose_path(const std::string &path){
     return decompose_path(path.c_str());
 }
 
-File_System::File_System(const std::string &prefix, const std::shared_ptr<Object_Store> &backend):
-    _root(Ref(prefix), backend),
-    _backend(backend)
+File_System::File_System(const std::string &prefix, const std::shared_ptr<Object_Store> &backend, const Mount_Options &options):
+    _options(options),
+    _requests(std::make_shared<Single_Flight_Store>(backend)),
+    _backend(options.metadata_cache > 0 ? std::make_shared<Cache_Store>(_requests, options.metadata_cache, options.lease) : _requests),
+    _root(Ref(prefix), _backend, _requests),
+    _dir_committer(_backend, _requests, options.dir_commit_window),
+    _file_data(_requests, options.chunking),
+    _prefetcher(_backend, options.metadata_cache > 0 ? options.prefetch : 0),
+    //Warming only pays off if there is a cache to warm
+    _warmer(_backend, options.metadata_cache > 0 ? options.warm_manifest : ""),
+    //Counters of other mounts must be seen, so not through the cache. They
+    //are fetched without hints, so decorators below send them to the primary.
+    _usage(backend, prefix, USAGE_FLUSH_INTERVAL),
+    _readahead_pool(options.readahead > 0 ? READAHEAD_THREADS : 0),
+    _xattr_cache(4096),
+    _dir_cache(DIR_CACHE_ENTRIES)
 {
     try{
-        _backend->fetch_tail(Ref(prefix), sizeof(Inode));
+        fetch_inode(*_backend, Ref(prefix));
     }
     catch(E_OBJECT_DNE e){ //empty filesystem
         //write new empty directory
@@ -144,48 +187,68 @@ File_System::File_System(const std::string &prefix, const std::shared_ptr<Object
 
 }
 
-Node File_System::_get_node(const std::deque<std::string> &decomp_path){
-    Node current_node = _root;
+Node File_System::_child(Node &dir_node, const Path_Component &name){
+    const auto dir_inode = dir_node.inode();
+    has_access(dir_inode, X_OK);
 
-    for(const auto &entry_name: decomp_path){
-        const auto current_inode = current_node.inode();
-        if(!has_access(current_inode, X_OK)){
-            throw E_ACCESS();
-        }
+    //lookup next path element in current_inode directory and then set current_inode = next
+    if(dir_inode.type != NODE_DIR){
+        throw E_NOT_DIR();
+    }
 
-        //lookup next path element in current_inode directory and then set current_inode = next
-        if(current_inode.type != NODE_DIR){
-            throw E_NOT_DIR();
+    const Ref data_ref(dir_inode.data_ref, 32);
+    auto dir = _dir_cache.get(data_ref);
+    if(!dir){
+        const Object serialized_dir = fetch_immutable(*_backend, data_ref);
+        if(serialized_dir.data().size() > MAX_CACHED_DIR){
+            //Parsed into scratch space as nothing in it outlives the lookup
+            Scratch_Arena arena;
+            auto scratch = google::protobuf::Arena::CreateMessage<rtosfs::Directory>(arena.get());
+            scratch->ParseFromString(serialized_dir.data());
+            return _entry(*scratch, name);
         }
-        else{
-            //get directory corresponding to current_inode
-            const Ref serialized_dir_ref(current_inode.data_ref, 32);
-            const std::string serialized_dir = _backend->fetch(serialized_dir_ref).data();
-            rtosfs::Directory dir;
-            dir.ParseFromString(serialized_dir);
-
-            //search directory for next entry
-            bool bad_path = true;
-            for(const auto &entry: dir.entries()){
-                if(entry.name() == entry_name){
-                    Node next_node(Ref(entry.inode_ref().c_str(), 32), _backend);
-                    current_node = next_node;
-                    bad_path = false;
-                    break;
-                }
-            }
+        dir = _parse_dir(data_ref, serialized_dir.data());
+    }
+    return _entry(*dir, name);
+}
 
-            if(bad_path){
-                throw E_DNE();
-            }
+Node File_System::_entry(const rtosfs::Directory &dir, const Path_Component &name){
+    for(const auto &entry: dir.entries()){
+        if(name == entry.name()){
+            _warmer.lookup(entry.inode_ref(), entry.mode());
+            return Node(Ref(entry.inode_ref().data(), 32), _backend, _requests);
         }
     }
+    throw E_DNE();
+}
+
+std::shared_ptr<const rtosfs::Directory> File_System::_parse_dir(const Ref &data_ref, const std::string &serialized_dir){
+    std::shared_ptr<rtosfs::Directory> dir(new rtosfs::Directory());
+    dir->ParseFromString(serialized_dir);
+    if(serialized_dir.size() <= MAX_CACHED_DIR){
+        _dir_cache.put(data_ref, dir);
+    }
+    return dir;
+}
+
+Node File_System::_get_node(const Path &path){
+    Node current_node = _root;
+    for(const auto &name: path){
+        current_node = _child(current_node, name);
+    }
+    return current_node;
+}
 
+Node File_System::_get_node(const std::deque<std::string> &decomp_path){
+    Node current_node = _root;
+    for(const auto &name: decomp_path){
+        current_node = _child(current_node, Path_Component{name.data(), name.size()});
+    }
     return current_node;
 }
 
 Node File_System::_get_node(const char *path){
-    return _get_node(decompose_path(path));
+    return _get_node(Path(path));
 }
 
 Inode File_System::_get_inode(const char *path){
@@ -197,16 +260,13 @@ int File_System::getattr(const char *path, struct stat *stbuf){
         std::memset(stbuf, '\0', sizeof(struct stat));
 
         {
-            auto dir_path = decompose_path(path);
-            if(dir_path.size() > 0){
-                dir_path.pop_back();
-            }
-            const Inode dir_inode = _get_node(dir_path).inode();
+            const Inode dir_inode = _get_node(Path(path).parent()).inode();
             has_access(dir_inode, R_OK);
         }
 
         //Don't need perms on this inode... only its parent directory, see above
-        const Inode inode = _get_inode(path);
+        Node node = _get_node(path);
+        const Inode inode = node.inode();
 
         /* st_dev, st_blksize are ignored
          * st_ino is ignored, as we do not support use_ino mount option
@@ -216,17 +276,25 @@ int File_System::getattr(const char *path, struct stat *stbuf){
         stbuf->st_rdev = 0;
         */
 
-        //Note: I don't think st_blocks is meaningful without a block size
-        stbuf->st_blocks = ceil(inode.st_size / 512.0);
+        //Currently read and write a character at a time
+        stbuf->st_size = _pending_size(node, inode.st_size);
+
+        //st_blocks is in 512 byte units whatever the block size, holes take
+        //none and uncommitted appends are never holes
+        uint64_t allocated = 0;
+        if( (inode.type == NODE_FILE) || (inode.type == NODE_CHUNKED) ){
+            allocated = _file_data.allocated(inode) + (stbuf->st_size - inode.st_size);
+        }
+        else{
+            allocated = inode.st_size;
+        }
+        stbuf->st_blocks = ceil(allocated / 512.0);
 
         stbuf->st_mode = inode.st_mode;
         stbuf->st_nlink = inode.st_nlink;
         stbuf->st_uid = inode.st_uid;
         stbuf->st_gid = inode.st_gid;
 
-        //Currently read and write a character at a time
-        stbuf->st_size = inode.st_size;
-
         stbuf->st_atim = inode.st_atim;
         stbuf->st_mtim = inode.st_mtim;
         stbuf->st_ctim = inode.st_ctim;
@@ -239,42 +307,96 @@ int File_System::getattr(const char *path, struct stat *stbuf){
     catch(E_ACCESS e){
         return -EACCES;
     }
+    catch(E_OBJECT_DNE e){
+        //Chunk list of the file is gone
+        return -EIO;
+    }
+
+}
+
+std::shared_ptr<const rtosfs::Dictionary> File_System::_get_xattrs(const Inode &inode){
+    static const std::shared_ptr<const rtosfs::Dictionary> no_xattrs(new rtosfs::Dictionary());
+    if(null_ref(inode.xattr_ref)){
+        return no_xattrs;
+    }
+
+    const Ref xattr_ref(inode.xattr_ref, 32);
+    auto xattrs = _xattr_cache.get(xattr_ref);
+    if(!xattrs){
+        std::shared_ptr<rtosfs::Dictionary> parsed(new rtosfs::Dictionary());
+        parsed->ParseFromString(fetch_immutable(*_backend, xattr_ref).data());
+        xattrs = parsed;
+        _xattr_cache.put(xattr_ref, xattrs);
+    }
+    return xattrs;
+}
+
+void File_System::_set_xattrs(Inode &inode, const std::shared_ptr<const rtosfs::Dictionary> &xattrs){
+    //Removing the last xattr returns the node to having no xattr object
+    if(xattrs->entries().size() == 0){
+        std::memset(inode.xattr_ref, (char)0, 32);
+        return;
+    }
 
+    std::string serialized_xattrs;
+    xattrs->SerializeToString(&serialized_xattrs);
+    const Ref new_xattr_ref = Ref();
+    _backend->store(new_xattr_ref, Object(serialized_xattrs));
+    _xattr_cache.put(new_xattr_ref, xattrs);
+
+    std::memcpy(inode.xattr_ref, new_xattr_ref.buf(), 32);
+}
+
+//Copy an xattr value out following the getxattr(2) size conventions
+int xattr_value(const std::string &v, char *value, size_t val_size){
+    //Manpage for getxattr states that if the size is 0 return the
+    //current size of the attribute in question
+    if(val_size == 0){
+        return v.size();
+    }
+    else if(v.size() <= val_size){
+        std::memcpy(value, v.c_str(), v.size());
+        return v.size();
+    }
+    else{
+        return -ERANGE;
+    }
+}
+
+CODEC File_System::_compression(const Inode &dir_inode){
+    for(const auto &entry: _get_xattrs(dir_inode)->entries()){
+        if(entry.name() == COMPRESSION_XATTR){
+            try{
+                return codec_from_name(entry.value());
+            }
+            catch(E_BAD_CODEC e){
+            }
+        }
+    }
+    return _options.compression;
 }
 
 int File_System::getxattr(const char *path, const char *name, char *value, size_t val_size){
     try{
-        std::memset(value, '\0', val_size);
-
         const Inode inode = _get_inode(path);
         has_access(inode, R_OK);
 
-        const Ref xattr_ref(inode.xattr_ref, 32);
-
-        const std::string serialized_xattr_dict = _backend->fetch(xattr_ref).data();
+        //Filesystem wide statistics, available on every path
+        if(std::strcmp(name, "user.rtosfs.dedup") == 0){
+            return xattr_value(_file_data.stats(), value, val_size);
+        }
 
-        rtosfs::Dictionary xattr_dict;
-        xattr_dict.ParseFromString(serialized_xattr_dict);
+        //Most nodes have no xattrs at all, answer without touching the backend.
+        //This is the common case for the security.capability query the kernel
+        //issues on every write.
+        if(null_ref(inode.xattr_ref)){
+            return -ENODATA;
+        }
 
-        for(const auto &entry: xattr_dict.entries()){
-            if(std::strncmp(name, entry.name().c_str(), entry.name().size())){
-                //Manpage for getxattr states that if the size is 0 return the
-                //current size of the attribute in question
-                if(val_size == 0){
-                    return entry.value().size();
-                }
-                else{
-                    if(entry.value().size() >= val_size){
-                        std::strncpy(value, entry.value().c_str(), entry.value().size());
-                        return entry.value().size();
-                    }
-                    else{
-                        return -ERANGE;
-                    }
-                }
-            }
-            else{
-                continue;
+        const auto xattrs = _get_xattrs(inode);
+        for(const auto &entry: xattrs->entries()){
+            if(entry.name() == name){
+                return xattr_value(entry.value(), value, val_size);
             }
         }
 
@@ -294,7 +416,51 @@ int File_System::getxattr(const char *path, const char *name, char *value, size_
     }
 }
 
-rtosfs::Directory File_System::_get_dir(const std::deque<std::string> &decomp_path){
+int File_System::listxattr(const char *path, char *list, size_t size){
+    try{
+        const Inode inode = _get_inode(path);
+        has_access(inode, R_OK);
+
+        if(null_ref(inode.xattr_ref)){
+            return 0;
+        }
+
+        const auto xattrs = _get_xattrs(inode);
+
+        //Names are returned back to back, each null terminated
+        size_t list_size = 0;
+        for(const auto &entry: xattrs->entries()){
+            list_size += entry.name().size() + 1;
+        }
+
+        if(size == 0){
+            return list_size;
+        }
+        else if(list_size > size){
+            return -ERANGE;
+        }
+
+        for(const auto &entry: xattrs->entries()){
+            std::memcpy(list, entry.name().c_str(), entry.name().size() + 1);
+            list += entry.name().size() + 1;
+        }
+        return list_size;
+    }
+    catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
+    }
+    catch(E_OBJECT_DNE e){
+        return 0;
+    }
+    catch(E_ACCESS e){
+        return -EACCES;
+    }
+}
+
+std::shared_ptr<const rtosfs::Directory> File_System::_get_dir(const std::deque<std::string> &decomp_path){
     const Inode inode = _get_node(decomp_path).inode();
     if(inode.type != NODE_DIR){
         throw E_NOT_DIR();
@@ -303,41 +469,97 @@ rtosfs::Directory File_System::_get_dir(const std::deque<std::string> &decomp_pa
     //Need read access to list contents
     has_access(inode, R_OK);
 
-    const std::string serialized_dir = _backend->fetch(Ref(inode.data_ref, 32)).data();
-    rtosfs::Directory dir;
-    dir.ParseFromString(serialized_dir);
-    return dir;
+    const Ref data_ref(inode.data_ref, 32);
+    const auto dir = _dir_cache.get(data_ref);
+    if(dir){
+        return dir;
+    }
+    return _parse_dir(data_ref, fetch_immutable(*_backend, data_ref).data());
 }
 
-rtosfs::Directory File_System::_get_dir(const char *path){
+std::shared_ptr<const rtosfs::Directory> File_System::_get_dir(const char *path){
     return _get_dir(decompose_path(path));
 }
 
-int File_System::readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi){
-    (void) offset;
-    (void) fi;
+int File_System::opendir(const char *path, struct fuse_file_info *fi){
+    try{
+        const auto dir = _get_dir(path);
+        std::lock_guard<std::mutex> l(_handles_lock);
+        fi->fh = _next_handle++;
+        _dir_handles[fi->fh].dir = dir;
+        return 0;
+    }
+    catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
+    }
+    catch(E_ACCESS e){
+        return -EACCES;
+    }
+}
+
+int File_System::releasedir(const char *path, struct fuse_file_info *fi){
+    (void) path;
+    std::lock_guard<std::mutex> l(_handles_lock);
+    _dir_handles.erase(fi->fh);
+    return 0;
+}
 
+int File_System::readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi){
     try{
-        const std::string dir_path(path);
-        const rtosfs::Directory dir = _get_dir(path);
-        //add .
+        //Offsets are positions in the directory as it was opened, 1 is past
+        //".", 2 past ".." and n + 3 past entry n. Directories are never
+        //changed in place, so continuing from the same copy always lines up,
+        //and only the entries after offset are looked at.
+        std::shared_ptr<const rtosfs::Directory> dir;
+        bool opened = false;
         {
-            const std::string foo(".");
-            const auto dir_inode = _get_inode(path);
-            struct stat st;
-            st.st_mode = dir_inode.st_mode;
-            filler(buf, foo.c_str(), &st, 0);
-        }
-        //add ..
-        for(const auto &e: dir.entries()){
-            const std::string entry_path = dir_path + "/" + e.name();
-            const auto entry_inode = _get_inode(entry_path.c_str());
-            //Don't need to check permissions on each node... _get_dir checked permissions on parent
+            std::lock_guard<std::mutex> l(_handles_lock);
+            const auto h = (fi == nullptr) ? _dir_handles.end() : _dir_handles.find(fi->fh);
+            if( (h != _dir_handles.end()) && ( (offset != 0) || h->second.opened ) ){
+                dir = h->second.dir;
+                opened = (offset == 0);
+                h->second.opened = false;
+            }
+        }
+        if(!dir){
+            //Rewinding, which should see the directory as it is now
+            dir = _get_dir(path);
+            if(fi != nullptr){
+                std::lock_guard<std::mutex> l(_handles_lock);
+                const auto h = _dir_handles.find(fi->fh);
+                if(h != _dir_handles.end()){
+                    h->second.dir = dir;
+                }
+            }
+            opened = true;
+        }
+        if(opened){
+            _prefetcher.directory(*dir);
+        }
 
-            struct stat st;
-            st.st_mode = entry_inode.st_mode;
+        struct stat st;
+        std::memset(&st, 0, sizeof(st));
+        st.st_mode = S_IFDIR;
+        if( (offset < 1) && filler(buf, ".", &st, 1) ){
+            return 0;
+        }
+        if( (offset < 2) && filler(buf, "..", &st, 2) ){
+            return 0;
+        }
+
+        for(off_t i = std::max(offset - 2, (off_t)0); i < dir->entries_size(); i++){
+            const auto &e = dir->entries(i);
+            //Don't need to check permissions on each node... _get_dir checked permissions on parent
+            st.st_mode = e.mode();
+            if(st.st_mode == 0){
+                //Entry predates modes being recorded in directories
+                st.st_mode = Node(Ref(e.inode_ref().c_str(), 32), _backend).inode().st_mode;
+            }
 
-            if(filler(buf, e.name().c_str(), &st, 0)){
+            if(filler(buf, e.name().c_str(), &st, i + 3)){
                 break;
             }
         }
@@ -356,24 +578,22 @@ int File_System::readdir(const char *path, void *buf, fuse_fill_dir_t filler, of
 
 int File_System::create(const char *path, mode_t mode, struct fuse_file_info *fi){
     try{
-        const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
-
-        //create new empty file ref
-        const Ref new_file_ref = Ref();
-        {
-            const Object empty_file = Object("");
-            _backend->store(new_file_ref, empty_file);
+        //Get Node for directory...
+        auto decomposed_path = decompose_path(path);
+        if(decomposed_path.size() == 0){
+            return -(EEXIST);
         }
+        const std::string name = decomposed_path.back();
+        decomposed_path.pop_back();
 
-        //create new empty xattr ref
-        const Ref new_xattr_ref = Ref();
-        {
-            rtosfs::Dictionary xattrs;
-            std::string serialized_xattrs;
-            xattrs.SerializeToString(&serialized_xattrs);
-            const Object empty_xattr = Object(serialized_xattrs);
-            _backend->store(new_xattr_ref, empty_xattr);
+        Node dir_node = _get_node(decomposed_path);
+        const Inode dir_inode = dir_node.inode();
+        if(dir_inode.type != NODE_DIR){
+            return -ENOTDIR;
         }
+        has_access(dir_inode, W_OK);
+
+        const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
 
         //create new empty file inode
         Inode new_file_inode;
@@ -382,11 +602,10 @@ int File_System::create(const char *path, mode_t mode, struct fuse_file_info *fi
             new_file_inode.st_nlink = 1;
 
             //TODO: set this by looking at mode
-            new_file_inode.type = NODE_FILE;
+            //Sets type, data_ref and st_size of the new empty file
+            _file_data.init(new_file_inode, _compression(dir_inode));
 
-            std::memcpy(new_file_inode.data_ref, new_file_ref.buf(), 32);
-            std::memcpy(new_file_inode.xattr_ref, new_xattr_ref.buf(), 32);
-            new_file_inode.st_size = 0; //we know file is empty
+            std::memset(new_file_inode.xattr_ref, (char)0, 32);
 
             //TODO: figure out if this should actually be zeroed out...
             new_file_inode.st_atim = current_time;
@@ -404,49 +623,22 @@ int File_System::create(const char *path, mode_t mode, struct fuse_file_info *fi
             new_file_node.update_inode(new_file_inode);
         }
 
-        //Get Node for directory...
-        auto decomposed_path = decompose_path(path);
-        if(decomposed_path.size() == 0){
-            return -(EEXIST);
-        }
-        else{
-            const std::string name = decomposed_path.back();
-            decomposed_path.pop_back();
-
-            //get existing directory
-            rtosfs::Directory dir = _get_dir(decomposed_path);
-
-            //check to see if object already exists
-            for(const auto &e: dir.entries()){
-                if(e.name() == name){
-                    return -(EEXIST);
-                }
-            }
-
-            //Create directory object with new file entry
-            std::string serialized_dir;
-            auto new_entry = dir.add_entries();
-            new_entry->set_name(name);
-            new_entry->set_inode_ref(std::string(new_file_inode_ref.buf(), 32));
-            dir.SerializeToString(&serialized_dir);
-
-            //Store new instance of directory object
-            const Ref new_dir_ref = Ref();
-            const Object new_dir = Object(serialized_dir);
-            _backend->store(new_dir_ref, new_dir);
-
-            //Update directory inode and append to inode stack
-            Node dir_node = _get_node(decomposed_path);
-            Inode dir_inode = dir_node.inode();
-            has_access(dir_inode, W_OK);
-
-            std::memcpy(dir_inode.data_ref, new_dir_ref.buf(), 32);
-            dir_inode.st_atim = current_time;
-            dir_inode.st_mtim = current_time;
-            dir_inode.st_size = serialized_dir.size();
-            dir_node.update_inode(dir_inode);
-            return 0;
+        //Add the new file to its directory, this may be committed together
+        //with other concurrent mutations of the same directory
+        Dir_Op op;
+        op.type = DIR_ADD;
+        op.entry.set_name(name);
+        op.entry.set_inode_ref(std::string(new_file_inode_ref.buf(), 32));
+        op.entry.set_mode(new_file_inode.st_mode);
+        const int r = _dir_committer.commit(dir_node.ref(), op);
+        if(r == 0){
+            _usage.add(1, 0, 0);
+            _open_handle(fi);
         }
+        return r;
+    }
+    catch(E_DNE e){
+        return -ENOENT;
     }
     catch(E_ACCESS e){
         return -EACCES;
@@ -454,31 +646,50 @@ int File_System::create(const char *path, mode_t mode, struct fuse_file_info *fi
     catch(E_NOT_DIR e){
         return -ENOTDIR;
     }
+    catch(E_OBJECT_DNE e){
+        //The xattr dictionary of the directory is gone, so there is no
+        //telling which codec it asks for
+        return -EIO;
+    }
 }
 
-//TODO: ACTUALLY IMPLEMENT LOCKING
 int File_System::lock(const char *path, struct fuse_file_info *fi, int cmd, struct flock *fl){
-    if(cmd == F_GETLK){
-
+    try{
+        const Node node = _get_node(path);
+        if(cmd == F_GETLK){
+            return _locks.get(node.ref(), fi->lock_owner, *fl);
+        }
+        else if( (cmd == F_SETLK) || (cmd == F_SETLKW) ){
+            return _locks.set(node.ref(), fi->lock_owner, *fl, cmd == F_SETLKW);
+        }
+        return -EINVAL;
     }
-    else if(cmd == F_SETLK){
-
+    catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
     }
-    else if(cmd == F_SETLKW){
+}
 
+int File_System::flock(const char *path, struct fuse_file_info *fi, int op){
+    try{
+        const Node node = _get_node(path);
+        return _locks.flock(node.ref(), fi->lock_owner, op);
     }
-    else{
-        assert(false);
+    catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
     }
-
-    return 0;
 }
 
 //TODO: Support null tv = set current time
 int File_System::utimens(const char *path, const struct timespec tv[2]){
     try{
         Node current_node = _get_node(path);
-        Inode i = current_node.inode();
+        Inode i = current_node.latest_inode();
 
         //Special case, man pages indiciate that you don't necessarily need write perms if you're the owner
         try{
@@ -520,7 +731,7 @@ int File_System::utime(const char *path, struct utimbuf *buf){
 int File_System::chmod(const char *path, mode_t mode){
     try{
         Node current_node = _get_node(path);
-        Inode i = current_node.inode();
+        Inode i = current_node.latest_inode();
         //has_access(i, W_OK);
         if(fuse_get_context()->uid != i.st_uid){
             throw E_ACCESS();
@@ -529,6 +740,17 @@ int File_System::chmod(const char *path, mode_t mode){
         i.st_mode = mode;
 
         current_node.update_inode(i);
+
+        //Keep the mode in the entry we found it by in step
+        const Path p(path);
+        if(!p.empty()){
+            Dir_Op op;
+            op.type = DIR_SET_MODE;
+            op.entry.set_name(p.last().str());
+            op.entry.set_inode_ref(current_node.ref().buf(), 32);
+            op.entry.set_mode(i.st_mode);
+            return _dir_committer.commit(_get_node(p.parent()).ref(), op);
+        }
         return 0;
     }
     catch(E_DNE e){
@@ -545,7 +767,7 @@ int File_System::chmod(const char *path, mode_t mode){
 int File_System::chown(const char *path, uid_t uid, gid_t gid){
     try{
         Node current_node = _get_node(path);
-        Inode i = current_node.inode();
+        Inode i = current_node.latest_inode();
         //has_access(i, W_OK);
         if(fuse_get_context()->uid != i.st_uid){
             throw E_ACCESS();
@@ -576,6 +798,7 @@ int File_System::chown(const char *path, uid_t uid, gid_t gid){
 int File_System::open(const char *path, struct fuse_file_info *fi){
     try{
         _get_inode(path);
+        _open_handle(fi);
         return 0;
     }
     catch(E_DNE e){
@@ -586,9 +809,159 @@ int File_System::open(const char *path, struct fuse_file_info *fi){
     }
 }
 
+int File_System::flush(const char *path, struct fuse_file_info *fi){
+    (void) fi;
+    try{
+        Node node = _get_node(path);
+        _commit_appends(node);
+        return 0;
+    }
+    catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_BAD_CHUNK e){
+        return -EIO;
+    }
+}
+
+int File_System::fsync(const char *path, int datasync, struct fuse_file_info *fi){
+    (void) datasync;
+    return flush(path, fi);
+}
+
+int File_System::release(const char *path, struct fuse_file_info *fi){
+    const int r = flush(path, fi);
+    std::lock_guard<std::mutex> l(_handles_lock);
+    _handles.erase(fi->fh);
+    return r;
+}
+
+void File_System::_open_handle(struct fuse_file_info *fi){
+    fi->fh = 0;
+    if(_options.readahead == 0){
+        return;
+    }
+
+    std::shared_ptr<Readahead> readahead(new Readahead(_file_data, _readahead_pool, READAHEAD_MIN, _options.readahead));
+    std::lock_guard<std::mutex> l(_handles_lock);
+    fi->fh = _next_handle++;
+    _handles[fi->fh] = readahead;
+}
+
+std::shared_ptr<Readahead> File_System::_handle(const struct fuse_file_info *fi){
+    if( (fi == nullptr) || (fi->fh == 0) ){
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> l(_handles_lock);
+    const auto h = _handles.find(fi->fh);
+    if(h == _handles.end()){
+        return nullptr;
+    }
+    return h->second;
+}
+
+bool File_System::_append(Node &node, const Inode &inode, const char *buf, const size_t &size, const off_t &off){
+    //Plain files are appended to in place already
+    if(inode.type != NODE_CHUNKED){
+        return false;
+    }
+
+    const std::string key(node.ref().buf(), 32);
+    for(;;){
+        std::shared_ptr<Appends> appends;
+        {
+            std::lock_guard<std::mutex> l(_appends_lock);
+            const auto a = _appends.find(key);
+            if(a != _appends.end()){
+                appends = a->second;
+            }
+            else if((uint64_t)off == (uint64_t)inode.st_size){
+                appends.reset(new Appends());
+                _appends[key] = appends;
+            }
+            else{
+                return false;
+            }
+        }
+
+        std::lock_guard<std::mutex> l(appends->lock);
+        if(appends->committed){
+            continue;
+        }
+        if(!appends->started){
+            _file_data.begin_appends(node.latest_inode(), appends->pending);
+            appends->started = true;
+        }
+        if((uint64_t)off != appends->pending.end()){
+            return false;
+        }
+
+        _file_data.append(appends->pending, buf, size);
+        if(appends->pending.chunked >= APPEND_COMMIT_SIZE){
+            _commit(node, *appends);
+        }
+        return true;
+    }
+}
+
+void File_System::_commit_appends(Node &node){
+    const std::string key(node.ref().buf(), 32);
+    std::shared_ptr<Appends> appends;
+    {
+        std::lock_guard<std::mutex> l(_appends_lock);
+        const auto a = _appends.find(key);
+        if(a == _appends.end()){
+            return;
+        }
+        appends = a->second;
+    }
+
+    //Dropped only once committed, so writers never start again from the
+    //inode as it was before
+    std::lock_guard<std::mutex> l(appends->lock);
+    if(appends->committed){
+        return;
+    }
+    if(appends->started){
+        _commit(node, *appends);
+    }
+    appends->committed = true;
+    std::lock_guard<std::mutex> m(_appends_lock);
+    _appends.erase(key);
+}
+
+void File_System::_commit(Node &node, Appends &appends){
+    Inode inode = node.latest_inode();
+    const off_t old_size = inode.st_size;
+    _file_data.commit_appends(inode, appends.pending);
+    node.update_inode(inode);
+    _usage.add(0, 0, inode.st_size - old_size);
+}
+
+uint64_t File_System::_pending_size(const Node &node, const uint64_t &size){
+    const std::string key(node.ref().buf(), 32);
+    std::shared_ptr<Appends> appends;
+    {
+        std::lock_guard<std::mutex> l(_appends_lock);
+        const auto a = _appends.find(key);
+        if(a == _appends.end()){
+            return size;
+        }
+        appends = a->second;
+    }
+
+    std::lock_guard<std::mutex> l(appends->lock);
+    if( !appends->started || appends->committed ){
+        return size;
+    }
+    return appends->pending.end();
+}
+
 int File_System::read(const char *path, char *buf, size_t size, off_t off, struct fuse_file_info *fi){
     try{
-        const Inode i = _get_inode(path);
+        Node node = _get_node(path);
+        _commit_appends(node);
+        const Inode i = node.inode();
         has_access(i, R_OK);
 
         if(i.type == NODE_DIR){
@@ -598,19 +971,11 @@ int File_System::read(const char *path, char *buf, size_t size, off_t off, struc
             return -EBADF;
         }
         else if(off < i.st_size){
-            //const auto fetch_size = std::max((size_t)(i.st_size - off), size);
-            const Ref data_ref = Ref(i.data_ref, 32);
-
-            //TODO: fix this to do partial fetch when this is supported
-            const std::string file = _backend->fetch(data_ref).data();
-            if( (off_t)file.size() <= off ){
-                return 0;
-            }
-            else{
-                const size_t bytes_to_copy = std::min(size, file.size() - off);
-                std::memcpy(buf, &(file[off]), bytes_to_copy);
-                return bytes_to_copy;
+            const auto readahead = _handle(fi);
+            if(readahead){
+                return readahead->read(i, buf, size, off);
             }
+            return _file_data.read(i, buf, std::min(size, (size_t)(i.st_size - off)), off);
         }
         else{
             return 0;
@@ -627,43 +992,54 @@ int File_System::read(const char *path, char *buf, size_t size, off_t off, struc
     catch(E_OBJECT_DNE e){
         return -EBADF;
     }
+    catch(E_BAD_CHUNK e){
+        return -EIO;
+    }
     catch(E_ACCESS e){
         return -EACCES;
     }
 }
 
-//TODO: Fix this so it uses flags correctly
 int File_System::setxattr(const char *path, const char *name, const char *value, size_t size, int flags){
     try{
         Node node = _get_node(path);
-        Inode inode = node.inode();
+        Inode inode = node.latest_inode();
         has_access(inode, W_OK);
 
-        std::string serialized_xattrs = _backend->fetch(Ref(inode.xattr_ref, 32)).data();
-        rtosfs::Dictionary xattrs;
-        xattrs.ParseFromString(serialized_xattrs);
+        if(name == COMPRESSION_XATTR){
+            try{
+                codec_from_name(std::string(value, size));
+            }
+            catch(E_BAD_CODEC e){
+                return -EINVAL;
+            }
+        }
+
+        std::shared_ptr<rtosfs::Dictionary> xattrs(new rtosfs::Dictionary(*_get_xattrs(inode)));
 
         {
             bool set = false;
-            for(auto &entry: (*xattrs.mutable_entries())){
-                if(std::strncmp(name, entry.name().c_str(), entry.name().size())){
+            for(auto &entry: (*xattrs->mutable_entries())){
+                if(entry.name() == name){
+                    if(flags & XATTR_CREATE){
+                        return -EEXIST;
+                    }
                     entry.set_value(std::string(value, size));
                     set = true;
                 }
             }
 
             if(!set){
-                auto new_entry = xattrs.add_entries();
+                if(flags & XATTR_REPLACE){
+                    return -ENODATA;
+                }
+                auto new_entry = xattrs->add_entries();
                 new_entry->set_name(name);
                 new_entry->set_value(std::string(value, size));
             }
         }
 
-        xattrs.SerializeToString(&serialized_xattrs);
-        const Ref new_xattr_ref = Ref();
-        _backend->store(new_xattr_ref, Object(serialized_xattrs));
-
-        std::memcpy(&(inode.xattr_ref), new_xattr_ref.buf(), 32);
+        _set_xattrs(inode, xattrs);
         node.update_inode(inode);
 
         return 0;
@@ -671,6 +1047,14 @@ int File_System::setxattr(const char *path, const char *name, const char *value,
     catch(E_DNE e){
         return -ENOENT;
     }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
+    }
+    catch(E_OBJECT_DNE e){
+        //The dictionary the node names is gone, setting one xattr would
+        //silently drop the rest
+        return -EIO;
+    }
     catch(E_ACCESS e){
         return -EACCES;
     }
@@ -679,23 +1063,24 @@ int File_System::setxattr(const char *path, const char *name, const char *value,
 int File_System::removexattr(const char *path, const char *name){
     try{
         Node node = _get_node(path);
-        Inode inode = node.inode();
+        Inode inode = node.latest_inode();
         has_access(inode, W_OK);
 
-        std::string serialized_xattrs = _backend->fetch(Ref(inode.xattr_ref, 32)).data();
-        rtosfs::Dictionary old_xattrs;
-        old_xattrs.ParseFromString(serialized_xattrs);
+        if(null_ref(inode.xattr_ref)){
+            return -ENODATA;
+        }
 
+        const auto old_xattrs = _get_xattrs(inode);
 
         //Loop over the xattrs, copy the ones we aren't removing to a new xattrs dict
-        rtosfs::Dictionary new_attrs;
+        std::shared_ptr<rtosfs::Dictionary> new_xattrs(new rtosfs::Dictionary());
         bool dirty = false;
-        for(const auto &entry: old_xattrs.entries()){
-            if(std::strncmp(name, entry.name().c_str(), entry.name().size())){
+        for(const auto &entry: old_xattrs->entries()){
+            if(entry.name() == name){
                 dirty = true;
             }
             else{
-                auto new_entry = new_attrs.add_entries();
+                auto new_entry = new_xattrs->add_entries();
                 new_entry->set_name(entry.name());
                 new_entry->set_value(entry.value());
             }
@@ -704,19 +1089,23 @@ int File_System::removexattr(const char *path, const char *name){
         //If we actually changed the xattrs (by not copying the one we're removing)
         //then write them back out to "disk"
         if(dirty){
-            new_attrs.SerializeToString(&serialized_xattrs);
-            const Ref new_xattr_ref = Ref();
-            _backend->store(new_xattr_ref, Object(serialized_xattrs));
-
-            std::memcpy(&(inode.xattr_ref), new_xattr_ref.buf(), 32);
+            _set_xattrs(inode, new_xattrs);
             node.update_inode(inode);
+            return 0;
+        }
+        else{
+            return -ENODATA;
         }
-
-        return 0;
     }
     catch(E_DNE e){
         return -ENOENT;
     }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
+    }
+    catch(E_OBJECT_DNE e){
+        return -ENODATA;
+    }
     catch(E_ACCESS e){
         return -EACCES;
     }
@@ -725,20 +1114,15 @@ int File_System::removexattr(const char *path, const char *name){
 int File_System::truncate(const char *path, off_t off){
     try{
         Node node = _get_node(path);
-        Inode inode = node.inode();
+        _commit_appends(node);
+        Inode inode = node.latest_inode();
         has_access(inode, W_OK);
 
         if(off != inode.st_size){
-            //TODO:Replace with Object Store mutation tech?
-            std::string file = _backend->fetch(Ref(inode.data_ref, 32), 0, inode.st_size).data();
-            file.resize(off);
-
-            Ref new_data_ref = Ref();
-            _backend->store(new_data_ref, Object(file));
-            std::memcpy(inode.data_ref, new_data_ref.buf(), 32);
-
-            inode.st_size = off;
+            const off_t old_size = inode.st_size;
+            _file_data.truncate(inode, off);
             node.update_inode(inode);
+            _usage.add(0, 0, inode.st_size - old_size);
         }
         return 0;
     }
@@ -748,6 +1132,9 @@ int File_System::truncate(const char *path, off_t off){
     catch(E_NOT_DIR e){
         return -ENOTDIR;
     }
+    catch(E_BAD_CHUNK e){
+        return -EIO;
+    }
     catch(E_ACCESS e){
         return -EACCES;
     }
@@ -760,31 +1147,76 @@ int File_System::write(const char *path, const char *buf, size_t size, off_t off
         Inode inode = node.inode();
         has_access(inode, W_OK);
 
-        if(off == inode.st_size){
-            //TODO: Possible security hole, re-using the ref when appending can leak information if we allow the fetching of underlying ref via xattr and subsequent direct queries of the object store
-            //A straight append
-            _backend->append(Ref(inode.data_ref, 32), buf, size);
-            inode.st_size = inode.st_size + size;
-            node.update_inode(inode);
+        if(_append(node, inode, buf, size, off)){
             return size;
         }
-        else{
-            //Rewriting a portion of the file or punching a hole
-            std::string current_file = _backend->fetch(Ref(inode.data_ref, 32)).data();
-            current_file.resize(std::max(off + size, current_file.size()));
-            std::memcpy(&current_file[off], buf, size);
+        _commit_appends(node);
+        inode = node.latest_inode();
+
+        const off_t old_size = inode.st_size;
+        _file_data.write(inode, buf, size, off);
+        node.update_inode(inode);
+        _usage.add(0, 0, inode.st_size - old_size);
+        return size;
+    }
+    catch(E_DNE e){
+        return -EIO;
+    }
+    catch(E_BAD_CHUNK e){
+        return -EIO;
+    }
+    catch(E_ACCESS e){
+        return -EACCES;
+    }
+}
 
-            const Ref new_data_ref = Ref();
-            _backend->store(new_data_ref, Object(current_file));
+int File_System::fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi){
+    if( (offset < 0) || (length <= 0) ){
+        return -EINVAL;
+    }
+    if( (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)) != 0 ){
+        return -EOPNOTSUPP;
+    }
+    if( (mode & FALLOC_FL_PUNCH_HOLE) && !(mode & FALLOC_FL_KEEP_SIZE) ){
+        return -EINVAL;
+    }
 
-            inode.st_size = current_file.size();
-            std::memcpy(inode.data_ref, new_data_ref.buf(), 32);
+    try{
+        Node node = _get_node(path);
+        _commit_appends(node);
+        Inode inode = node.latest_inode();
+        has_access(inode, W_OK);
+        if( (inode.type != NODE_FILE) && (inode.type != NODE_CHUNKED) ){
+            return -ENODEV;
+        }
 
-            node.update_inode(inode);
-            return size;
+        const off_t old_size = inode.st_size;
+        const bool keep_size = mode & FALLOC_FL_KEEP_SIZE;
+        if( mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE) ){
+            _file_data.zero(inode, offset, length, keep_size);
+        }
+        else if( !keep_size && (offset + length > inode.st_size) ){
+            //Nothing is ever preallocated, growing the file just adds a hole
+            _file_data.truncate(inode, offset + length);
         }
+        else{
+            return 0;
+        }
+
+        const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
+        inode.st_mtim = current_time;
+        inode.st_ctim = current_time;
+        node.update_inode(inode);
+        _usage.add(0, 0, inode.st_size - old_size);
+        return 0;
     }
     catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
+    }
+    catch(E_BAD_CHUNK e){
         return -EIO;
     }
     catch(E_ACCESS e){
@@ -792,6 +1224,27 @@ int File_System::write(const char *path, const char *buf, size_t size, off_t off
     }
 }
 
+int File_System::statfs(const char *path, struct statvfs *stbuf){
+    (void) path;
+    const Superblock usage = _usage.current();
+    const uint64_t used = (usage.bytes + STATFS_BLOCK_SIZE - 1) / STATFS_BLOCK_SIZE;
+    const uint64_t total = std::max(used, _options.capacity / STATFS_BLOCK_SIZE);
+    const uint64_t nodes = usage.files + usage.directories;
+
+    std::memset(stbuf, 0, sizeof(struct statvfs));
+    stbuf->f_bsize = STATFS_BLOCK_SIZE;
+    stbuf->f_frsize = STATFS_BLOCK_SIZE;
+    stbuf->f_blocks = total;
+    stbuf->f_bfree = total - used;
+    stbuf->f_bavail = total - used;
+    //Nodes are only limited by space, so report as many free as blocks
+    stbuf->f_files = nodes + (total - used);
+    stbuf->f_ffree = total - used;
+    stbuf->f_favail = total - used;
+    stbuf->f_namemax = 255;
+    return 0;
+}
+
 int File_System::access(const char *path, int mode){
     try{
         const Inode inode = _get_inode(path);
@@ -818,49 +1271,30 @@ int File_System::access(const char *path, int mode){
 int File_System::unlink(const char *path){
     try{
         auto decomposed_path = decompose_path(path);
-        Node object_node = _get_node(decomposed_path);
-
+        if(decomposed_path.size() == 0){
+            return -EBUSY;
+        }
         const std::string name = decomposed_path.back();
 
         decomposed_path.pop_back();
         Node directory_node = _get_node(decomposed_path);
 
         Inode inode = directory_node.inode();
-        has_access(inode, W_OK);
-
         if(inode.type != NODE_DIR){
             return -ENOTDIR;
         }
-        else{
-            rtosfs::Directory dir = _get_dir(decomposed_path);
-
-            for(auto i = dir.entries().begin(); i != dir.entries().end(); i++){
-                if(i->name() == name){
-                    dir.mutable_entries()->erase(i);
-
-                    const Ref new_dir_ref = Ref();
-                    {
-                        std::string serialized_dir;
-                        dir.SerializeToString(&serialized_dir);
-                        const Object empty_file = Object(serialized_dir);
-                        _backend->store(new_dir_ref, empty_file);
-                    }
-                    std::memcpy(inode.data_ref, new_dir_ref.buf(), 32);
-                    directory_node.update_inode(inode);
-
-                    //Now reduce link count on Node
-                    Inode object_inode = object_node.inode();
-                    assert(object_inode.st_nlink > 0);
-
-                    object_inode.st_nlink--;
-                    object_node.update_inode(object_inode);
-
-                    return 0;
-                }
-            }
+        has_access(inode, W_OK);
 
-            return -ENOENT;
+        Dir_Op op;
+        op.type = DIR_REMOVE;
+        op.entry.set_name(name);
+        const int r = _dir_committer.commit(directory_node.ref(), op);
+        if(r != 0){
+            return r;
         }
+
+        _drop_link(op.removed);
+        return 0;
     }
     catch(E_NOT_DIR e){
         return -ENOTDIR;
@@ -873,81 +1307,95 @@ int File_System::unlink(const char *path){
     }
 }
 
+void File_System::_drop_link(const rtosfs::Entry &removed){
+    //Nothing was replaced
+    if(removed.inode_ref().empty()){
+        return;
+    }
+
+    Node object_node(Ref(removed.inode_ref().c_str(), 32), _backend, _requests);
+    Inode object_inode = object_node.latest_inode();
+    assert(object_inode.st_nlink > 0);
+
+    object_inode.st_nlink--;
+    object_node.update_inode(object_inode);
+
+    if(object_inode.st_nlink == 0){
+        if(object_inode.type == NODE_DIR){
+            _usage.add(0, -1, 0);
+        }
+        else{
+            _usage.add(-1, 0, -object_inode.st_size);
+        }
+    }
+}
+
 int File_System::mkdir(const char *path, mode_t mode){
     try{
         auto decomposed_path = decompose_path(path);
+        if(decomposed_path.size() == 0){
+            return -EEXIST;
+        }
         const std::string new_dir_name = decomposed_path.back();
 
         decomposed_path.pop_back();
         Node parent_dir_node = _get_node(decomposed_path);
 
         Inode parent_inode = parent_dir_node.inode();
-        has_access(parent_inode, W_OK);
-
         if(parent_inode.type != NODE_DIR){
             return -ENOTDIR;
         }
-        else{
-            rtosfs::Directory parent_dir = _get_dir(decomposed_path);
-
-            //Check to see if it already exists
-            for(auto i = parent_dir.entries().begin(); i != parent_dir.entries().end(); i++){
-                if(i->name() == new_dir_name){
-                    return -EEXIST;
-                }
-            }
-
-            //Does not exist, add it
+        has_access(parent_inode, W_OK);
 
-            const Ref new_dir_log_ref = Ref();
-            Node new_dir_node(new_dir_log_ref, _backend);
-            Inode new_dir_inode;
+        const Ref new_dir_log_ref = Ref();
+        Node new_dir_node(new_dir_log_ref, _backend);
+        Inode new_dir_inode;
+        {
+            //Make a new empty directory and store it
+            const Ref new_dir_ref = Ref();
             {
-                //Make a new empty directory and store it
-                const Ref new_dir_ref = Ref();
-                {
-                    _backend->store(new_dir_ref, Object(""));
-                }
-
-                _debug_log() << "New empty directory stored" << std::endl;
-
-                new_dir_inode.st_mode = S_IFDIR | mode;
-                new_dir_inode.type = NODE_DIR;
-                std::memcpy(new_dir_inode.data_ref, new_dir_ref.buf(), 32);
-                std::memset(new_dir_inode.xattr_ref, (char)0, 32);
-                //New directories are empty strings in protobuf speak
-                new_dir_inode.st_size = 0;
-                new_dir_inode.st_nlink = 1;
-
-                const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
-                new_dir_inode.st_atim = current_time;
-                new_dir_inode.st_mtim = current_time;
-                new_dir_inode.st_ctim = current_time;
-                new_dir_inode.st_uid = fuse_get_context()->uid;
-                new_dir_inode.st_gid = fuse_get_context()->gid;
+                _backend->store(new_dir_ref, Object(""));
             }
-            new_dir_node.update_inode(new_dir_inode);
 
-            //Add entry to new directory in parent directory
-            auto new_entry = parent_dir.add_entries();
-            {
-                new_entry->set_name(new_dir_name);
-                new_entry->set_inode_ref(new_dir_log_ref.buf(), 32);
-            }
+            _debug_log() << "New empty directory stored" << std::endl;
 
-            //Store new instance of parent directory at a new ref
-            const Ref new_parent_dir_ref = Ref();
-            {
-                std::string serialized_parent;
-                parent_dir.SerializeToString(&serialized_parent);
-                _backend->store(new_parent_dir_ref, Object(serialized_parent));
-            }
+            new_dir_inode.st_mode = S_IFDIR | mode;
+            new_dir_inode.type = NODE_DIR;
+            std::memcpy(new_dir_inode.data_ref, new_dir_ref.buf(), 32);
+            std::memset(new_dir_inode.xattr_ref, (char)0, 32);
+            //New directories are empty strings in protobuf speak
+            new_dir_inode.st_size = 0;
+            new_dir_inode.st_nlink = 1;
 
-            //Update parent inode with new parent ref
-            std::memcpy(parent_inode.data_ref, new_parent_dir_ref.buf(), 32);
-            parent_dir_node.update_inode(parent_inode);
-            return 0;
+            const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
+            new_dir_inode.st_atim = current_time;
+            new_dir_inode.st_mtim = current_time;
+            new_dir_inode.st_ctim = current_time;
+            new_dir_inode.st_uid = fuse_get_context()->uid;
+            new_dir_inode.st_gid = fuse_get_context()->gid;
+
+            //Compression policy applies to the whole subtree
+            for(const auto &entry: _get_xattrs(parent_inode)->entries()){
+                if(entry.name() == COMPRESSION_XATTR){
+                    std::shared_ptr<rtosfs::Dictionary> xattrs(new rtosfs::Dictionary());
+                    *xattrs->add_entries() = entry;
+                    _set_xattrs(new_dir_inode, xattrs);
+                }
+            }
         }
+        new_dir_node.update_inode(new_dir_inode);
+
+        //Add entry to new directory in parent directory
+        Dir_Op op;
+        op.type = DIR_ADD;
+        op.entry.set_name(new_dir_name);
+        op.entry.set_inode_ref(new_dir_log_ref.buf(), 32);
+        op.entry.set_mode(new_dir_inode.st_mode);
+        const int r = _dir_committer.commit(parent_dir_node.ref(), op);
+        if(r == 0){
+            _usage.add(0, 1, 0);
+        }
+        return r;
     }
     catch(E_NOT_DIR e){
         return -ENOTDIR;
@@ -963,7 +1411,7 @@ int File_System::mkdir(const char *path, mode_t mode){
 int File_System::rmdir(const char *path){
     try{
         const auto dir = _get_dir(decompose_path(path));
-        if(dir.entries().size() != 0){
+        if(dir->entries().size() != 0){
             return -ENOTEMPTY;
         }
         else{
@@ -992,11 +1440,13 @@ int File_System::symlink(const char *to, const char *from){
         auto dir_path = path;
         dir_path.pop_back();
 
-        auto source_dir = _get_dir(dir_path);
-        for(const auto &e: source_dir.entries()){
-            if(name == e.name()){
-                return -EEXIST;
+        Node dir_node = _get_node(dir_path);
+        {
+            const Inode dir_inode = dir_node.inode();
+            if(dir_inode.type != NODE_DIR){
+                return -ENOTDIR;
             }
+            has_access(dir_inode, W_OK);
         }
 
         const std::string dest(to);
@@ -1006,8 +1456,8 @@ int File_System::symlink(const char *to, const char *from){
         }
 
         const Ref new_link_log_ref = Ref();
+        Inode new_link_inode;
         {
-            Inode new_link_inode;
             {
                 new_link_inode.st_mode = S_IFLNK | 0777;
                 new_link_inode.type = NODE_SYM;
@@ -1028,20 +1478,16 @@ int File_System::symlink(const char *to, const char *from){
             new_link_node.update_inode(new_link_inode);
         }
 
-        auto new_entry = source_dir.add_entries();
-        new_entry->set_name(name);
-        new_entry->set_inode_ref(std::string(new_link_log_ref.buf(), 32));
-
-        std::string serialized_dir;
-        source_dir.SerializeToString(&serialized_dir);
-        const auto new_dir_ref = Ref();
-        _backend->store(new_dir_ref, serialized_dir);
-
-        Node dir_node = _get_node(dir_path);
-        auto dir_inode = dir_node.inode();
-        std::memcpy(dir_inode.data_ref, new_dir_ref.buf(), 32);
-        dir_node.update_inode(dir_inode);
-        return 0;
+        Dir_Op op;
+        op.type = DIR_ADD;
+        op.entry.set_name(name);
+        op.entry.set_inode_ref(std::string(new_link_log_ref.buf(), 32));
+        op.entry.set_mode(new_link_inode.st_mode);
+        const int r = _dir_committer.commit(dir_node.ref(), op);
+        if(r == 0){
+            _usage.add(1, 0, new_link_inode.st_size);
+        }
+        return r;
     }
     catch(E_NOT_DIR e){
         return -ENOTDIR;
@@ -1058,7 +1504,7 @@ int File_System::readlink(const char *path, char *linkbuf, size_t size){
     try{
         Node link_node = _get_node(path);
         const Inode link_inode = link_node.inode();
-        const std::string target = _backend->fetch(Ref(link_inode.data_ref, 32)).data();
+        const std::string target = fetch_immutable(*_backend, Ref(link_inode.data_ref, 32)).data();
 
         const size_t to_copy = std::min(target.size(), size);
         std::strncpy(linkbuf, target.c_str(), to_copy);
@@ -1090,34 +1536,32 @@ int File_System::link(const char *to, const char *from){
         auto dir_path = path;
         dir_path.pop_back();
 
-        auto source_dir = _get_dir(dir_path);
-        for(const auto &e: source_dir.entries()){
-            if(name == e.name()){
-                return -EEXIST;
+        Node dir_node = _get_node(dir_path);
+        {
+            const Inode dir_inode = dir_node.inode();
+            if(dir_inode.type != NODE_DIR){
+                return -ENOTDIR;
             }
+            has_access(dir_inode, W_OK);
         }
 
-
         Node to_node = _get_node(to);
+
+        Dir_Op op;
+        op.type = DIR_ADD;
+        op.entry.set_name(name);
+        op.entry.set_inode_ref(to_node.ref().buf(), 32);
+        op.entry.set_mode(to_node.inode().st_mode);
+        const int r = _dir_committer.commit(dir_node.ref(), op);
+        if(r != 0){
+            return r;
+        }
+
         {
-            Inode to_inode = to_node.inode();
+            Inode to_inode = to_node.latest_inode();
             to_inode.st_nlink++;
             to_node.update_inode(to_inode);
         }
-
-        auto new_entry = source_dir.add_entries();
-        new_entry->set_name(name);
-        new_entry->set_inode_ref(to_node.ref().buf(), 32);
-
-        std::string serialized_dir;
-        source_dir.SerializeToString(&serialized_dir);
-        const auto new_dir_ref = Ref();
-        _backend->store(new_dir_ref, serialized_dir);
-
-        Node dir_node = _get_node(dir_path);
-        auto dir_inode = dir_node.inode();
-        std::memcpy(dir_inode.data_ref, new_dir_ref.buf(), 32);
-        dir_node.update_inode(dir_inode);
         return 0;
     }
     catch(E_NOT_DIR e){
@@ -1152,9 +1596,6 @@ int File_System::rename(const char *source, const char *dest){
         const std::string source_file_name = source_file_path.back();
         const std::string dest_file_name = dest_file_path.back();
 
-        (void)source_file_path;
-        (void)dest_file_path;
-
         Node source_dir_node = _get_node(source_dir_path);
         Inode source_dir_inode = source_dir_node.inode();
         has_access(source_dir_inode, W_OK);
@@ -1164,119 +1605,166 @@ int File_System::rename(const char *source, const char *dest){
         has_access(dest_dir_inode, W_OK);
 
         if(source_dir_path == dest_dir_path){
-            (void)dest_dir_path;
-            (void)dest_dir_node;
-            (void)dest_dir_inode;
             _debug_log() << source_dir_node.ref().base16() << std::endl;
 
-            rtosfs::Directory dir = _get_dir(source_dir_path);
-            rtosfs::Directory new_dir;
-            (void)source_dir_path;
-
-            Ref file_ref;
-
-            //create new dir
-            bool exists = false;
-            for(const auto &d: dir.entries()){
-                if(d.name() == source_file_name){
-                    file_ref = Ref(d.inode_ref().c_str(), 32);
-                    exists = true;
-                }
-                else if(d.name() == dest_file_name){
-                    //don't copy
-                }
-                else{
-                    auto n = new_dir.add_entries();
-                    n->set_name(d.name());
-                    n->set_inode_ref(d.inode_ref());
-                }
+            Dir_Op op;
+            op.type = DIR_RENAME;
+            op.entry.set_name(source_file_name);
+            op.new_name = dest_file_name;
+            const int r = _dir_committer.commit(source_dir_node.ref(), op);
+            if(r == 0){
+                _drop_link(op.removed);
             }
-            if(!exists){
-                return -ENOENT;
-            }
-
-            //modify new dir
-            auto new_dir_ent = new_dir.add_entries();
-            new_dir_ent->set_name(dest_file_name);
-            new_dir_ent->set_inode_ref(file_ref.buf(), 32);
-
-            //serialize and store source dir
-            const Ref new_dir_ref = Ref();
-            std::string serialized_dir;
-            new_dir.SerializeToString(&serialized_dir);
-            _backend->store(new_dir_ref, Object(serialized_dir));
-
-            //update source dir inode
-            std::memcpy(source_dir_inode.data_ref, new_dir_ref.buf(), 32);
-            source_dir_node.update_inode(source_dir_inode);
-
-            return 0;
+            return r;
         }
         else{
-            rtosfs::Directory source_dir = _get_dir(source_dir_path);
-            rtosfs::Directory new_source_dir;
-            Ref file_ref;
+            //Find the entry being moved
+            rtosfs::Entry moved;
             {
-                //modify source dir
+                const auto source_dir = _get_dir(source_dir_path);
                 bool exists = false;
-                for(const auto &d: source_dir.entries()){
+                for(const auto &d: source_dir->entries()){
                     if(d.name() == source_file_name){
-                        file_ref = Ref(d.inode_ref().c_str(), 32);
+                        moved = d;
                         exists = true;
-                    }
-                    else{
-                        auto n = new_source_dir.add_entries();
-                        n->set_name(d.name());
-                        n->set_inode_ref(d.inode_ref());
+                        break;
                     }
                 }
                 if(!exists){
                     return -ENOENT;
                 }
             }
-            (void)source_dir;
 
-            //modify new dir
-            const rtosfs::Directory old_dest_dir = _get_dir(dest_dir_path);
-            rtosfs::Directory new_dest_dir;
+            //The two directories are separate commits. The moved node is
+            //counted as linked from both while it is, so a crash between
+            //them leaves an ordinary hard link, never a lost file or a node
+            //freed while a directory still names it. A crash either side of
+            //the commits at worst leaves st_nlink one too high.
+            Node moved_node(Ref(moved.inode_ref().c_str(), 32), _backend, _requests);
             {
-                for(const auto &e: old_dest_dir.entries()){
-                    if(e.name() != dest_file_name){
-                        auto n = new_dest_dir.add_entries();
-                        n->set_name(e.name());
-                        n->set_inode_ref(e.inode_ref());
-                    }
-                }
-                auto new_dir_ent = new_dest_dir.add_entries();
-                new_dir_ent->set_name(dest_file_name);
-                new_dir_ent->set_inode_ref(file_ref.buf(), 32);
+                Inode moved_inode = moved_node.latest_inode();
+                moved_inode.st_nlink++;
+                moved_node.update_inode(moved_inode);
             }
 
-            //serialize and store source dir
-            const Ref new_source_dir_ref = Ref();
             {
-                std::string serialized_source_dir;
-                new_source_dir.SerializeToString(&serialized_source_dir);
-                _backend->store(new_source_dir_ref, Object(serialized_source_dir));
+                Dir_Op op;
+                op.type = DIR_REPLACE;
+                op.entry = moved;
+                op.entry.set_name(dest_file_name);
+                const int r = _dir_committer.commit(dest_dir_node.ref(), op);
+                if(r != 0){
+                    _drop_link(moved);
+                    return r;
+                }
+                _drop_link(op.removed);
             }
 
-            //serialize and store new dir
-            const Ref new_dest_dir_ref = Ref();
-            {
-                std::string serialized_dest_dir;
-                new_dest_dir.SerializeToString(&serialized_dest_dir);
-                _backend->store(new_dest_dir_ref, Object(serialized_dest_dir));
+            Dir_Op op;
+            op.type = DIR_REMOVE;
+            op.entry.set_name(source_file_name);
+            const int r = _dir_committer.commit(source_dir_node.ref(), op);
+            if(r == 0){
+                _drop_link(op.removed);
             }
+            //Someone else already removed it from the source directory, and
+            //dropped its link
+            else if(r == -ENOENT){
+                return 0;
+            }
+            return r;
+        }
+    }
+    catch(E_NOT_DIR e){
+        return -ENOTDIR;
+    }
+    catch(E_DNE e){
+        return -ENOENT;
+    }
+    catch(E_ACCESS e){
+        return -EACCES;
+    }
+}
 
-            //update target dir inode
-            std::memcpy(dest_dir_inode.data_ref, new_dest_dir_ref.buf(), 32);
-            dest_dir_node.update_inode(dest_dir_inode);
-            //update source dir inode
-            std::memcpy(source_dir_inode.data_ref, new_source_dir_ref.buf(), 32);
-            source_dir_node.update_inode(source_dir_inode);
+int File_System::ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data){
+    (void)arg;
+    (void)fi;
 
-            return 0;
+    if(flags & FUSE_IOCTL_COMPAT){
+        return -ENOSYS;
+    }
+
+    if((unsigned int)cmd == RTOSFS_IOC_CLONE){
+        const struct rtosfs_clone_args *args = (const struct rtosfs_clone_args *)data;
+        if(strnlen(args->dest, sizeof(args->dest)) >= sizeof(args->dest)){
+            return -ENAMETOOLONG;
+        }
+        return clone(path, args->dest);
+    }
+    else{
+        return -ENOTTY;
+    }
+}
+
+int File_System::clone(const char *source, const char *dest){
+    try{
+        Node source_node = _get_node(source);
+        _commit_appends(source_node);
+        const Inode source_inode = source_node.inode();
+        has_access(source_inode, R_OK);
+        if(source_inode.type == NODE_DIR){
+            return -EISDIR;
+        }
+        else if(source_inode.type == NODE_SYM){
+            return -EINVAL;
+        }
+
+        auto dest_path = decompose_path(dest);
+        if(dest_path.size() == 0){
+            return -EEXIST;
+        }
+        const std::string name = dest_path.back();
+        dest_path.pop_back();
+
+        Node dir_node = _get_node(dest_path);
+        {
+            const Inode dir_inode = dir_node.inode();
+            if(dir_inode.type != NODE_DIR){
+                return -ENOTDIR;
+            }
+            has_access(dir_inode, W_OK);
+        }
+
+        //Same contents, mode and xattrs (which are never mutated in place)
+        Inode clone_inode = source_inode;
+        {
+            _file_data.clone(source_inode, clone_inode);
+            clone_inode.st_nlink = 1;
+
+            const timespec current_time = get_timespec(std::chrono::high_resolution_clock::now());
+            clone_inode.st_atim = current_time;
+            clone_inode.st_mtim = current_time;
+            clone_inode.st_ctim = current_time;
+            clone_inode.st_uid = fuse_get_context()->uid;
+            clone_inode.st_gid = fuse_get_context()->gid;
+        }
+
+        const Ref clone_log_ref = Ref();
+        {
+            Node clone_node(clone_log_ref, _backend);
+            clone_node.update_inode(clone_inode);
+        }
+
+        Dir_Op op;
+        op.type = DIR_ADD;
+        op.entry.set_name(name);
+        op.entry.set_inode_ref(clone_log_ref.buf(), 32);
+        op.entry.set_mode(clone_inode.st_mode);
+        const int r = _dir_committer.commit(dir_node.ref(), op);
+        if(r == 0){
+            _usage.add(1, 0, clone_inode.st_size);
         }
+        return r;
     }
     catch(E_NOT_DIR e){
         return -ENOTDIR;
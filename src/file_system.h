@@ -1,16 +1,30 @@
 #ifndef __FILE_SYSTEM_H__
 #define __FILE_SYSTEM_H__
 
+#include <chrono>
+#include <map>
 #include <memory>
 #include <deque>
+#include <mutex>
 #include <string>
 #include <rtos/object_store.h>
 #include <rtos/ref_log.h>
+#include <sys/statvfs.h>
 #include <time.h>
 #include <utime.h>
 
+#include "dir_commit.h"
 #include "disk_format.pb.h"
+#include "file_data.h"
 #include "inode.h"
+#include "lock_manager.h"
+#include "path.h"
+#include "prefetcher.h"
+#include "readahead.h"
+#include "superblock.h"
+#include "warmer.h"
+#include "ref_cache.h"
+#include "single_flight_store.h"
 
 #define FUSE_USE_VERSION 26
 #include <fuse.h>
@@ -28,35 +42,90 @@ class Node {
 
     public:
         Node(const Ref &log, const std::shared_ptr<Object_Store> &backend);
+        //latest must not cache inode tails, backend may
+        Node(const Ref &log, const std::shared_ptr<Object_Store> &backend, const std::shared_ptr<Object_Store> &latest);
 
         Inode inode();
+        //The inode as it is in the backend now, what an update must be based
+        //on so no change made elsewhere within a lease is lost
+        Inode latest_inode();
         void update_inode(const Inode &inode);
         Ref ref() const;
 
     private:
         std::shared_ptr<Object_Store> _backend;
+        std::shared_ptr<Object_Store> _latest;
         Ref _log;
 };
 
 std::map<std::string, Node> dir_list(const Inode &inode);
 std::string sym_target(const Inode &inode);
+timespec get_timespec(const std::chrono::high_resolution_clock::time_point &tp);
+
+struct Mount_Options {
+    //How long a directory commit waits for further mutations to the same
+    //directory before committing them together
+    std::chrono::microseconds dir_commit_window = std::chrono::microseconds(0);
+
+    //Store new files as deduplicated content defined chunks
+    bool chunking = false;
+
+    //Codec new files are compressed with, unless their directory's
+    //user.rtosfs.compression xattr names another
+    CODEC compression = CODEC_NONE;
+
+    //Largest window sequential readers of a handle are prefetched ahead by,
+    //0 disables readahead
+    size_t readahead = 8 * 1024 * 1024;
+
+    //Bytes of inodes and directories kept in memory, 0 disables the cache.
+    //Off unless asked for, as other mounts' changes to a cached inode are
+    //only seen once its lease runs out.
+    size_t metadata_cache = 0;
+
+    //How long a cached inode is used before it is fetched again to see
+    //changes made by other mounts of the same File System. Directories and
+    //everything else in the cache are never changed in place, a node that
+    //changes points at new ones.
+    std::chrono::milliseconds lease = std::chrono::milliseconds(1000);
+
+    //Most child inodes and directories loaded ahead of a tree walk at once,
+    //0 disables metadata prefetch
+    size_t prefetch = 4096;
+
+    //File the most looked up directories are recorded in, and the metadata
+    //cache warmed from at mount. Empty, or no metadata_cache, disables both.
+    std::string warm_manifest;
+
+    //Size statfs reports the File System as, it has no real limit
+    uint64_t capacity = 1ull << 50;
+};
 
 class File_System {
 
     public:
-        File_System(const std::string &prefix, const std::shared_ptr<Object_Store> &backend);
+        File_System(const std::string &prefix, const std::shared_ptr<Object_Store> &backend, const Mount_Options &options = Mount_Options());
 
         //Fuse operations
         int getattr(const char *path, struct stat *stbuf);
         int getxattr(const char *path, const char *name, char *value, size_t size);
+        int listxattr(const char *path, char *list, size_t size);
+        int opendir(const char *path, struct fuse_file_info *fi);
         int readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
+        int releasedir(const char *path, struct fuse_file_info *fi);
         int create(const char *path, mode_t mode, struct fuse_file_info *fi);
+        //Locks are only held by this mount and dropped by FUSE on close,
+        //through F_UNLCK on flush and LOCK_UN on release
         int lock(const char *path, struct fuse_file_info *fi, int cmd, struct flock *fl);
+        int flock(const char *path, struct fuse_file_info *fi, int op);
         int utimens(const char *path, const struct timespec tv[2]);
         int utime(const char *path, struct utimbuf *buf);
         int chown(const char *path, uid_t uid, gid_t gid);
         int chmod(const char *path, mode_t mode);
         int open(const char *path, struct fuse_file_info *fi);
+        int flush(const char *path, struct fuse_file_info *fi);
+        int fsync(const char *path, int datasync, struct fuse_file_info *fi);
+        int release(const char *path, struct fuse_file_info *fi);
         int read(const char *path, char *buf, size_t size, off_t off,
                             struct fuse_file_info *fi);
         int setxattr(const char *path, const char *name, const char *value, size_t size, int flags);
@@ -64,6 +133,8 @@ class File_System {
         int truncate(const char *path, off_t off);
         int write(const char *path, const char *buf, size_t size, off_t off,
                             struct fuse_file_info *fi);
+        int statfs(const char *path, struct statvfs *stbuf);
+        int fallocate(const char *path, int mode, off_t offset, off_t length, struct fuse_file_info *fi);
         int access(const char *path, int mode);
         int unlink(const char *path);
         int mkdir(const char *path, mode_t t);
@@ -72,17 +143,90 @@ class File_System {
         int readlink(const char *path, char *linkbuf, size_t size);
         int link(const char *to, const char *from);
         int rename(const char *source, const char *dest);
+        int ioctl(const char *path, int cmd, void *arg, struct fuse_file_info *fi, unsigned int flags, void *data);
+
+        //Create dest as a copy of source without copying any data
+        int clone(const char *source, const char *dest);
 
 
     private:
-        Node _root;
+        const Mount_Options _options;
+        //Backend with concurrent identical fetches coalesced
+        std::shared_ptr<Object_Store> _requests;
+        //Metadata goes through the cache, file data straight to _requests
         std::shared_ptr<Object_Store> _backend;
-
+        Node _root;
+        Dir_Committer _dir_committer;
+        File_Data _file_data;
+        Prefetcher _prefetcher;
+        Warmer _warmer;
+        Usage_Counters _usage;
+        Lock_Manager _locks;
+
+        //Per handle state of open files, fi->fh is the key
+        std::mutex _handles_lock;
+        uint64_t _next_handle = 1;
+        std::map<uint64_t, std::shared_ptr<Readahead>> _handles;
+        //Directory as it was when it was opened or last rewound, readdir
+        //offsets are positions in it
+        struct Dir_Handle {
+            std::shared_ptr<const rtosfs::Directory> dir;
+            //Fetched by opendir and not yet read from, the first readdir at
+            //offset 0 uses it rather than fetching the directory again
+            bool opened = true;
+        };
+        std::map<uint64_t, Dir_Handle> _dir_handles;
+        //Appends to a chunked file not yet in its chunk list, by node. They
+        //are committed on flush, fsync, release and before anything else that
+        //needs the file's data.
+        struct Appends {
+            std::mutex lock;
+            bool started = false;
+            //Dropped from _appends, writers holding it must look again
+            bool committed = false;
+            Pending_Appends pending;
+        };
+        std::mutex _appends_lock;
+        std::map<std::string, std::shared_ptr<Appends>> _appends;
+
+        //Buffers the write if it continues the appends to a chunked file,
+        //otherwise returns false and it must go through _file_data.write
+        bool _append(Node &node, const Inode &inode, const char *buf, const size_t &size, const off_t &off);
+        void _commit_appends(Node &node);
+        void _commit(Node &node, Appends &appends);
+        //Size of the file at node once its appends are committed
+        uint64_t _pending_size(const Node &node, const uint64_t &size);
+
+        //Declared after _file_data so prefetches finish before it is destroyed
+        Work_Pool _readahead_pool;
+
+        void _open_handle(struct fuse_file_info *fi);
+        std::shared_ptr<Readahead> _handle(const struct fuse_file_info *fi);
+
+        //Look up name in the directory at dir_node
+        Node _child(Node &dir_node, const Path_Component &name);
+        Node _entry(const rtosfs::Directory &dir, const Path_Component &name);
+        Node _get_node(const Path &path);
+
+        //Drop the link to removed from its node, if there was one
+        void _drop_link(const rtosfs::Entry &removed);
         Node _get_node(const char *path);
         Node _get_node(const std::deque<std::string> &decomp_path);
         Inode _get_inode(const char *path);
-        rtosfs::Directory _get_dir(const char *path);
-        rtosfs::Directory _get_dir(const std::deque<std::string> &decomp_path);
+        std::shared_ptr<const rtosfs::Directory> _get_dir(const char *path);
+        std::shared_ptr<const rtosfs::Directory> _get_dir(const std::deque<std::string> &decomp_path);
+
+        //xattr dictionaries are immutable once stored, so they are cached by ref
+        Ref_Cache<rtosfs::Dictionary> _xattr_cache;
+
+        //So are directories, parsed ones are cached by ref unless they are
+        //large, so lookups neither copy nor parse them again
+        Ref_Cache<rtosfs::Directory> _dir_cache;
+        std::shared_ptr<const rtosfs::Directory> _parse_dir(const Ref &data_ref, const std::string &serialized_dir);
+        std::shared_ptr<const rtosfs::Dictionary> _get_xattrs(const Inode &inode);
+        void _set_xattrs(Inode &inode, const std::shared_ptr<const rtosfs::Dictionary> &xattrs);
+
+        CODEC _compression(const Inode &dir_inode);
 
         //TODO:
         //Replace this with a smarter tree structure so we can invalidate
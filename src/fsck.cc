@@ -0,0 +1,268 @@
+#include "fsck.h"
+
+#include "fetch_hints.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+namespace{
+
+uint64_t short_ref(const char *ref){
+    uint64_t r;
+    std::memcpy(&r, ref, sizeof(r));
+    return r;
+}
+
+std::string join(const std::string &dir, const std::string &name){
+    return (dir == "/") ? dir + name : dir + "/" + name;
+}
+
+}
+
+Fsck::Fsck(const std::shared_ptr<Object_Store> &backend, const size_t &threads, std::ostream &out, std::ostream &progress):
+    _backend(backend),
+    _threads(threads),
+    _out(out),
+    _progress(progress)
+{
+}
+
+uint64_t Fsck::check(const std::string &prefix){
+    const auto start = std::chrono::steady_clock::now();
+    const auto elapsed = [&](){
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    };
+
+    std::mutex done_lock;
+    std::condition_variable done_cv;
+    bool done = false;
+    std::thread reporter([&](){
+        std::unique_lock<std::mutex> l(done_lock);
+        while(!done_cv.wait_for(l, std::chrono::seconds(1), [&](){ return done; })){
+            const double t = elapsed();
+            std::lock_guard<std::mutex> o(_out_lock);
+            _progress << _nodes << " nodes (" << (uint64_t)(_nodes / t) << "/s), "
+                << (_bytes >> 20) << " MiB (" << (uint64_t)((_bytes >> 20) / t) << " MiB/s), "
+                << _problems << " problems" << std::endl;
+        }
+    });
+
+    {
+        Work_Pool pool(_threads);
+        const Ref root(prefix);
+        _check_node(pool, "/", std::string(root.buf(), 32), 0);
+        pool.wait();
+    }
+
+    //Every node has been seen through every link to it by now, extra links
+    //were reported as they were found
+    for(auto &shard: _links){
+        for(const auto &l: shard.links){
+            if(l.second.found < l.second.expected){
+                std::stringstream node;
+                node << "node " << std::hex << std::setfill('0') << std::setw(16) << __builtin_bswap64(l.first) << "...";
+                _problem(node.str(), "st_nlink is " + std::to_string(l.second.expected) + " but only " + std::to_string(l.second.found) + " entries link to it");
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> l(done_lock);
+        done = true;
+    }
+    done_cv.notify_all();
+    reporter.join();
+
+    const double t = elapsed();
+    _progress << "Checked " << _nodes << " nodes, " << _directories << " directories, "
+        << (_bytes >> 20) << " MiB in " << t << "s (" << (uint64_t)(_nodes / t) << " nodes/s), "
+        << _problems << " problems" << std::endl;
+    return _problems;
+}
+
+void Fsck::_check_node(Work_Pool &pool, const std::string &path, const std::string &log_ref, const uint32_t &entry_mode){
+    std::string log;
+    try{
+        log = _backend->fetch(Ref(log_ref.c_str(), 32)).data();
+    }
+    catch(E_OBJECT_DNE e){
+        _problem(path, "node log does not exist");
+        return;
+    }
+    _nodes++;
+    _bytes += log.size();
+
+    Inode inode;
+    try{
+        inode = inode_generations(log).back();
+    }
+    catch(E_BAD_INODE e){
+        _problem(path, "node log is " + std::to_string(log.size()) + " bytes, which is not a sequence of inode records");
+        return;
+    }
+
+    if( (entry_mode != 0) && ((entry_mode & S_IFMT) != (inode.st_mode & S_IFMT)) ){
+        _problem(path, "directory entry has a different file type to the inode");
+    }
+
+    //The root has no entry linking it, so no meaningful link count
+    if( (path != "/") && !_link(path, log_ref, inode.st_nlink) ){
+        //Already checked through another link
+        return;
+    }
+
+    if(!null_ref(inode.xattr_ref)){
+        try{
+            const std::string raw = fetch_immutable(*_backend, Ref(inode.xattr_ref, 32)).data();
+            _bytes += raw.size();
+            rtosfs::Dictionary xattrs;
+            if(!xattrs.ParseFromString(raw)){
+                _problem(path, "xattrs do not parse");
+            }
+        }
+        catch(E_OBJECT_DNE e){
+            _problem(path, "xattr_ref does not exist");
+        }
+    }
+
+    try{
+        if(inode.type == NODE_DIR){
+            _check_directory(pool, path, inode);
+        }
+        else if(inode.type == NODE_SYM){
+            const std::string target = fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data();
+            _bytes += target.size();
+            if((off_t)target.size() != inode.st_size){
+                _problem(path, "st_size is " + std::to_string(inode.st_size) + " but the symlink target is " + std::to_string(target.size()) + " bytes");
+            }
+        }
+        else if(inode.type == NODE_FILE){
+            //An empty object has no tail to ask for
+            if(inode.st_size == 0){
+                _backend->fetch(Ref(inode.data_ref, 32));
+            }
+            else if(!_exists(Ref(inode.data_ref, 32))){
+                _problem(path, "data_ref does not exist");
+            }
+        }
+        else if(inode.type == NODE_CHUNKED){
+            _check_chunks(path, inode);
+        }
+        else{
+            _problem(path, "unknown node type " + std::to_string(inode.type));
+        }
+    }
+    catch(E_OBJECT_DNE e){
+        _problem(path, "data_ref does not exist");
+    }
+}
+
+void Fsck::_check_directory(Work_Pool &pool, const std::string &path, const Inode &inode){
+    const std::string raw = fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data();
+    _bytes += raw.size();
+    _directories++;
+    if((off_t)raw.size() != inode.st_size){
+        _problem(path, "st_size is " + std::to_string(inode.st_size) + " but the directory is " + std::to_string(raw.size()) + " bytes");
+    }
+
+    rtosfs::Directory dir;
+    if(!dir.ParseFromString(raw)){
+        _problem(path, "directory does not parse");
+        return;
+    }
+
+    for(const auto &e: dir.entries()){
+        const std::string entry_path = join(path, e.name());
+        if(e.inode_ref().size() != 32){
+            _problem(entry_path, "entry has a malformed inode_ref");
+            continue;
+        }
+        const std::string log_ref = e.inode_ref();
+        const uint32_t mode = e.mode();
+        pool.submit([this, &pool, entry_path, log_ref, mode](){
+            _check_node(pool, entry_path, log_ref, mode);
+        });
+    }
+}
+
+void Fsck::_check_chunks(const std::string &path, const Inode &inode){
+    const std::string raw = fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data();
+    _bytes += raw.size();
+    rtosfs::Chunk_List list;
+    if(!list.ParseFromString(raw)){
+        _problem(path, "chunk list does not parse");
+        return;
+    }
+
+    uint64_t size = 0;
+    for(const auto &c: list.chunks()){
+        size += c.length();
+        //Holes have no object
+        if(c.ref().empty()){
+            continue;
+        }
+        if( (c.ref().size() != 32) || !_exists(Ref(c.ref().c_str(), 32)) ){
+            _problem(path, "chunk at offset " + std::to_string(size - c.length()) + " does not exist");
+        }
+    }
+    if(size != (uint64_t)inode.st_size){
+        _problem(path, "st_size is " + std::to_string(inode.st_size) + " but the chunks add up to " + std::to_string(size));
+    }
+}
+
+bool Fsck::_exists(const Ref &ref){
+    //Chunks are shared between files, only ask about each once
+    const uint64_t key = short_ref(ref.buf());
+    {
+        std::lock_guard<std::mutex> l(_chunks_lock);
+        const auto c = _chunks.find(key);
+        if(c != _chunks.end()){
+            return c->second;
+        }
+    }
+
+    bool exists = true;
+    try{
+        _backend->fetch_tail(ref, 1);
+    }
+    catch(E_OBJECT_DNE e){
+        exists = false;
+    }
+
+    std::lock_guard<std::mutex> l(_chunks_lock);
+    _chunks[key] = exists;
+    return exists;
+}
+
+bool Fsck::_link(const std::string &path, const std::string &log_ref, const nlink_t &expected){
+    const uint64_t key = short_ref(log_ref.data());
+    Link_Shard &shard = _links[(unsigned char)log_ref[0]];
+    nlink_t found = 1;
+    bool first = true;
+    {
+        std::lock_guard<std::mutex> l(shard.lock);
+        const auto existing = shard.links.find(key);
+        if(existing != shard.links.end()){
+            found = ++existing->second.found;
+            first = false;
+        }
+        else{
+            shard.links[key] = Links{expected, 1};
+        }
+    }
+
+    if(found == expected + 1){
+        _problem(path, "node has st_nlink " + std::to_string(expected) + " but more entries link to it");
+    }
+    return first;
+}
+
+void Fsck::_problem(const std::string &path, const std::string &problem){
+    _problems++;
+    std::lock_guard<std::mutex> l(_out_lock);
+    _out << path << ": " << problem << std::endl;
+}
@@ -0,0 +1,75 @@
+#ifndef __FSCK_H__
+#define __FSCK_H__
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+#include "disk_format.pb.h"
+#include "inode.h"
+#include "work_pool.h"
+
+/* Offline consistency check of a whole filesystem.
+ *
+ * Walks the tree from the node log at prefix with a pool of workers, each
+ * directory's entries being checked in parallel, and verifies that:
+ *  - every node log exists and is a non-empty sequence of inode records
+ *  - data_ref and xattr_ref resolve and parse
+ *  - st_size matches directory and symlink objects and chunk lists
+ *  - the file type recorded in directory entries matches the inode
+ *  - st_nlink matches the number of entries linking each node
+ *
+ * Problems are written to out as they are found, progress is written to
+ * progress once a second.
+ */
+class Fsck {
+
+    public:
+        Fsck(const std::shared_ptr<Object_Store> &backend, const size_t &threads, std::ostream &out, std::ostream &progress);
+
+        //Returns the number of problems found
+        uint64_t check(const std::string &prefix);
+
+    private:
+        struct Links {
+            nlink_t expected;
+            nlink_t found;
+        };
+
+        //Node logs are keyed by the first 8 bytes of their ref, which are
+        //random, so even 50M nodes take little memory
+        struct Link_Shard {
+            std::mutex lock;
+            std::unordered_map<uint64_t, Links> links;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        const size_t _threads;
+        std::ostream &_out;
+        std::ostream &_progress;
+        std::mutex _out_lock;
+
+        Link_Shard _links[256];
+        std::mutex _chunks_lock;
+        std::unordered_map<uint64_t, bool> _chunks;
+
+        std::atomic<uint64_t> _nodes{0};
+        std::atomic<uint64_t> _directories{0};
+        std::atomic<uint64_t> _bytes{0};
+        std::atomic<uint64_t> _problems{0};
+
+        void _check_node(Work_Pool &pool, const std::string &path, const std::string &log_ref, const uint32_t &entry_mode);
+        void _check_directory(Work_Pool &pool, const std::string &path, const Inode &inode);
+        void _check_chunks(const std::string &path, const Inode &inode);
+        bool _exists(const Ref &ref);
+        //Returns true the first time each node is linked
+        bool _link(const std::string &path, const std::string &log_ref, const nlink_t &expected);
+        void _problem(const std::string &path, const std::string &problem);
+
+};
+
+#endif
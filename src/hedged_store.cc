@@ -0,0 +1,244 @@
+#include "hedged_store.h"
+
+#include "fetch_hints.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace{
+
+//Reads the hedge delay is worked out from
+const size_t LATENCY_SAMPLES = 1024;
+//How often the delay is worked out again, in reads
+const size_t LATENCY_UPDATE = 64;
+
+//Most requests in flight at once, beyond that reads are no longer hedged
+const size_t MAX_THREADS = 64;
+//How long a thread waits for a request before it exits
+const std::chrono::seconds IDLE_TIMEOUT(10);
+
+//What became of one read, shared by every request made for it
+struct Flight {
+    std::mutex lock;
+    std::condition_variable done_cv;
+    bool done = false;
+    bool answered = false;
+    std::string result;
+    std::exception_ptr error;
+    size_t failed = 0;
+};
+
+}
+
+Hedged_Store::Hedged_Store(const std::vector<std::shared_ptr<Object_Store>> &backends, const Hedge_Options &options):
+    _backends(backends),
+    _options(options),
+    _hedge_delay(options.min_delay)
+{
+}
+
+Hedged_Store::~Hedged_Store(){
+    std::map<std::thread::id, std::thread> threads;
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _stopping = true;
+        threads.swap(_threads);
+    }
+    _work_ready.notify_all();
+    for(auto &t: threads){
+        t.second.join();
+    }
+}
+
+void Hedged_Store::store(const Ref &ref, const Object &obj){
+    _backends[0]->store(ref, obj);
+}
+
+Object Hedged_Store::fetch(const Ref &ref){
+    if( (_backends.size() == 1) || !Immutable_Fetch::active() ){
+        return _backends[0]->fetch(ref);
+    }
+    return Object(_hedge([&ref](Object_Store &backend){
+        return backend.fetch(ref).data();
+    }));
+}
+
+Object Hedged_Store::fetch(const Ref &ref, const size_t &start, const size_t &end){
+    return _backends[0]->fetch(ref, start, end);
+}
+
+Object Hedged_Store::fetch_tail(const Ref &ref, const size_t &num_bytes){
+    std::string tail(num_bytes, '\0');
+    fetch_tail(ref, num_bytes, &tail[0]);
+    return Object(tail);
+}
+
+void Hedged_Store::fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf){
+    if( (_backends.size() == 1) || !Stale_Fetch::active() ){
+        _backends[0]->fetch_tail(ref, num_bytes, buf);
+        return;
+    }
+    const std::string tail = _hedge([&ref, &num_bytes](Object_Store &backend){
+        std::string tail(num_bytes, '\0');
+        backend.fetch_tail(ref, num_bytes, &tail[0]);
+        return tail;
+    });
+    std::memcpy(buf, tail.data(), num_bytes);
+}
+
+void Hedged_Store::append(const Ref &ref, const char *data, const size_t &size){
+    _backends[0]->append(ref, data, size);
+}
+
+std::string Hedged_Store::_hedge(const std::function<std::string(Object_Store &)> &request){
+    const auto flight = std::make_shared<Flight>();
+    //Attempts may outlive this call, so hold their own copy of the request
+    const auto attempt = [this, request, flight](const size_t &b){
+        const auto start = std::chrono::steady_clock::now();
+        try{
+            std::string result = request(*_backends[b]);
+            _sample(std::chrono::steady_clock::now() - start);
+
+            std::lock_guard<std::mutex> l(flight->lock);
+            if(!flight->done){
+                flight->result.swap(result);
+                flight->answered = true;
+                flight->done = true;
+            }
+        }
+        catch(E_OBJECT_DNE e){
+            std::lock_guard<std::mutex> l(flight->lock);
+            flight->failed++;
+            //Only the primary knows an object is really not there
+            if( (b == 0) && !flight->done ){
+                flight->error = std::current_exception();
+                flight->done = true;
+            }
+            else if(!flight->error){
+                flight->error = std::current_exception();
+            }
+        }
+        catch(...){
+            std::lock_guard<std::mutex> l(flight->lock);
+            flight->failed++;
+            if(!flight->error){
+                flight->error = std::current_exception();
+            }
+        }
+        flight->done_cv.notify_all();
+    };
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto delay = _delay();
+    if(!_submit([attempt](){ attempt(0); })){
+        //Too much in flight already, wait for the primary like any other read
+        return request(*_backends[0]);
+    }
+    size_t sent = 1;
+    size_t limit = _backends.size();
+
+    std::unique_lock<std::mutex> l(flight->lock);
+    const auto answered_or_failed = [&flight, &sent](){
+        return flight->done || (flight->failed == sent);
+    };
+    while(!flight->done){
+        if(flight->failed == sent){
+            //Every request so far failed, don't wait to try the next
+            if(sent == limit){
+                break;
+            }
+        }
+        else if(sent == limit){
+            flight->done_cv.wait(l, answered_or_failed);
+            continue;
+        }
+        else if(flight->done_cv.wait_until(l, start + delay * sent, answered_or_failed)){
+            continue;
+        }
+
+        const size_t b = sent;
+        if(_submit([attempt, b](){ attempt(b); })){
+            sent++;
+        }
+        else{
+            limit = sent;
+        }
+    }
+
+    if(flight->answered){
+        return flight->result;
+    }
+    std::rethrow_exception(flight->error);
+}
+
+std::chrono::nanoseconds Hedged_Store::_delay(){
+    std::lock_guard<std::mutex> l(_latency_lock);
+    return _hedge_delay;
+}
+
+void Hedged_Store::_sample(const std::chrono::nanoseconds &latency){
+    std::lock_guard<std::mutex> l(_latency_lock);
+    if(_samples.size() < LATENCY_SAMPLES){
+        _samples.push_back(latency.count());
+    }
+    else{
+        _samples[_next_sample] = latency.count();
+    }
+    _next_sample = (_next_sample + 1) % LATENCY_SAMPLES;
+
+    if(_next_sample % LATENCY_UPDATE == 0){
+        std::vector<uint64_t> sorted(_samples);
+        const auto p = sorted.begin() + std::min(sorted.size() - 1, (size_t)(_options.percentile * sorted.size()));
+        std::nth_element(sorted.begin(), p, sorted.end());
+        _hedge_delay = std::max<std::chrono::nanoseconds>(std::chrono::nanoseconds(*p), _options.min_delay);
+    }
+}
+
+bool Hedged_Store::_submit(const std::function<void()> &work){
+    std::lock_guard<std::mutex> l(_lock);
+    //Exited threads hold no lock and do nothing more, so they join at once
+    for(const auto &id: _exited){
+        const auto t = _threads.find(id);
+        t->second.join();
+        _threads.erase(t);
+    }
+    _exited.clear();
+
+    if(_queue.size() < _idle){
+        _queue.push_back(work);
+        _work_ready.notify_one();
+        return true;
+    }
+    if(_threads.size() >= MAX_THREADS){
+        return false;
+    }
+    _queue.push_back(work);
+    std::thread t(&Hedged_Store::_worker, this);
+    _threads[t.get_id()] = std::move(t);
+    return true;
+}
+
+void Hedged_Store::_worker(){
+    std::unique_lock<std::mutex> l(_lock);
+    while(true){
+        if(!_queue.empty()){
+            const auto work = _queue.front();
+            _queue.pop_front();
+            l.unlock();
+            work();
+            l.lock();
+        }
+        else if(_stopping){
+            return;
+        }
+        else{
+            _idle++;
+            const bool woken = _work_ready.wait_for(l, IDLE_TIMEOUT, [this](){ return !_queue.empty() || _stopping; });
+            _idle--;
+            if(!woken){
+                _exited.push_back(std::this_thread::get_id());
+                return;
+            }
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef __HEDGED_STORE_H__
+#define __HEDGED_STORE_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <rtos/object_store.h>
+
+struct Hedge_Options {
+    //Reads slower than this fraction of recent reads are sent to a replica
+    double percentile = 0.95;
+
+    //Never hedge reads faster than this, however fast the rest are
+    std::chrono::microseconds min_delay = std::chrono::microseconds(200);
+};
+
+/* Object_Store decorator hedging slow reads across replicas of one store.
+ *
+ * Only whole object fetches under an Immutable_Fetch and tails under a
+ * Stale_Fetch are hedged. The former never change once stored, so every
+ * replica that has one has the same one, and the latter are read by
+ * Cache_Store, whose tails may be a lease old anyway. A fetch goes to the
+ * primary, and if it has not answered once it
+ * is slower than the configured percentile of recent fetches, the same
+ * request is sent to the next replica, and so on. The first answer is used,
+ * the rest are left to finish and dropped. So a stall on one rtosd costs a
+ * fetch about the hedge delay, not the stall.
+ *
+ * Writes, ranges and unhinted fetches go to the primary only. An unhinted
+ * tail or changing object from a lagging replica could miss writes the
+ * caller must see, e.g. before it appends on top of them, and ranges are
+ * file data read by Readahead and File_Data, which would rather wait than
+ * read it twice.
+ *
+ * The primary is authoritative for whether an object exists, replicas may
+ * not have caught up yet, so E_OBJECT_DNE from a replica is only thrown if
+ * every backend failed.
+ */
+class Hedged_Store : public Object_Store {
+
+    public:
+        //backends[0] is the primary
+        Hedged_Store(const std::vector<std::shared_ptr<Object_Store>> &backends, const Hedge_Options &options);
+
+        //Waits for requests still running, e.g. stalled ones that lost
+        ~Hedged_Store();
+
+        void store(const Ref &ref, const Object &obj);
+        Object fetch(const Ref &ref);
+        Object fetch(const Ref &ref, const size_t &start, const size_t &end);
+        Object fetch_tail(const Ref &ref, const size_t &num_bytes);
+        void fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf);
+        void append(const Ref &ref, const char *data, const size_t &size);
+
+    private:
+        const std::vector<std::shared_ptr<Object_Store>> _backends;
+        const Hedge_Options _options;
+
+        //Recent fetch latencies, and the hedge delay they give
+        std::mutex _latency_lock;
+        std::vector<uint64_t> _samples;
+        size_t _next_sample = 0;
+        std::chrono::nanoseconds _hedge_delay;
+
+        //Requests block for as long as a backend stalls, so a new one gets a
+        //thread of its own rather than waiting for a fixed number of them, up
+        //to a limit. Threads left idle for long exit again.
+        std::mutex _lock;
+        std::condition_variable _work_ready;
+        std::deque<std::function<void()>> _queue;
+        size_t _idle = 0;
+        bool _stopping = false;
+        std::map<std::thread::id, std::thread> _threads;
+        //Threads that exited and are yet to be joined
+        std::vector<std::thread::id> _exited;
+
+        //Runs request against the primary, then against each replica in
+        //turn while none has answered
+        std::string _hedge(const std::function<std::string(Object_Store &)> &request);
+        std::chrono::nanoseconds _delay();
+        void _sample(const std::chrono::nanoseconds &latency);
+        //False if every thread is busy and no more may be started
+        bool _submit(const std::function<void()> &work);
+        void _worker();
+
+};
+
+#endif
@@ -0,0 +1,349 @@
+#include "import.h"
+
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#include "disk_format.pb.h"
+#include "fetch_hints.h"
+#include "path.h"
+#include "superblock.h"
+
+namespace{
+
+//Files are stored with one append per block, so memory use is bounded by
+//threads * UPLOAD_BLOCK whatever the size of the files
+const size_t UPLOAD_BLOCK = 4 * 1024 * 1024;
+
+std::string join(const std::string &dir, const std::string &name){
+    return (dir == "/") ? dir + name : dir + "/" + name;
+}
+
+Inode from_stat(const struct stat &st){
+    Inode inode;
+    std::memset(&inode, 0, sizeof(inode));
+    inode.st_mode = st.st_mode;
+    inode.st_uid = st.st_uid;
+    inode.st_gid = st.st_gid;
+    inode.st_nlink = 1;
+    inode.st_atim = st.st_atim;
+    inode.st_mtim = st.st_mtim;
+    inode.st_ctim = st.st_ctim;
+    return inode;
+}
+
+}
+
+Import::Import(const std::shared_ptr<Object_Store> &backend, const size_t &threads, std::ostream &out):
+    _backend(backend),
+    _threads(threads),
+    _out(out)
+{
+}
+
+int Import::run(const std::string &prefix, const std::string &source, const std::string &dest){
+    struct stat st;
+    if(lstat(source.c_str(), &st) != 0){
+        _error(source, strerror(errno));
+        return -ENOENT;
+    }
+
+    const Path dest_path(dest.c_str());
+    if(dest_path.empty()){
+        return -EEXIST;
+    }
+
+    //Find the destination's parent before writing anything
+    Ref parent_log(prefix);
+    try{
+        for(const auto &name: dest_path.parent()){
+            const Inode inode = fetch_inode(*_backend, parent_log);
+            if(inode.type != NODE_DIR){
+                return -ENOTDIR;
+            }
+
+            rtosfs::Directory dir;
+            dir.ParseFromString(fetch_immutable(*_backend, Ref(inode.data_ref, 32)).data());
+            bool found = false;
+            for(const auto &e: dir.entries()){
+                if(name == e.name()){
+                    parent_log = Ref(e.inode_ref().c_str(), 32);
+                    found = true;
+                    break;
+                }
+            }
+            if(!found){
+                return -ENOENT;
+            }
+        }
+        const Inode parent_inode = fetch_inode(*_backend, parent_log);
+        if(parent_inode.type != NODE_DIR){
+            return -ENOTDIR;
+        }
+        rtosfs::Directory parent_dir;
+        parent_dir.ParseFromString(fetch_immutable(*_backend, Ref(parent_inode.data_ref, 32)).data());
+        for(const auto &e: parent_dir.entries()){
+            if(dest_path.last() == e.name()){
+                return -EEXIST;
+            }
+        }
+    }
+    catch(E_OBJECT_DNE e){
+        return -ENOENT;
+    }
+
+    const Ref root_log = Ref();
+    const std::string root_ref(root_log.buf(), 32);
+    {
+        Work_Pool pool(_threads);
+        if(S_ISDIR(st.st_mode)){
+            _directory(pool, source, root_ref, st);
+        }
+        else if(S_ISREG(st.st_mode)){
+            _file(source, root_ref, st, false);
+        }
+        else if(S_ISLNK(st.st_mode)){
+            _symlink(source, root_ref, st);
+        }
+        else{
+            _error(source, "not a file, directory or symlink");
+        }
+        pool.wait();
+    }
+
+    //Every link to a multiply linked file has been counted by now
+    for(auto &l: _linked){
+        try{
+            l.second.inode.st_nlink = l.second.links;
+            append_inode(*_backend, Ref(l.second.log_ref.c_str(), 32), l.second.inode);
+        }
+        catch(...){
+            _error(source, "failed to store a hard linked node");
+        }
+    }
+
+    if(_errors > 0){
+        _out << _errors << " errors, " << dest << " was not created" << std::endl;
+        return -EIO;
+    }
+
+    //The parent is fetched again as it may have changed during the import
+    try{
+        Inode parent_inode = fetch_inode(*_backend, parent_log);
+        rtosfs::Directory parent_dir;
+        parent_dir.ParseFromString(fetch_immutable(*_backend, Ref(parent_inode.data_ref, 32)).data());
+        for(const auto &e: parent_dir.entries()){
+            if(dest_path.last() == e.name()){
+                _out << dest << " was created during the import" << std::endl;
+                return -EEXIST;
+            }
+        }
+
+        auto e = parent_dir.add_entries();
+        e->set_name(dest_path.last().str());
+        e->set_inode_ref(root_ref);
+        e->set_mode(st.st_mode);
+
+        std::string serialized;
+        parent_dir.SerializeToString(&serialized);
+        const Ref new_dir_ref = Ref();
+        _backend->store(new_dir_ref, Object(serialized));
+
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        std::memcpy(parent_inode.data_ref, new_dir_ref.buf(), 32);
+        parent_inode.st_size = serialized.size();
+        parent_inode.st_mtim = now;
+        parent_inode.st_ctim = now;
+        append_inode(*_backend, parent_log, parent_inode);
+    }
+    catch(E_OBJECT_DNE e){
+        return -EIO;
+    }
+
+    //Flushed when it goes out of scope
+    Usage_Counters usage(_backend, prefix, std::chrono::milliseconds(5000));
+    usage.add(_files, _directories, _bytes);
+    _out << "Imported " << _files << " files, " << _directories << " directories, "
+        << (_bytes >> 20) << " MiB" << std::endl;
+    return 0;
+}
+
+void Import::_directory(Work_Pool &pool, const std::string &path, const std::string &log_ref, const struct stat &st){
+    DIR *d = opendir(path.c_str());
+    if(d == nullptr){
+        _error(path, strerror(errno));
+        return;
+    }
+
+    rtosfs::Directory dir;
+    for(struct dirent *de = readdir(d); de != nullptr; de = readdir(d)){
+        const std::string name(de->d_name);
+        if( (name == ".") || (name == "..") ){
+            continue;
+        }
+
+        const std::string child_path = join(path, name);
+        struct stat child;
+        if(lstat(child_path.c_str(), &child) != 0){
+            _error(child_path, strerror(errno));
+            continue;
+        }
+
+        std::string child_ref;
+        if(S_ISDIR(child.st_mode)){
+            child_ref = std::string(Ref().buf(), 32);
+            pool.submit([this, &pool, child_path, child_ref, child](){
+                _directory(pool, child_path, child_ref, child);
+            });
+        }
+        else if(S_ISREG(child.st_mode) && (child.st_nlink > 1)){
+            bool first;
+            {
+                std::lock_guard<std::mutex> l(_lock);
+                auto &linked = _linked[std::make_pair(child.st_dev, child.st_ino)];
+                first = linked.log_ref.empty();
+                if(first){
+                    linked.log_ref = std::string(Ref().buf(), 32);
+                    linked.links = 0;
+                }
+                linked.links++;
+                child_ref = linked.log_ref;
+            }
+            if(first){
+                pool.submit([this, child_path, child_ref, child](){
+                    _file(child_path, child_ref, child, true);
+                });
+            }
+        }
+        else if(S_ISREG(child.st_mode)){
+            child_ref = std::string(Ref().buf(), 32);
+            pool.submit([this, child_path, child_ref, child](){
+                _file(child_path, child_ref, child, false);
+            });
+        }
+        else if(S_ISLNK(child.st_mode)){
+            child_ref = std::string(Ref().buf(), 32);
+            pool.submit([this, child_path, child_ref, child](){
+                _symlink(child_path, child_ref, child);
+            });
+        }
+        else{
+            std::lock_guard<std::mutex> l(_lock);
+            _out << child_path << ": skipped, not a file, directory or symlink" << std::endl;
+            continue;
+        }
+
+        auto e = dir.add_entries();
+        e->set_name(name);
+        e->set_inode_ref(child_ref);
+        e->set_mode(child.st_mode);
+    }
+    closedir(d);
+
+    try{
+        std::string serialized;
+        dir.SerializeToString(&serialized);
+        const Ref dir_ref = Ref();
+        _backend->store(dir_ref, Object(serialized));
+
+        Inode inode = from_stat(st);
+        inode.type = NODE_DIR;
+        inode.st_size = serialized.size();
+        std::memcpy(inode.data_ref, dir_ref.buf(), 32);
+        append_inode(*_backend, Ref(log_ref.c_str(), 32), inode);
+        _directories++;
+    }
+    catch(...){
+        _error(path, "failed to store directory");
+    }
+}
+
+void Import::_file(const std::string &path, const std::string &log_ref, const struct stat &st, const bool &linked){
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if(fd < 0){
+        _error(path, strerror(errno));
+        return;
+    }
+
+    Inode inode = from_stat(st);
+    inode.type = NODE_FILE;
+    const Ref data_ref = Ref();
+    std::memcpy(inode.data_ref, data_ref.buf(), 32);
+    try{
+        std::vector<char> block(UPLOAD_BLOCK);
+        uint64_t size = 0;
+        bool stored = false;
+        for(;;){
+            const ssize_t r = ::read(fd, &block[0], block.size());
+            if(r < 0){
+                _error(path, strerror(errno));
+                ::close(fd);
+                return;
+            }
+            if(!stored){
+                _backend->store(data_ref, Object(std::string(&block[0], r)));
+                stored = true;
+            }
+            else if(r > 0){
+                _backend->append(data_ref, &block[0], r);
+            }
+            size += r;
+            if(r == 0){
+                break;
+            }
+        }
+        ::close(fd);
+        inode.st_size = size;
+
+        if(linked){
+            std::lock_guard<std::mutex> l(_lock);
+            _linked[std::make_pair(st.st_dev, st.st_ino)].inode = inode;
+        }
+        else{
+            append_inode(*_backend, Ref(log_ref.c_str(), 32), inode);
+        }
+        _files++;
+        _bytes += size;
+    }
+    catch(...){
+        ::close(fd);
+        _error(path, "failed to store file");
+    }
+}
+
+void Import::_symlink(const std::string &path, const std::string &log_ref, const struct stat &st){
+    std::vector<char> target(st.st_size + 1);
+    const ssize_t r = readlink(path.c_str(), &target[0], target.size());
+    if( (r < 0) || ((size_t)r >= target.size()) ){
+        _error(path, "cannot read link");
+        return;
+    }
+
+    try{
+        const Ref target_ref = Ref();
+        _backend->store(target_ref, Object(std::string(&target[0], r)));
+
+        Inode inode = from_stat(st);
+        inode.type = NODE_SYM;
+        inode.st_size = r;
+        std::memcpy(inode.data_ref, target_ref.buf(), 32);
+        append_inode(*_backend, Ref(log_ref.c_str(), 32), inode);
+        _files++;
+        _bytes += r;
+    }
+    catch(...){
+        _error(path, "failed to store symlink");
+    }
+}
+
+void Import::_error(const std::string &path, const std::string &what){
+    _errors++;
+    std::lock_guard<std::mutex> l(_lock);
+    _out << path << ": " << what << std::endl;
+}
@@ -0,0 +1,68 @@
+#ifndef __IMPORT_H__
+#define __IMPORT_H__
+
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <rtos/object_store.h>
+
+#include "inode.h"
+#include "work_pool.h"
+
+/* Bulk load of a local tree into a File System, directly against the object
+ * store rather than through a mount.
+ *
+ * Local directories are read and files uploaded in parallel by a pool of
+ * workers. Every node log ref is chosen as soon as its name is read, so each
+ * directory is stored once with its complete entry list and every node gets
+ * a single generation. Nothing is reachable until the whole subtree has been
+ * written, after which it is added to the destination's parent with one
+ * directory update, so a failed import leaves the File System untouched,
+ * apart from unreachable objects. That update does not go through a mount's
+ * directory commits, so nothing else should be changing the destination's
+ * parent at the same time.
+ *
+ * Files are stored as plain files, the chunking and compression options of
+ * mounts are not applied. Hard links within the tree are kept, special files
+ * are skipped.
+ */
+class Import {
+
+    public:
+        Import(const std::shared_ptr<Object_Store> &backend, const size_t &threads, std::ostream &out);
+
+        //Imports the local tree at source as dest in the File System at
+        //prefix, returns 0 or -errno
+        int run(const std::string &prefix, const std::string &source, const std::string &dest);
+
+    private:
+        //A local file with more than one link, stored once
+        struct Linked {
+            std::string log_ref;
+            nlink_t links;
+            Inode inode;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        const size_t _threads;
+        std::ostream &_out;
+
+        std::mutex _lock;
+        std::map<std::pair<dev_t, ino_t>, Linked> _linked;
+        std::atomic<uint64_t> _errors{0};
+        std::atomic<uint64_t> _files{0};
+        std::atomic<uint64_t> _directories{0};
+        std::atomic<uint64_t> _bytes{0};
+
+        void _directory(Work_Pool &pool, const std::string &path, const std::string &log_ref, const struct stat &st);
+        void _file(const std::string &path, const std::string &log_ref, const struct stat &st, const bool &linked);
+        void _symlink(const std::string &path, const std::string &log_ref, const struct stat &st);
+        void _error(const std::string &path, const std::string &what);
+
+};
+
+#endif
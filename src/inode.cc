@@ -1,10 +1,163 @@
 #include "inode.h"
 
 #include <cassert>
+#include <cstring>
 #include <sys/types.h>
 #include <sys/xattr.h>
 #include <rtos/encode.h>
 
+namespace{
+
+const uint32_t INODE_MAGIC = 0x6e697472; //"rtin"
+
+void put(char *&out, uint64_t value, const size_t &bytes){
+    for(size_t i = 0; i < bytes; i++){
+        *out++ = value & 0xff;
+        value >>= 8;
+    }
+}
+
+uint64_t get(const char *&in, const size_t &bytes){
+    uint64_t value = 0;
+    for(size_t i = 0; i < bytes; i++){
+        value |= (uint64_t)(unsigned char)in[i] << (8 * i);
+    }
+    in += bytes;
+    return value;
+}
+
+void put_time(char *&out, const timespec &t){
+    put(out, t.tv_sec, 8);
+    put(out, t.tv_nsec, 4);
+}
+
+timespec get_time(const char *&in){
+    timespec t;
+    t.tv_sec = (int64_t)get(in, 8);
+    t.tv_nsec = get(in, 4);
+    return t;
+}
+
+//Whether the INODE_RECORD_SIZE bytes at record end in a versioned trailer
+bool is_record(const char *record){
+    const char *trailer = record + INODE_RECORD_SIZE - 8;
+    const uint32_t version = get(trailer, 4);
+    const uint32_t magic = get(trailer, 4);
+    if(magic != INODE_MAGIC){
+        return false;
+    }
+    if(version != INODE_VERSION){
+        throw E_BAD_INODE();
+    }
+    return true;
+}
+
+Inode decode(const char *in){
+    Inode inode;
+    std::memset(&inode, 0, sizeof(inode));
+    inode.st_mode = get(in, 4);
+    inode.st_uid = get(in, 4);
+    inode.st_gid = get(in, 4);
+    get(in, 4); //flags
+    inode.st_size = get(in, 8);
+    inode.st_nlink = get(in, 4);
+    inode.st_atim = get_time(in);
+    inode.st_mtim = get_time(in);
+    inode.st_ctim = get_time(in);
+    inode.type = (NODE_TYPE)get(in, 1);
+    std::memcpy(inode.data_ref, in, 32);
+    std::memcpy(inode.xattr_ref, in + 32, 32);
+    return inode;
+}
+
+//Size of the record ending at end, which is past the start of log
+size_t record_size(const char *log, const size_t &end){
+    if( (end >= INODE_RECORD_SIZE) && is_record(log + end - INODE_RECORD_SIZE) ){
+        return INODE_RECORD_SIZE;
+    }
+    else if(end >= sizeof(Inode)){
+        return sizeof(Inode);
+    }
+    throw E_BAD_INODE();
+}
+
+Inode decode_at(const char *log, const size_t &end, const size_t &size){
+    if(size == INODE_RECORD_SIZE){
+        return decode(log + end - size);
+    }
+    Inode inode;
+    std::memcpy(&inode, log + end - size, sizeof(Inode));
+    return inode;
+}
+
+}
+
+void encode_inode(const Inode &inode, char *record){
+    char *out = record;
+    put(out, inode.st_mode, 4);
+    put(out, inode.st_uid, 4);
+    put(out, inode.st_gid, 4);
+    put(out, 0, 4); //flags
+    put(out, inode.st_size, 8);
+    put(out, inode.st_nlink, 4);
+    put_time(out, inode.st_atim);
+    put_time(out, inode.st_mtim);
+    put_time(out, inode.st_ctim);
+    put(out, inode.type, 1);
+    std::memcpy(out, inode.data_ref, 32);
+    std::memcpy(out + 32, inode.xattr_ref, 32);
+    out += 64;
+    put(out, INODE_VERSION, 4);
+    put(out, INODE_MAGIC, 4);
+    assert(out == record + INODE_RECORD_SIZE);
+}
+
+Inode fetch_inode(Object_Store &backend, const Ref &log){
+    char record[INODE_RECORD_SIZE];
+    backend.fetch_tail(log, INODE_RECORD_SIZE, record);
+    if(is_record(record)){
+        return decode(record);
+    }
+
+    //Written before records were versioned
+    Inode inode;
+    backend.fetch_tail(log, sizeof(Inode), (char *)(&inode));
+    return inode;
+}
+
+void append_inode(Object_Store &backend, const Ref &log, const Inode &inode){
+    char record[INODE_RECORD_SIZE];
+    encode_inode(inode, record);
+    backend.append(log, record, INODE_RECORD_SIZE);
+}
+
+std::vector<Inode> inode_generations(const std::string &log){
+    std::vector<Inode> generations;
+    for(size_t end = log.size(); end > 0;){
+        const size_t size = record_size(log.data(), end);
+        generations.push_back(decode_at(log.data(), end, size));
+        end -= size;
+    }
+    if(generations.empty()){
+        throw E_BAD_INODE();
+    }
+    return std::vector<Inode>(generations.rbegin(), generations.rend());
+}
+
+Inode last_inode(const std::string &log){
+    const size_t size = record_size(log.data(), log.size());
+    return decode_at(log.data(), log.size(), size);
+}
+
+bool null_ref(const char *ref){
+    for(size_t i = 0; i < 32; i++){
+        if(ref[i] != 0){
+            return false;
+        }
+    }
+    return true;
+}
+
 std::ostream &operator<<(std::ostream &out, const timespec &t){
     out << "seconds: " << t.tv_sec << " nanos: " << t.tv_nsec;
     return out;
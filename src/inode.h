@@ -4,14 +4,21 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cstdint>
 #include <ostream>
+#include <string>
+#include <vector>
+#include <rtos/object_store.h>
 
 enum NODE_TYPE{
     NODE_DIR,
     NODE_FILE,
-    NODE_SYM
+    NODE_SYM,
+    NODE_CHUNKED    //Regular file whose data_ref names an rtosfs::Chunk_List
 };
 
+//In memory form of an inode. Node logs written before inode records were
+//versioned hold this struct raw, so its layout must not change.
 struct Inode{
     mode_t st_mode;
     uid_t st_uid;
@@ -26,6 +33,39 @@ struct Inode{
     char xattr_ref[32];
 };
 
+class E_BAD_INODE {};
+
+/* Inode records, appended to node logs for every generation.
+ *
+ * Fixed width little endian fields with no padding, ending in a version and
+ * a magic number so the last record of a log can be told apart from a raw
+ * legacy Inode:
+ *
+ *   u32 mode, u32 uid, u32 gid, u32 flags, u64 size, u32 nlink,
+ *   3 x (i64 seconds, u32 nanoseconds) atime, mtime, ctime,
+ *   u8 type, 32 byte data_ref, 32 byte xattr_ref, u32 version, u32 magic
+ *
+ * flags are for optional features and are 0 for now, readers ignore flags
+ * they do not know. Readers throw E_BAD_INODE on versions they do not know.
+ */
+const size_t INODE_RECORD_SIZE = 137;
+const uint32_t INODE_VERSION = 1;
+
+void encode_inode(const Inode &inode, char *record);
+
+//The current generation of the node log at log, throws E_OBJECT_DNE
+Inode fetch_inode(Object_Store &backend, const Ref &log);
+void append_inode(Object_Store &backend, const Ref &log, const Inode &inode);
+
+//Every generation in a whole node log, oldest first, throws E_BAD_INODE if
+//log is not a sequence of records
+std::vector<Inode> inode_generations(const std::string &log);
+//Only the last generation, throws E_BAD_INODE if log does not end in a record
+Inode last_inode(const std::string &log);
+
+//An all-zero ref means "no object", e.g. a node that has never had an xattr set
+bool null_ref(const char *ref);
+
 std::ostream &operator<<(std::ostream &out, const timespec &t);
 std::ostream &operator<<(std::ostream &out, const Inode &i);
 
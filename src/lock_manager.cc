@@ -0,0 +1,324 @@
+#include "lock_manager.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <sys/file.h>
+#include <utility>
+#include <vector>
+
+namespace{
+
+//Absolute [start, end) of fl, which FUSE always gives us relative to the
+//start of the file
+bool to_range(const struct flock &fl, uint64_t &start, uint64_t &end){
+    off_t s = fl.l_start;
+    off_t len = fl.l_len;
+    if(len < 0){
+        s += len;
+        len = -len;
+    }
+    if(s < 0){
+        return false;
+    }
+    start = s;
+    end = (len == 0) ? UINT64_MAX : start + len;
+    return true;
+}
+
+//Heap priority of the range with id, ids are sequential so they are mixed
+//(the splitmix64 finalizer) to keep the treap balanced
+uint64_t priority(const uint64_t &id){
+    uint64_t z = id + 0x9e3779b97f4a7c15ull;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+bool before(const uint64_t &start, const uint64_t &id, const uint64_t &other_start, const uint64_t &other_id){
+    return (start < other_start) || ((start == other_start) && (id < other_id));
+}
+
+}
+
+int Lock_Manager::get(const Ref &node, const uint64_t &owner, struct flock &fl){
+    uint64_t start, end;
+    if( !to_range(fl, start, end) || ((fl.l_type != F_RDLCK) && (fl.l_type != F_WRLCK)) ){
+        return -EINVAL;
+    }
+
+    const std::string key(node.buf(), 32);
+    const auto file = _acquire(key);
+    {
+        std::lock_guard<std::mutex> l(file->lock);
+        uint64_t conflict_start;
+        const Range *conflict = _conflict(*file, owner, fl.l_type, start, end, conflict_start);
+        if(conflict == nullptr){
+            fl.l_type = F_UNLCK;
+        }
+        else{
+            fl.l_type = conflict->type;
+            fl.l_whence = SEEK_SET;
+            fl.l_start = conflict_start;
+            fl.l_len = (conflict->end == UINT64_MAX) ? 0 : conflict->end - conflict_start;
+            fl.l_pid = conflict->pid;
+        }
+    }
+    _done(key, file);
+    return 0;
+}
+
+int Lock_Manager::set(const Ref &node, const uint64_t &owner, const struct flock &fl, const bool &wait){
+    uint64_t start, end;
+    if( !to_range(fl, start, end) || ((fl.l_type != F_RDLCK) && (fl.l_type != F_WRLCK) && (fl.l_type != F_UNLCK)) ){
+        return -EINVAL;
+    }
+
+    const std::string key(node.buf(), 32);
+    const auto file = _acquire(key);
+    int result = 0;
+    {
+        std::unique_lock<std::mutex> l(file->lock);
+        if(fl.l_type != F_UNLCK){
+            uint64_t conflict_start;
+            while(_conflict(*file, owner, fl.l_type, start, end, conflict_start) != nullptr){
+                if(!wait){
+                    result = -EAGAIN;
+                    break;
+                }
+                file->released.wait(l);
+            }
+        }
+
+        if(result == 0){
+            //Replaces whatever owner held over the range, so upgrades and
+            //downgrades are atomic
+            _unlock(*file, owner, start, end);
+            if(fl.l_type != F_UNLCK){
+                _add(*file, start, Range{end, fl.l_type, owner, fl.l_pid});
+            }
+            file->released.notify_all();
+        }
+    }
+    _done(key, file);
+    return result;
+}
+
+int Lock_Manager::flock(const Ref &node, const uint64_t &owner, const int &op){
+    const bool block = !(op & LOCK_NB);
+    const int type = op & ~LOCK_NB;
+    if( (type != LOCK_SH) && (type != LOCK_EX) && (type != LOCK_UN) ){
+        return -EINVAL;
+    }
+
+    const std::string key(node.buf(), 32);
+    const auto file = _acquire(key);
+    int result = 0;
+    {
+        std::unique_lock<std::mutex> l(file->lock);
+        if(type != LOCK_UN){
+            const auto conflicts = [&](){
+                for(const auto &f: file->flocks){
+                    if( (f.first != owner) && ((type == LOCK_EX) || (f.second == LOCK_EX)) ){
+                        return true;
+                    }
+                }
+                return false;
+            };
+            while(conflicts()){
+                if(!block){
+                    result = -EWOULDBLOCK;
+                    break;
+                }
+                file->released.wait(l);
+            }
+        }
+
+        if(result == 0){
+            if(type == LOCK_UN){
+                file->flocks.erase(owner);
+            }
+            else{
+                file->flocks[owner] = type;
+            }
+            file->released.notify_all();
+        }
+    }
+    _done(key, file);
+    return result;
+}
+
+Lock_Manager::Shard &Lock_Manager::_shard(const std::string &key){
+    //Refs are random, any byte will do
+    return _shards[(unsigned char)key[0] % 64];
+}
+
+std::shared_ptr<Lock_Manager::File_Locks> Lock_Manager::_acquire(const std::string &key){
+    Shard &shard = _shard(key);
+    std::lock_guard<std::mutex> l(shard.lock);
+    auto &file = shard.files[key];
+    if(!file){
+        file.reset(new File_Locks());
+    }
+    file->users++;
+    return file;
+}
+
+void Lock_Manager::_done(const std::string &key, const std::shared_ptr<File_Locks> &file){
+    Shard &shard = _shard(key);
+    std::lock_guard<std::mutex> l(shard.lock);
+    file->users--;
+    if(file->users > 0){
+        return;
+    }
+    std::lock_guard<std::mutex> f(file->lock);
+    if( !file->ranges && file->flocks.empty() ){
+        shard.files.erase(key);
+    }
+}
+
+void Lock_Manager::_update(Range_Node &node){
+    node.max_end = node.range.end;
+    if(node.left){
+        node.max_end = std::max(node.max_end, node.left->max_end);
+    }
+    if(node.right){
+        node.max_end = std::max(node.max_end, node.right->max_end);
+    }
+}
+
+void Lock_Manager::_split(std::unique_ptr<Range_Node> tree, const uint64_t &start, const uint64_t &id, std::unique_ptr<Range_Node> &less, std::unique_ptr<Range_Node> &rest){
+    if(!tree){
+        less.reset();
+        rest.reset();
+        return;
+    }
+
+    if(before(tree->start, tree->id, start, id)){
+        std::unique_ptr<Range_Node> right_less;
+        _split(std::move(tree->right), start, id, right_less, rest);
+        tree->right = std::move(right_less);
+        _update(*tree);
+        less = std::move(tree);
+    }
+    else{
+        std::unique_ptr<Range_Node> left_rest;
+        _split(std::move(tree->left), start, id, less, left_rest);
+        tree->left = std::move(left_rest);
+        _update(*tree);
+        rest = std::move(tree);
+    }
+}
+
+std::unique_ptr<Lock_Manager::Range_Node> Lock_Manager::_merge(std::unique_ptr<Range_Node> less, std::unique_ptr<Range_Node> rest){
+    if(!less){
+        return rest;
+    }
+    if(!rest){
+        return less;
+    }
+
+    if(priority(less->id) > priority(rest->id)){
+        less->right = _merge(std::move(less->right), std::move(rest));
+        _update(*less);
+        return less;
+    }
+    rest->left = _merge(std::move(less), std::move(rest->left));
+    _update(*rest);
+    return rest;
+}
+
+void Lock_Manager::_insert(std::unique_ptr<Range_Node> &tree, std::unique_ptr<Range_Node> node){
+    if(!tree){
+        tree = std::move(node);
+        return;
+    }
+
+    if(priority(node->id) > priority(tree->id)){
+        _split(std::move(tree), node->start, node->id, node->left, node->right);
+        _update(*node);
+        tree = std::move(node);
+        return;
+    }
+
+    if(before(node->start, node->id, tree->start, tree->id)){
+        _insert(tree->left, std::move(node));
+    }
+    else{
+        _insert(tree->right, std::move(node));
+    }
+    _update(*tree);
+}
+
+std::unique_ptr<Lock_Manager::Range_Node> Lock_Manager::_remove(std::unique_ptr<Range_Node> &tree, const uint64_t &start, const uint64_t &id){
+    if(!tree){
+        return nullptr;
+    }
+
+    if( (tree->start == start) && (tree->id == id) ){
+        std::unique_ptr<Range_Node> removed = std::move(tree);
+        tree = _merge(std::move(removed->left), std::move(removed->right));
+        return removed;
+    }
+
+    std::unique_ptr<Range_Node> removed = before(start, id, tree->start, tree->id) ? _remove(tree->left, start, id) : _remove(tree->right, start, id);
+    _update(*tree);
+    return removed;
+}
+
+void Lock_Manager::_add(File_Locks &file, const uint64_t &start, const Range &range){
+    std::unique_ptr<Range_Node> node(new Range_Node{start, file.next_id++, range, range.end, nullptr, nullptr});
+    _insert(file.ranges, std::move(node));
+}
+
+void Lock_Manager::_overlapping(const Range_Node *tree, const uint64_t &start, const uint64_t &end, std::vector<const Range_Node *> &found){
+    //Nothing below here reaches start
+    if( (tree == nullptr) || (tree->max_end <= start) ){
+        return;
+    }
+
+    _overlapping(tree->left.get(), start, end, found);
+    if(tree->start >= end){
+        //Nor does anything to the right start before end
+        return;
+    }
+    if(tree->range.end > start){
+        found.push_back(tree);
+    }
+    _overlapping(tree->right.get(), start, end, found);
+}
+
+const Lock_Manager::Range *Lock_Manager::_conflict(const File_Locks &file, const uint64_t &owner, const short &type, const uint64_t &start, const uint64_t &end, uint64_t &conflict_start) const{
+    std::vector<const Range_Node *> found;
+    _overlapping(file.ranges.get(), start, end, found);
+    for(const auto r: found){
+        if( (r->range.owner != owner) && ((type == F_WRLCK) || (r->range.type == F_WRLCK)) ){
+            conflict_start = r->start;
+            return &r->range;
+        }
+    }
+    return nullptr;
+}
+
+void Lock_Manager::_unlock(File_Locks &file, const uint64_t &owner, const uint64_t &start, const uint64_t &end){
+    std::vector<const Range_Node *> found;
+    _overlapping(file.ranges.get(), start, end, found);
+
+    std::vector<std::pair<uint64_t, Range>> remaining;
+    for(const auto r: found){
+        if(r->range.owner != owner){
+            continue;
+        }
+
+        //Other nodes are only relinked, so the rest of found stays valid
+        const std::unique_ptr<Range_Node> removed = _remove(file.ranges, r->start, r->id);
+        if(removed->start < start){
+            remaining.push_back(std::make_pair(removed->start, Range{start, removed->range.type, owner, removed->range.pid}));
+        }
+        if(removed->range.end > end){
+            remaining.push_back(std::make_pair(end, Range{removed->range.end, removed->range.type, owner, removed->range.pid}));
+        }
+    }
+    for(const auto &r: remaining){
+        _add(file, r.first, r.second);
+    }
+}
@@ -0,0 +1,107 @@
+#ifndef __LOCK_MANAGER_H__
+#define __LOCK_MANAGER_H__
+
+#include <condition_variable>
+#include <cstdint>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <rtos/object_store.h>
+
+/* POSIX byte range locks and flock() locks of the files of one mount.
+ *
+ * Locks are held in memory by node ref and owner, the lock_owner FUSE gives
+ * us, so they only exclude processes using the same mount. Files are spread
+ * over shards, each with its own mutex, and every file with locks has its own
+ * mutex and condition variable that blocked lockers wait on, so lockers of
+ * different files never contend.
+ *
+ * Byte ranges are kept in a treap ordered by start, each node also holding
+ * the largest end in its subtree, so the ranges overlapping a request are
+ * found in O(log n) plus the number found, however long any range is. A
+ * file's state is dropped as soon as it holds no locks and nobody is waiting
+ * on it.
+ *
+ * Ranges of one owner are split on partial unlocks but adjacent ranges are
+ * not merged, and there is no deadlock detection.
+ */
+class Lock_Manager {
+
+    public:
+        //F_GETLK, fl is set to the first lock conflicting with it, or its
+        //l_type to F_UNLCK if there is none
+        int get(const Ref &node, const uint64_t &owner, struct flock &fl);
+
+        //F_SETLK or, if wait, F_SETLKW, including F_UNLCK. Returns 0, or
+        //-EAGAIN if the range is locked by another owner and !wait
+        int set(const Ref &node, const uint64_t &owner, const struct flock &fl, const bool &wait);
+
+        //flock(2) operation op, returns 0 or -EWOULDBLOCK
+        int flock(const Ref &node, const uint64_t &owner, const int &op);
+
+    private:
+        struct Range {
+            //Exclusive, UINT64_MAX for ranges to the end of the file
+            uint64_t end;
+            short type;
+            uint64_t owner;
+            pid_t pid;
+        };
+
+        //Ordered by (start, id), ids are unique within a file and also give
+        //the heap priority
+        struct Range_Node {
+            uint64_t start;
+            uint64_t id;
+            Range range;
+            //Largest range.end in this subtree
+            uint64_t max_end;
+            std::unique_ptr<Range_Node> left;
+            std::unique_ptr<Range_Node> right;
+        };
+
+        struct File_Locks {
+            std::mutex lock;
+            std::condition_variable released;
+            std::unique_ptr<Range_Node> ranges;
+            uint64_t next_id = 0;
+            //flock() locks by owner, LOCK_SH or LOCK_EX
+            std::map<uint64_t, int> flocks;
+
+            //Callers between _acquire and _done, guarded by the shard's lock
+            size_t users = 0;
+        };
+
+        struct Shard {
+            std::mutex lock;
+            std::unordered_map<std::string, std::shared_ptr<File_Locks>> files;
+        };
+
+        Shard _shards[64];
+
+        Shard &_shard(const std::string &key);
+        std::shared_ptr<File_Locks> _acquire(const std::string &key);
+        void _done(const std::string &key, const std::shared_ptr<File_Locks> &file);
+
+        static void _insert(std::unique_ptr<Range_Node> &tree, std::unique_ptr<Range_Node> node);
+        static std::unique_ptr<Range_Node> _remove(std::unique_ptr<Range_Node> &tree, const uint64_t &start, const uint64_t &id);
+        static void _split(std::unique_ptr<Range_Node> tree, const uint64_t &start, const uint64_t &id, std::unique_ptr<Range_Node> &less, std::unique_ptr<Range_Node> &rest);
+        static std::unique_ptr<Range_Node> _merge(std::unique_ptr<Range_Node> less, std::unique_ptr<Range_Node> rest);
+        static void _update(Range_Node &node);
+        void _add(File_Locks &file, const uint64_t &start, const Range &range);
+
+        //Ranges overlapping [start, end) in order of start
+        static void _overlapping(const Range_Node *tree, const uint64_t &start, const uint64_t &end, std::vector<const Range_Node *> &found);
+
+        //A lock of another owner overlapping [start, end) that type conflicts with
+        const Range *_conflict(const File_Locks &file, const uint64_t &owner, const short &type, const uint64_t &start, const uint64_t &end, uint64_t &conflict_start) const;
+        //Drop owner's locks over [start, end), keeping the parts outside it
+        void _unlock(File_Locks &file, const uint64_t &owner, const uint64_t &start, const uint64_t &end);
+
+};
+
+#endif
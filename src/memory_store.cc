@@ -0,0 +1,76 @@
+#include "memory_store.h"
+
+#include <algorithm>
+#include <cstring>
+
+void Memory_Store::store(const Ref &ref, const Object &obj){
+    const std::string key(ref.buf(), 32);
+    Shard &s = _shard(key);
+    std::lock_guard<std::mutex> l(s.lock);
+    s.objects[key] = obj.data();
+}
+
+Object Memory_Store::fetch(const Ref &ref){
+    const std::string key(ref.buf(), 32);
+    Shard &s = _shard(key);
+    std::lock_guard<std::mutex> l(s.lock);
+    const auto o = s.objects.find(key);
+    if(o == s.objects.end()){
+        throw E_OBJECT_DNE();
+    }
+    return Object(o->second);
+}
+
+Object Memory_Store::fetch(const Ref &ref, const size_t &start, const size_t &end){
+    const std::string key(ref.buf(), 32);
+    Shard &s = _shard(key);
+    std::lock_guard<std::mutex> l(s.lock);
+    const auto o = s.objects.find(key);
+    if(o == s.objects.end()){
+        throw E_OBJECT_DNE();
+    }
+    const std::string &data = o->second;
+    const size_t first = std::min(start, data.size());
+    const size_t last = std::min(std::max(end, first), data.size());
+    return Object(data.substr(first, last - first));
+}
+
+Object Memory_Store::fetch_tail(const Ref &ref, const size_t &num_bytes){
+    const std::string key(ref.buf(), 32);
+    Shard &s = _shard(key);
+    std::lock_guard<std::mutex> l(s.lock);
+    const auto o = s.objects.find(key);
+    if(o == s.objects.end()){
+        throw E_OBJECT_DNE();
+    }
+    const std::string &data = o->second;
+    return Object(data.substr(data.size() - std::min(num_bytes, data.size())));
+}
+
+void Memory_Store::fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf){
+    const std::string key(ref.buf(), 32);
+    Shard &s = _shard(key);
+    std::lock_guard<std::mutex> l(s.lock);
+    const auto o = s.objects.find(key);
+    if(o == s.objects.end()){
+        throw E_OBJECT_DNE();
+    }
+    //Callers size buf for exactly num_bytes, a shorter object is an error
+    const std::string &data = o->second;
+    if(data.size() < num_bytes){
+        throw E_OBJECT_DNE();
+    }
+    std::memcpy(buf, data.data() + data.size() - num_bytes, num_bytes);
+}
+
+void Memory_Store::append(const Ref &ref, const char *data, const size_t &size){
+    const std::string key(ref.buf(), 32);
+    Shard &s = _shard(key);
+    std::lock_guard<std::mutex> l(s.lock);
+    s.objects[key].append(data, size);
+}
+
+Memory_Store::Shard &Memory_Store::_shard(const std::string &key){
+    //Refs are random or hashes, any byte will do
+    return _shards[(unsigned char)key[0] % SHARDS];
+}
@@ -0,0 +1,39 @@
+#ifndef __MEMORY_STORE_H__
+#define __MEMORY_STORE_H__
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+/* Object_Store holding everything in memory, for running a File_System
+ * without rtosd, e.g. to replay traces against. Nothing is persisted.
+ *
+ * Objects are spread over shards by ref so concurrent requests rarely
+ * contend. Missing refs throw E_OBJECT_DNE like any other store.
+ */
+class Memory_Store : public Object_Store {
+
+    public:
+        void store(const Ref &ref, const Object &obj);
+        Object fetch(const Ref &ref);
+        Object fetch(const Ref &ref, const size_t &start, const size_t &end);
+        Object fetch_tail(const Ref &ref, const size_t &num_bytes);
+        void fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf);
+        void append(const Ref &ref, const char *data, const size_t &size);
+
+    private:
+        static const size_t SHARDS = 64;
+
+        struct Shard {
+            std::mutex lock;
+            std::unordered_map<std::string, std::string> objects;
+        };
+
+        Shard _shards[SHARDS];
+
+        Shard &_shard(const std::string &key);
+
+};
+
+#endif
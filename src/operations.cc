@@ -2,6 +2,56 @@
 #include "debug.h"
 
 std::unique_ptr<File_System> fs;
+std::unique_ptr<Trace_Recorder> tracer;
+
+namespace{
+
+//Records one operation to the trace, if there is one, along with the result
+//it is given. Fields beyond path are only worth setting if (bool)trace.
+class Traced {
+
+    public:
+        Traced(const TRACE_OP &op, const char *path, const struct fuse_file_info *fi = nullptr):
+            _fi(fi)
+        {
+            if(tracer){
+                _event.set_op(op);
+                _event.set_path(path);
+                _event.set_start(tracer->now());
+            }
+        }
+
+        explicit operator bool() const{
+            return (bool)tracer;
+        }
+
+        rtosfs::Trace_Event *operator->(){
+            return &_event;
+        }
+
+        int operator()(const int &result){
+            if(tracer){
+                _event.set_duration(tracer->now() - _event.start());
+                _event.set_result(result);
+                //Read after the op, as open, create and opendir set it
+                if(_fi != nullptr){
+                    _event.set_fh(_fi->fh);
+                }
+                const auto context = fuse_get_context();
+                _event.set_uid(context->uid);
+                _event.set_gid(context->gid);
+                tracer->record(_event);
+            }
+            return result;
+        }
+
+    private:
+        const struct fuse_file_info *_fi;
+        rtosfs::Trace_Event _event;
+
+};
+
+}
 
 /*
  * const char *path is a path relative to the root of the mountpoint
@@ -9,7 +59,8 @@ std::unique_ptr<File_System> fs;
 
 int rtos_getattr(const char *path, struct stat *stbuf){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
-    const auto rval = fs->getattr(path, stbuf);
+    Traced trace(TRACE_GETATTR, path);
+    const auto rval = trace(fs->getattr(path, stbuf));
     _debug_log() << "rtos_getattr " << path << " return: " << rval << std::endl;
     return rval;
 }
@@ -17,7 +68,11 @@ int rtos_getattr(const char *path, struct stat *stbuf){
 int rtos_readlink(const char *path, char *linkbuf, size_t size){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_readlink " << path << " " << linkbuf << " " << size << std::endl;
-    const auto r = fs->readlink(path, linkbuf, size);
+    Traced trace(TRACE_READLINK, path);
+    if(trace){
+        trace->set_size(size);
+    }
+    const auto r = trace(fs->readlink(path, linkbuf, size));
     _debug_log() << "rtos_readlink returned : " << r << std::endl;
     return r;
 }
@@ -37,70 +92,111 @@ int rtos_mknod(const char *path, mode_t, dev_t){
 int rtos_mkdir(const char *path, mode_t t){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_mkdir " << path << " " << t << std::endl;
-    return fs->mkdir(path, t);
+    Traced trace(TRACE_MKDIR, path);
+    if(trace){
+        trace->set_arg(t);
+    }
+    return trace(fs->mkdir(path, t));
 }
 
 int rtos_unlink(const char *path){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_unlink " << path << std::endl;
-    return fs->unlink(path);
+    Traced trace(TRACE_UNLINK, path);
+    return trace(fs->unlink(path));
 }
 
 int rtos_rmdir(const char *path){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_rmdir " << path << std::endl;
-    return fs->rmdir(path);
+    Traced trace(TRACE_RMDIR, path);
+    return trace(fs->rmdir(path));
 }
 
 int rtos_symlink(const char *to, const char *from){
     _debug_log() << "rtos_symlink " << from << " " << to << std::endl;
-    return fs->symlink(to, from);
+    Traced trace(TRACE_SYMLINK, from);
+    if(trace){
+        trace->set_target(to);
+    }
+    return trace(fs->symlink(to, from));
 }
 
 int rtos_rename(const char *source, const char *dest){
     _debug_log() << "rtos_rename " << source << " " << dest << std::endl;
-    fs->rename(source, dest);
+    Traced trace(TRACE_RENAME, source);
+    if(trace){
+        trace->set_target(dest);
+    }
+    return trace(fs->rename(source, dest));
 }
 
 int rtos_link(const char *to, const char *from){
     _debug_log() << "rtos_link " << from << " " << to << std::endl;
-    return fs->link(to, from);
+    Traced trace(TRACE_LINK, from);
+    if(trace){
+        trace->set_target(to);
+    }
+    return trace(fs->link(to, from));
 }
 
 int rtos_chmod(const char *path, mode_t mode){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_chmod " << path << std::endl;
-    return fs->chmod(path, mode);
+    Traced trace(TRACE_CHMOD, path);
+    if(trace){
+        trace->set_arg(mode);
+    }
+    return trace(fs->chmod(path, mode));
 }
 
 int rtos_chown(const char *path, uid_t uid, gid_t gid){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_chown " << path << " " << uid << " " << gid << std::endl;
-    return fs->chown(path, uid, gid);
+    Traced trace(TRACE_CHOWN, path);
+    if(trace){
+        trace->set_arg(uid);
+        trace->set_arg2(gid);
+    }
+    return trace(fs->chown(path, uid, gid));
 }
 
 int rtos_truncate(const char *path, off_t off){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_truncate " << path << std::endl;
-    return fs->truncate(path, off);
+    Traced trace(TRACE_TRUNCATE, path);
+    if(trace){
+        trace->set_offset(off);
+    }
+    return trace(fs->truncate(path, off));
 }
 
 int rtos_utime(const char *path, struct utimbuf *buf){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_utime " << path << std::endl;
-    return fs->utime(path, buf);
+    Traced trace(TRACE_UTIME, path);
+    return trace(fs->utime(path, buf));
 }
 
 int rtos_open(const char *path, struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_open " << path << std::endl;
-    return fs->open(path, fi);
+    Traced trace(TRACE_OPEN, path, fi);
+    if(trace){
+        trace->set_arg(fi->flags);
+    }
+    return trace(fs->open(path, fi));
 }
 
 int rtos_read(const char *path, char *buf, size_t size, off_t off,
             struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
-    const auto r = fs->read(path, buf, size, off, fi);
+    Traced trace(TRACE_READ, path, fi);
+    if(trace){
+        trace->set_size(size);
+        trace->set_offset(off);
+    }
+    const auto r = trace(fs->read(path, buf, size, off, fi));
     _debug_log() << "rtos_read " << path << " size: " << size << " off: " << off << " return: " << r << std::endl;
     return r;
 }
@@ -109,84 +205,113 @@ int rtos_write(const char *path, const char *buf, size_t size, off_t off,
             struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_write " << path << std::endl;
-    return fs->write(path,  buf, size, off, fi);
+    Traced trace(TRACE_WRITE, path, fi);
+    if(trace){
+        trace->set_size(size);
+        trace->set_offset(off);
+    }
+    return trace(fs->write(path,  buf, size, off, fi));
 }
 
-int rtos_statfs(const char *path, struct statvfs *){
+int rtos_statfs(const char *path, struct statvfs *stbuf){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_statfs " << path << std::endl;
-    return -1;
+    Traced trace(TRACE_STATFS, path);
+    return trace(fs->statfs(path, stbuf));
 
 }
 
-int rtos_flush(const char *path, struct fuse_file_info *){
+int rtos_flush(const char *path, struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_flush " << path << std::endl;
-    return 0;
+    Traced trace(TRACE_FLUSH, path, fi);
+    return trace(fs->flush(path, fi));
 }
 
-/*
-int rtos_release(const char *path, struct fuse_file_info *){
-    _debug_log() << "rtos_release " << path << std::endl;
-    return -1;
-
+int rtos_release(const char *path, struct fuse_file_info *fi){
+	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
+    _debug_log() << "rtos_release " << path << " " << fi << std::endl;
+    Traced trace(TRACE_RELEASE, path, fi);
+    return trace(fs->release(path, fi));
 }
-*/
 
-int rtos_fsync(const char *path, int, struct fuse_file_info *){
+int rtos_fsync(const char *path, int datasync, struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_fsync " << path << std::endl;
-    return 0;
+    Traced trace(TRACE_FSYNC, path, fi);
+    return trace(fs->fsync(path, datasync, fi));
 }
 
 int rtos_setxattr(const char *path, const char *name, const char *value, size_t size, int flags){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_setxattr " << path << std::endl;
-    return fs->setxattr(path, name, value, size, flags);
+    Traced trace(TRACE_SETXATTR, path);
+    if(trace){
+        trace->set_target(name);
+        trace->set_size(size);
+        trace->set_arg(flags);
+    }
+    return trace(fs->setxattr(path, name, value, size, flags));
 }
 
 int rtos_getxattr(const char *path, const char *name, char *value, size_t size){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
-    const auto rval = fs->getxattr(path, name, value, size);
+    Traced trace(TRACE_GETXATTR, path);
+    if(trace){
+        trace->set_target(name);
+        trace->set_size(size);
+    }
+    const auto rval = trace(fs->getxattr(path, name, value, size));
     _debug_log() << "rtos_getxattr " << path  << " " << name << " " << size << " return: " << rval << std::endl;
     return rval;
 
 }
 
-int rtos_listxattr(const char *path, char *, size_t){
+int rtos_listxattr(const char *path, char *list, size_t size){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
-    _debug_log() << "rtos_listxattr " << path << std::endl;
-    return -1;
-
+    Traced trace(TRACE_LISTXATTR, path);
+    if(trace){
+        trace->set_size(size);
+    }
+    const auto rval = trace(fs->listxattr(path, list, size));
+    _debug_log() << "rtos_listxattr " << path << " " << size << " return: " << rval << std::endl;
+    return rval;
 }
 
 int rtos_removexattr(const char *path, const char *name){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_removexattr " << path << " " << name << std::endl;
-    return fs->removexattr(path, name);
+    Traced trace(TRACE_REMOVEXATTR, path);
+    if(trace){
+        trace->set_target(name);
+    }
+    return trace(fs->removexattr(path, name));
 }
 
-/*
-int rtos_opendir(const char *path, struct fuse_file_info *){
+int rtos_opendir(const char *path, struct fuse_file_info *fi){
+	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_opendir " << path << std::endl;
-    return 1;
+    Traced trace(TRACE_OPENDIR, path, fi);
+    return trace(fs->opendir(path, fi));
 }
-*/
 
 int rtos_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
         struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
-    _debug_log() << "rtos_readdir " << path << std::endl;
-    return fs->readdir(path, buf, filler, offset, fi);
+    _debug_log() << "rtos_readdir " << path << " " << offset << std::endl;
+    Traced trace(TRACE_READDIR, path, fi);
+    if(trace){
+        trace->set_offset(offset);
+    }
+    return trace(fs->readdir(path, buf, filler, offset, fi));
 }
 
-/*
-int rtos_releasedir(const char *path, struct fuse_file_info *){
+int rtos_releasedir(const char *path, struct fuse_file_info *fi){
+	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_releasedir " << path << std::endl;
-    return 0;
-
+    Traced trace(TRACE_RELEASEDIR, path, fi);
+    return trace(fs->releasedir(path, fi));
 }
-*/
 
 int rtos_fsync_dir(const char *path, int, struct fuse_file_info *){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
@@ -200,44 +325,66 @@ void *rtos_init(struct fuse_conn_info *conn){
 }
 
 void rtos_destroy(void *){
-    return;
+    //Stop background work and save anything that outlives the mount
+    fs.reset();
 }
 
 int rtos_access(const char *path, int mode){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_access " << path << std::endl;
-    return fs->access(path, mode);
+    Traced trace(TRACE_ACCESS, path);
+    if(trace){
+        trace->set_arg(mode);
+    }
+    return trace(fs->access(path, mode));
 }
 
 int rtos_create(const char *path, mode_t mode, struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_create " << path << " mode " << mode << std::endl;
-    return fs->create(path, mode, fi);
+    Traced trace(TRACE_CREATE, path, fi);
+    if(trace){
+        trace->set_arg(mode);
+    }
+    return trace(fs->create(path, mode, fi));
 }
 
-int rtos_ftruncate(const char *path, off_t off, struct fuse_file_info *){
+int rtos_ftruncate(const char *path, off_t off, struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_ftruncate " << path << " " << off << std::endl;
-    return fs->truncate(path, off);
+    Traced trace(TRACE_FTRUNCATE, path, fi);
+    if(trace){
+        trace->set_offset(off);
+    }
+    return trace(fs->truncate(path, off));
 }
 
-int rtos_fgetattr(const char *path, struct stat *stbuff, struct fuse_file_info *){
+int rtos_fgetattr(const char *path, struct stat *stbuff, struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_fgetattr " << path << std::endl;
-    return fs->getattr(path, stbuff);
+    Traced trace(TRACE_FGETATTR, path, fi);
+    return trace(fs->getattr(path, stbuff));
 }
 
 int rtos_lock(const char *path, struct fuse_file_info *fi, int cmd,
             struct flock *fl){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_lock " << path << std::endl;
-    return fs->lock(path, fi, cmd, fl);
+    Traced trace(TRACE_LOCK, path, fi);
+    if(trace){
+        trace->set_arg(cmd);
+        trace->set_arg2(fl->l_type);
+        trace->set_offset(fl->l_start);
+        trace->set_size(fl->l_len);
+    }
+    return trace(fs->lock(path, fi, cmd, fl));
 }
 
 int rtos_utimens(const char *path, const struct timespec tv[2]){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_utimens " << path << std::endl;
-    return fs->utimens(path, tv);
+    Traced trace(TRACE_UTIMENS, path);
+    return trace(fs->utimens(path, tv));
 }
 
 int rtos_bmap(const char *path, size_t blocksize, uint64_t *idx){
@@ -250,7 +397,11 @@ int rtos_ioctl(const char *path, int cmd, void *arg,
             struct fuse_file_info *fi, unsigned int flags, void *data){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_ioctl " << path << " " << cmd << " " << arg << " " << fi << " " << flags << " " << data << std::endl;
-    return -1;
+    Traced trace(TRACE_IOCTL, path, fi);
+    if(trace){
+        trace->set_arg((uint32_t)cmd);
+    }
+    return trace(fs->ioctl(path, cmd, arg, fi, flags, data));
 }
 
 int rtos_poll(const char *path, struct fuse_file_info *fi,
@@ -279,14 +430,24 @@ int rtos_read_buf(const char *path, struct fuse_bufvec **bufp,
 int rtos_flock(const char *path, struct fuse_file_info *fi, int op){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
     _debug_log() << "rtos_flock " << path << " " << fi << " " << op << std::endl;
-    return -1;
+    Traced trace(TRACE_FLOCK, path, fi);
+    if(trace){
+        trace->set_arg(op);
+    }
+    return trace(fs->flock(path, fi, op));
 
 }
 
-int rtos_fallocate(const char *path, int, off_t, off_t,
-            struct fuse_file_info *){
+int rtos_fallocate(const char *path, int mode, off_t offset, off_t length,
+            struct fuse_file_info *fi){
 	if(strnlen(path, 4096) >= 4096) return -ENAMETOOLONG;
-    _debug_log() << "rtos_fallocate " << path << std::endl;
-    return -1;
+    _debug_log() << "rtos_fallocate " << path << " " << mode << " " << offset << " " << length << " " << fi << std::endl;
+    Traced trace(TRACE_FALLOCATE, path, fi);
+    if(trace){
+        trace->set_arg(mode);
+        trace->set_offset(offset);
+        trace->set_size(length);
+    }
+    return trace(fs->fallocate(path, mode, offset, length, fi));
 
 }
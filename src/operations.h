@@ -3,8 +3,11 @@
 
 #include <memory>
 #include "file_system.h"
+#include "trace.h"
 
 extern std::unique_ptr<File_System> fs;
+//Set to record every operation to a trace
+extern std::unique_ptr<Trace_Recorder> tracer;
 
 #define FUSE_USE_VERSION 26
 #include <fuse.h>
@@ -42,7 +45,7 @@ int rtos_write(const char *, const char *, size_t, off_t,
             struct fuse_file_info *);
 int rtos_statfs(const char *, struct statvfs *);
 int rtos_flush(const char *, struct fuse_file_info *);
-//int rtos_release(const char *, struct fuse_file_info *);
+int rtos_release(const char *, struct fuse_file_info *);
 int rtos_fsync(const char *, int, struct fuse_file_info *);
 int rtos_setxattr(const char *, const char *, const char *, size_t, int);
 
@@ -55,10 +58,10 @@ int rtos_setxattr(const char *, const char *, const char *, size_t, int);
 int rtos_getxattr(const char *path, const char *name, char *value, size_t val_size);
 int rtos_listxattr(const char *, char *, size_t);
 int rtos_removexattr(const char *, const char *);
-//int rtos_opendir(const char *, struct fuse_file_info *);
+int rtos_opendir(const char *, struct fuse_file_info *);
 int rtos_readdir(const char *, void *, fuse_fill_dir_t, off_t,
         struct fuse_file_info *);
-//int rtos_releasedir(const char *, struct fuse_file_info *);
+int rtos_releasedir(const char *, struct fuse_file_info *);
 int rtos_fsync_dir(const char *, int, struct fuse_file_info *);
 void *rtos_init(struct fuse_conn_info *conn);
 void rtos_destroy(void *);
@@ -97,20 +100,20 @@ static struct fuse_operations rtos_ops {
 	.chown = rtos_chown,
 	.truncate = rtos_truncate,
 	.utime = rtos_utime,
-	.open = NULL,
+	.open = rtos_open,
 	.read = rtos_read,
 	.write = rtos_write,
 	.statfs = rtos_statfs,
 	.flush = rtos_flush,
-	.release = NULL,
+	.release = rtos_release,
 	.fsync = rtos_fsync,
 	.setxattr = rtos_setxattr,
 	.getxattr = rtos_getxattr,
 	.listxattr = rtos_listxattr,
 	.removexattr = rtos_removexattr,
-	.opendir = NULL,
+	.opendir = rtos_opendir,
 	.readdir = rtos_readdir,
-	.releasedir = NULL,
+	.releasedir = rtos_releasedir,
 	.fsyncdir = rtos_fsync_dir,
 	.init  = rtos_init,
 	.destroy = rtos_destroy,
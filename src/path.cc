@@ -0,0 +1,83 @@
+#include "path.h"
+
+#include <cassert>
+
+Path::Iterator::Iterator(const char *pos, const char *end):
+    _pos(pos),
+    _end(end)
+{
+    _skip();
+}
+
+void Path::Iterator::_skip(){
+    while( (_pos != _end) && (*_pos == '/') ){
+        _pos++;
+    }
+    _next = _pos;
+    while( (_next != _end) && (*_next != '/') ){
+        _next++;
+    }
+}
+
+Path_Component Path::Iterator::operator*() const{
+    return Path_Component{_pos, (size_t)(_next - _pos)};
+}
+
+Path::Iterator &Path::Iterator::operator++(){
+    _pos = _next;
+    _skip();
+    return *this;
+}
+
+bool Path::Iterator::operator!=(const Iterator &other) const{
+    return _pos != other._pos;
+}
+
+Path::Path(const char *path):
+    _path(path),
+    _end(path + std::strlen(path))
+{
+}
+
+Path::Path(const char *path, const size_t &size):
+    _path(path),
+    _end(path + size)
+{
+}
+
+Path::Iterator Path::begin() const{
+    return Iterator(_path, _end);
+}
+
+Path::Iterator Path::end() const{
+    return Iterator(_end, _end);
+}
+
+bool Path::empty() const{
+    return !(begin() != end());
+}
+
+Path Path::parent() const{
+    //Drop trailing slashes, then the last component
+    const char *e = _end;
+    while( (e != _path) && (*(e - 1) == '/') ){
+        e--;
+    }
+    while( (e != _path) && (*(e - 1) != '/') ){
+        e--;
+    }
+    return Path(_path, e - _path);
+}
+
+Path_Component Path::last() const{
+    const char *e = _end;
+    while( (e != _path) && (*(e - 1) == '/') ){
+        e--;
+    }
+    const char *s = e;
+    while( (s != _path) && (*(s - 1) != '/') ){
+        s--;
+    }
+    assert(s != e);
+    return Path_Component{s, (size_t)(e - s)};
+}
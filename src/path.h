@@ -0,0 +1,67 @@
+#ifndef __PATH_H__
+#define __PATH_H__
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+//One component of a path, pointing into the path it came from
+struct Path_Component {
+    const char *data;
+    size_t size;
+
+    bool operator==(const std::string &name) const{
+        return (name.size() == size) && (std::memcmp(name.data(), data, size) == 0);
+    }
+
+    std::string str() const{
+        return std::string(data, size);
+    }
+};
+
+/* A view of a path as its non empty components.
+ *
+ * Walking a Path never copies or allocates, the path it was made from must
+ * outlive it.
+ */
+class Path {
+
+    public:
+        class Iterator {
+
+            public:
+                Iterator(const char *pos, const char *end);
+
+                Path_Component operator*() const;
+                Iterator &operator++();
+                bool operator!=(const Iterator &other) const;
+
+            private:
+                const char *_pos;
+                const char *_next;
+                const char *_end;
+
+                void _skip();
+
+        };
+
+        explicit Path(const char *path);
+        Path(const char *path, const size_t &size);
+
+        Iterator begin() const;
+        Iterator end() const;
+
+        bool empty() const;
+
+        //Everything but the last component, which is empty for the root
+        Path parent() const;
+        //Only valid if !empty()
+        Path_Component last() const;
+
+    private:
+        const char *_path;
+        const char *_end;
+
+};
+
+#endif
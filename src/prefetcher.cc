@@ -0,0 +1,106 @@
+#include "prefetcher.h"
+
+#include <chrono>
+#include <fstream>
+#include <sstream>
+
+#include "fetch_hints.h"
+#include "inode.h"
+
+namespace{
+
+const size_t PREFETCH_THREADS = 4;
+
+//Stop prefetching when less than this fraction of memory is available
+const double MIN_FREE_MEMORY = 0.1;
+const int64_t PRESSURE_CHECK_INTERVAL_MS = 100;
+
+//MemTotal and MemAvailable from /proc/meminfo, in kB. MemAvailable is the
+//kernel's estimate of what can be allocated without swapping, which unlike
+//free memory counts the page cache that can be reclaimed.
+bool read_meminfo(uint64_t &total, uint64_t &available){
+    std::ifstream meminfo("/proc/meminfo");
+    bool have_total = false;
+    bool have_available = false;
+    std::string line;
+    while( std::getline(meminfo, line) && !(have_total && have_available) ){
+        std::istringstream fields(line);
+        std::string name;
+        uint64_t kb;
+        if(!(fields >> name >> kb)){
+            continue;
+        }
+        if(name == "MemTotal:"){
+            total = kb;
+            have_total = true;
+        }
+        else if(name == "MemAvailable:"){
+            available = kb;
+            have_available = true;
+        }
+    }
+    return have_total && have_available;
+}
+
+}
+
+Prefetcher::Prefetcher(const std::shared_ptr<Object_Store> &backend, const size_t &budget):
+    _backend(backend),
+    _budget(budget),
+    _pool(budget > 0 ? PREFETCH_THREADS : 0)
+{
+}
+
+Prefetcher::~Prefetcher(){
+    _cancelled = true;
+}
+
+void Prefetcher::directory(const rtosfs::Directory &dir){
+    if(_budget == 0){
+        return;
+    }
+
+    for(const auto &e: dir.entries()){
+        if( (_queued >= _budget) || _memory_pressure() ){
+            return;
+        }
+
+        //Entries without a mode predate it being recorded, they may be directories
+        const bool maybe_dir = (e.mode() == 0) || S_ISDIR(e.mode());
+        const std::string inode_ref = e.inode_ref();
+        _queued++;
+        _pool.submit([this, inode_ref, maybe_dir](){
+            if( !_cancelled && !_memory_pressure() ){
+                load_metadata(*_backend, inode_ref, maybe_dir);
+            }
+            _queued--;
+        });
+    }
+}
+
+bool Prefetcher::_memory_pressure(){
+    const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t checked = _pressure_checked;
+    if( (now - checked < PRESSURE_CHECK_INTERVAL_MS) || !_pressure_checked.compare_exchange_strong(checked, now) ){
+        return _pressure;
+    }
+
+    uint64_t total = 0;
+    uint64_t available = 0;
+    if(read_meminfo(total, available)){
+        _pressure = available < (MIN_FREE_MEMORY * total);
+    }
+    return _pressure;
+}
+
+void load_metadata(Object_Store &backend, const std::string &inode_ref, const bool &maybe_dir){
+    try{
+        const Inode inode = fetch_inode(backend, Ref(inode_ref.c_str(), 32));
+        if( maybe_dir && (inode.type == NODE_DIR) ){
+            fetch_immutable(backend, Ref(inode.data_ref, 32));
+        }
+    }
+    catch(...){
+        //Only speculation, whoever actually needs it will see the error
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef __PREFETCHER_H__
+#define __PREFETCHER_H__
+
+#include <atomic>
+#include <memory>
+#include <rtos/object_store.h>
+
+#include "disk_format.pb.h"
+#include "work_pool.h"
+
+//Fetch the inode at inode_ref and, if it is a directory and maybe_dir, its
+//directory object, so both land in backend's cache. Errors are ignored.
+void load_metadata(Object_Store &backend, const std::string &inode_ref, const bool &maybe_dir);
+
+/* Speculative metadata prefetch for tree walks.
+ *
+ * After a directory is listed its children are usually stat()ed and its
+ * subdirectories listed in turn, each a dependent round trip. directory()
+ * queues loads of every child's inode, and of the directory object of each
+ * child that is a directory, through backend so they land in its cache
+ * before they are asked for.
+ *
+ * At most budget loads are queued at once, further entries are skipped.
+ * Queued loads are dropped while the machine is short of memory.
+ */
+class Prefetcher {
+
+    public:
+        Prefetcher(const std::shared_ptr<Object_Store> &backend, const size_t &budget);
+        ~Prefetcher();
+
+        void directory(const rtosfs::Directory &dir);
+
+    private:
+        std::shared_ptr<Object_Store> _backend;
+        const size_t _budget;
+        std::atomic<size_t> _queued{0};
+        std::atomic<bool> _cancelled{false};
+
+        std::atomic<int64_t> _pressure_checked{0};
+        std::atomic<bool> _pressure{false};
+
+        //Last so queued loads see _cancelled and return before anything
+        //else is destroyed
+        Work_Pool _pool;
+
+        bool _memory_pressure();
+
+};
+
+#endif
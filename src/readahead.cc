@@ -0,0 +1,121 @@
+#include "readahead.h"
+
+#include <algorithm>
+#include <cstring>
+
+//Sequential reads a handle makes before anything is fetched ahead of it
+const size_t SEQUENTIAL_READS = 2;
+
+Readahead::Readahead(File_Data &file_data, Work_Pool &pool, const size_t &min_window, const size_t &max_window):
+    _file_data(file_data),
+    _pool(pool),
+    _min_window(std::min(min_window, max_window)),
+    _max_window(max_window)
+{
+}
+
+size_t Readahead::read(const Inode &inode, char *buf, const size_t &size, const off_t &off){
+    const uint64_t end = std::min((uint64_t)off + size, (uint64_t)inode.st_size);
+    if((uint64_t)off >= end){
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> l(_lock);
+
+    std::string version(inode.data_ref, 32);
+    version.append((const char *)&inode.st_size, sizeof(inode.st_size));
+    if(version != _version){
+        _prefetches.clear();
+        _ahead = 0;
+        _version = version;
+    }
+
+    if((uint64_t)off != _next){
+        //Random access, don't waste any more bandwidth on this handle
+        _reset();
+        _sequential = 0;
+        _next = end;
+        return _file_data.read(inode, buf, end - off, off);
+    }
+    _next = end;
+    _sequential++;
+
+    //Serve what has been prefetched
+    uint64_t pos = off;
+    while( (pos < end) && !_prefetches.empty() ){
+        const auto p = _prefetches.front();
+        if(p->start > pos){
+            break;
+        }
+        {
+            std::unique_lock<std::mutex> w(p->lock);
+            while(!p->done){
+                p->ready.wait(w);
+            }
+        }
+        if(p->failed){
+            //Let the direct read below report the error
+            _prefetches.clear();
+            break;
+        }
+
+        const uint64_t p_end = p->start + p->data.size();
+        if(pos < p_end){
+            const size_t n = std::min(end, p_end) - pos;
+            std::memcpy(buf + (pos - off), p->data.data() + (pos - p->start), n);
+            pos += n;
+        }
+        if(pos >= p_end){
+            _prefetches.pop_front();
+        }
+    }
+    if(pos < end){
+        pos += _file_data.read(inode, buf + (pos - off), end - pos, pos);
+    }
+
+    //Keep at least a window ahead of the reader
+    _ahead = std::max(_ahead, end);
+    if(_sequential < SEQUENTIAL_READS){
+        return pos - off;
+    }
+    _window = std::max(_window, _min_window);
+    if( (_ahead < (uint64_t)inode.st_size) && (_ahead - end < _window) ){
+        const size_t length = std::min((uint64_t)_window, inode.st_size - _ahead);
+        _prefetch(inode, _ahead, length);
+        _ahead += length;
+        _window = std::min(_window * 2, _max_window);
+    }
+
+    return pos - off;
+}
+
+void Readahead::_reset(){
+    _window = 0;
+    _ahead = 0;
+    //Prefetches still running finish into buffers nobody holds
+    _prefetches.clear();
+}
+
+void Readahead::_prefetch(const Inode &inode, const uint64_t &start, const size_t &length){
+    std::shared_ptr<Prefetch> p(new Prefetch());
+    p->start = start;
+    _prefetches.push_back(p);
+
+    File_Data &file_data = _file_data;
+    _pool.submit([p, inode, length, &file_data](){
+        std::string data(length, '\0');
+        bool failed = false;
+        try{
+            data.resize(file_data.read(inode, &data[0], length, p->start));
+        }
+        catch(...){
+            failed = true;
+        }
+
+        std::lock_guard<std::mutex> l(p->lock);
+        p->data.swap(data);
+        p->failed = failed;
+        p->done = true;
+        p->ready.notify_all();
+    });
+}
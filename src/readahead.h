@@ -0,0 +1,66 @@
+#ifndef __READAHEAD_H__
+#define __READAHEAD_H__
+
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "file_data.h"
+#include "inode.h"
+#include "work_pool.h"
+
+/* Sequential readahead for one open file handle.
+ *
+ * Once two reads in a row have started where the previous read ended, a
+ * window of the file is kept being fetched in the background ahead of the
+ * reader, doubling with every
+ * prefetch up to max_window. Any other read drops the window and goes
+ * straight to File_Data, so random access costs nothing extra.
+ *
+ * Prefetched data belongs to the data_ref and size of the inode it was read
+ * from and is dropped as soon as a read sees the file has changed.
+ */
+class Readahead {
+
+    public:
+        Readahead(File_Data &file_data, Work_Pool &pool, const size_t &min_window, const size_t &max_window);
+
+        //Same as File_Data::read
+        size_t read(const Inode &inode, char *buf, const size_t &size, const off_t &off);
+
+    private:
+        struct Prefetch {
+            uint64_t start;
+            std::mutex lock;
+            std::condition_variable ready;
+            bool done = false;
+            bool failed = false;
+            std::string data;
+        };
+
+        File_Data &_file_data;
+        Work_Pool &_pool;
+        const size_t _min_window;
+        const size_t _max_window;
+
+        std::mutex _lock;
+        //Offset the next read starts at if the reader is sequential, nothing
+        //is before the first read
+        uint64_t _next = std::numeric_limits<uint64_t>::max();
+        //Reads in a row that started where the previous one ended
+        size_t _sequential = 0;
+        size_t _window = 0;
+        //End of the last prefetch issued
+        uint64_t _ahead = 0;
+        std::string _version;
+        std::deque<std::shared_ptr<Prefetch>> _prefetches;
+
+        void _reset();
+        void _prefetch(const Inode &inode, const uint64_t &start, const size_t &length);
+
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __REF_CACHE_H__
+#define __REF_CACHE_H__
+
+#include <array>
+#include <cstring>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+//The bytes of a Ref held inline, so keying a map by one allocates nothing
+typedef std::array<char, 32> Ref_Key;
+
+struct Ref_Key_Hash {
+    size_t operator()(const Ref_Key &key) const{
+        //Refs are random or hashes, any bytes will do
+        size_t h;
+        std::memcpy(&h, key.data(), sizeof(h));
+        return h;
+    }
+};
+
+inline Ref_Key ref_key(const Ref &ref){
+    Ref_Key key;
+    std::memcpy(key.data(), ref.buf(), 32);
+    return key;
+}
+
+/* Bounded LRU cache of parsed values keyed by object Ref.
+ *
+ * Only suitable for objects that are never mutated once stored under a Ref
+ * (directories, xattr dictionaries), so entries never need invalidating; they
+ * simply fall out of the cache when it is full.
+ */
+template <typename T>
+class Ref_Cache {
+
+    public:
+        Ref_Cache(const size_t &max_entries):
+            _max_entries(max_entries)
+        {
+        }
+
+        //Returns nullptr on a miss
+        std::shared_ptr<const T> get(const Ref &ref){
+            const Ref_Key key = ref_key(ref);
+            std::lock_guard<std::mutex> l(_lock);
+            const auto e = _entries.find(key);
+            if(e == _entries.end()){
+                return nullptr;
+            }
+            _lru.splice(_lru.begin(), _lru, e->second.second);
+            return e->second.first;
+        }
+
+        void put(const Ref &ref, const std::shared_ptr<const T> &value){
+            const Ref_Key key = ref_key(ref);
+            std::lock_guard<std::mutex> l(_lock);
+            const auto e = _entries.find(key);
+            if(e != _entries.end()){
+                e->second.first = value;
+                _lru.splice(_lru.begin(), _lru, e->second.second);
+                return;
+            }
+
+            _lru.push_front(key);
+            _entries[key] = std::make_pair(value, _lru.begin());
+
+            while(_entries.size() > _max_entries){
+                _entries.erase(_lru.back());
+                _lru.pop_back();
+            }
+        }
+
+        void erase(const Ref &ref){
+            const Ref_Key key = ref_key(ref);
+            std::lock_guard<std::mutex> l(_lock);
+            const auto e = _entries.find(key);
+            if(e != _entries.end()){
+                _lru.erase(e->second.second);
+                _entries.erase(e);
+            }
+        }
+
+        size_t size(){
+            std::lock_guard<std::mutex> l(_lock);
+            return _entries.size();
+        }
+
+    private:
+        std::mutex _lock;
+        const size_t _max_entries;
+        std::list<Ref_Key> _lru;
+        std::unordered_map<Ref_Key, std::pair<std::shared_ptr<const T>, typename std::list<Ref_Key>::iterator>, Ref_Key_Hash> _entries;
+
+};
+
+#endif
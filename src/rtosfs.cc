@@ -2,6 +2,7 @@
 #include <string>
 #include <iostream>
 #include <memory>
+#include <vector>
 
 #include <rtos/remote_store.h>
 
@@ -11,6 +12,9 @@
 #include <smpl.h>
 #include <smplsocket.h>
 
+#include "disk_cache.h"
+#include "fault_store.h"
+#include "hedged_store.h"
 #include "operations.h"
 
 namespace po = boost::program_options;
@@ -18,15 +22,41 @@ namespace po = boost::program_options;
 int main(int argc, char *argv[]){
 
 	std::string RTOSD;
+    std::vector<std::string> REPLICAS;
+    Hedge_Options HEDGE;
+    uint64_t HEDGE_MIN_DELAY = HEDGE.min_delay.count();
 	std::string FS;
     std::string MOUNTPOINT;
+    Mount_Options OPTIONS;
+    uint64_t DIR_COMMIT_WINDOW = 0;
+    uint64_t LEASE = OPTIONS.lease.count();
+    std::string COMPRESSION = "none";
+    std::string DISK_CACHE;
+    size_t DISK_CACHE_SIZE = 1024 * 1024 * 1024;
+    std::string TRACE;
 
     po::options_description desc("Options");
     desc.add_options()
         ("rtosd", po::value<std::string>(&RTOSD), "Unix Domain Socket of rtosd")
+        ("replica", po::value<std::vector<std::string>>(&REPLICAS), "Unix Domain Socket of a replica of rtosd to send slow reads to as well, may be given more than once")
+        ("hedge-percentile", po::value<double>(&HEDGE.percentile), "Reads slower than this fraction of recent reads are also sent to a replica")
+        ("hedge-min-delay", po::value<uint64_t>(&HEDGE_MIN_DELAY), "Microseconds a read always gets before it is sent to a replica")
         ("fs", po::value<std::string>(&FS), "File System to mount")
         ("mountpoint", po::value<std::string>(&MOUNTPOINT), "Mountpoint to mount File System on")
+        ("dir-commit-window", po::value<uint64_t>(&DIR_COMMIT_WINDOW), "Microseconds a directory update waits to be committed with concurrent updates to the same directory")
+        ("chunking", po::bool_switch(&OPTIONS.chunking), "Store new files as deduplicated content defined chunks")
+        ("readahead", po::value<size_t>(&OPTIONS.readahead), "Largest number of bytes prefetched ahead of a sequential reader, 0 disables readahead")
+        ("disk-cache", po::value<std::string>(&DISK_CACHE), "Directory to keep a persistent cache of immutable objects in")
+        ("disk-cache-size", po::value<size_t>(&DISK_CACHE_SIZE), "Most bytes kept in the disk cache")
+        ("warm-manifest", po::value<std::string>(&OPTIONS.warm_manifest), "File to record hot directories in and warm the metadata cache from at mount, needs --metadata-cache")
+        ("capacity", po::value<uint64_t>(&OPTIONS.capacity), "Size in bytes df reports the File System as")
+        ("metadata-cache", po::value<size_t>(&OPTIONS.metadata_cache), "Bytes of inodes and directories cached in memory, 0 disables the cache and metadata prefetch")
+        ("lease", po::value<uint64_t>(&LEASE), "Milliseconds a cached inode is trusted before it is checked for changes made by other mounts")
+        ("prefetch", po::value<size_t>(&OPTIONS.prefetch), "Most inodes and directories loaded ahead of a tree walk at once, 0 disables metadata prefetch")
+        ("compression", po::value<std::string>(&COMPRESSION), "Compress new files with none, lz4 or zstd, directories can override this with the user.rtosfs.compression xattr")
+        ("trace", po::value<std::string>(&TRACE), "File to record every operation to, for replay with rtosfsreplay")
     ;
+    Fault_Arguments FAULT_ARGUMENTS(desc, "rtosd");
 
     /*
     po::positional_options_description pos_desc;
@@ -50,10 +80,67 @@ int main(int argc, char *argv[]){
         return -1;
 	}
 
-    std::shared_ptr<smpl::Remote_Address> rtosd_address(new smpl::Remote_UDS(RTOSD));
-    std::shared_ptr<Object_Store> backend(new Remote_Store(rtosd_address));
+    Fault_Options FAULTS;
+    try{
+        FAULTS = FAULT_ARGUMENTS.options();
+    }
+    catch(E_BAD_DISTRIBUTION e){
+        std::cout << desc << std::endl;
+        return -1;
+    }
+
+    //Replicas after the primary, each slowed down on its own
+    REPLICAS.insert(REPLICAS.begin(), RTOSD);
+    std::vector<std::shared_ptr<Object_Store>> replicas;
+    for(const auto &r: REPLICAS){
+        std::shared_ptr<smpl::Remote_Address> rtosd_address(new smpl::Remote_UDS(r));
+        std::shared_ptr<Object_Store> replica(new Remote_Store(rtosd_address));
+        if(FAULTS.enabled()){
+            replica = std::shared_ptr<Object_Store>(new Fault_Store(replica, FAULTS));
+            FAULTS.seed++;
+        }
+        replicas.push_back(replica);
+    }
+    std::shared_ptr<Object_Store> backend = replicas[0];
+    if(replicas.size() > 1){
+        if( (HEDGE.percentile <= 0.0) || (HEDGE.percentile > 1.0) ){
+            std::cout << desc << std::endl;
+            return -1;
+        }
+        HEDGE.min_delay = std::chrono::microseconds(HEDGE_MIN_DELAY);
+        backend = std::shared_ptr<Object_Store>(new Hedged_Store(replicas, HEDGE));
+    }
+    if(DISK_CACHE.size() > 0){
+        try{
+            backend = std::shared_ptr<Object_Store>(new Disk_Cache(backend, DISK_CACHE, DISK_CACHE_SIZE));
+        }
+        catch(E_BAD_CACHE_DIR e){
+            std::cout << "Could not use disk cache " << DISK_CACHE << std::endl;
+            return -1;
+        }
+    }
+
+    OPTIONS.dir_commit_window = std::chrono::microseconds(DIR_COMMIT_WINDOW);
+    OPTIONS.lease = std::chrono::milliseconds(LEASE);
+    try{
+        OPTIONS.compression = codec_from_name(COMPRESSION);
+    }
+    catch(E_BAD_CODEC e){
+        std::cout << desc << std::endl;
+        return -1;
+    }
+
+    if(TRACE.size() > 0){
+        try{
+            tracer = std::unique_ptr<Trace_Recorder>(new Trace_Recorder(TRACE));
+        }
+        catch(E_BAD_TRACE e){
+            std::cout << "Could not record trace to " << TRACE << std::endl;
+            return -1;
+        }
+    }
 
-    fs = std::unique_ptr<File_System>(new File_System(FS, backend));
+    fs = std::unique_ptr<File_System>(new File_System(FS, backend, OPTIONS));
     assert(fs);
 
     int fargc = 2;
@@ -64,5 +151,8 @@ int main(int argc, char *argv[]){
     fargv[1] = (char *)malloc(sizeof(char) * MOUNTPOINT.size() + 1);
     std::strncpy(fargv[1], MOUNTPOINT.c_str(), MOUNTPOINT.size() + 1);
 
-    return fuse_main(fargc, fargv, &rtos_ops, NULL);
+    const auto r = fuse_main(fargc, fargv, &rtos_ops, NULL);
+    //Write out the end of the trace
+    tracer.reset();
+    return r;
 }
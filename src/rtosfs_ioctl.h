@@ -0,0 +1,19 @@
+#ifndef __RTOSFS_IOCTL_H__
+#define __RTOSFS_IOCTL_H__
+
+#include <linux/ioctl.h>
+
+/* Issued on an open file in an rtosfs mount, creates dest as a copy of the
+ * file in constant time. dest is relative to the root of the mount and must
+ * not already exist. Later writes to either file never affect the other.
+ *
+ * The kernel never passes FICLONE/FICLONERANGE through to FUSE filesystems,
+ * so this is the only way to ask for a clone.
+ */
+struct rtosfs_clone_args {
+    char dest[4096];
+};
+
+#define RTOSFS_IOC_CLONE _IOW('R', 1, struct rtosfs_clone_args)
+
+#endif
@@ -1,19 +1,74 @@
 #include <iostream>
+#include <climits>
+#include <cstdlib>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/ioctl.h>
 #include <boost/program_options.hpp>
 #include <rtos/remote_store.h>
 #include <rtos/encode.h>
 #include <smpl.h>
 #include <smplsocket.h>
 #include "file_system.h"
+#include "du.h"
+#include "export.h"
+#include "fsck.h"
+#include "import.h"
+#include "rtosfs_ioctl.h"
 
 namespace po = boost::program_options;
 
+//Path of dest relative to the root of the mount source is in
+std::string mount_relative(const std::string &source, const std::string &dest){
+    char resolved[PATH_MAX];
+    if(realpath(source.c_str(), resolved) == nullptr){
+        throw std::runtime_error("Cannot resolve " + source);
+    }
+
+    //Walk up until we leave the mount
+    std::string root(resolved);
+    struct stat st;
+    stat(root.c_str(), &st);
+    const dev_t dev = st.st_dev;
+    while(root != "/"){
+        std::string parent_buf(root);
+        const std::string parent(dirname(&parent_buf[0]));
+        if( (stat(parent.c_str(), &st) != 0) || (st.st_dev != dev) ){
+            break;
+        }
+        root = parent;
+    }
+
+    std::string dest_dir_buf(dest);
+    std::string dest_name_buf(dest);
+    const std::string dest_name(basename(&dest_name_buf[0]));
+    if(realpath(dirname(&dest_dir_buf[0]), resolved) == nullptr){
+        throw std::runtime_error("Cannot resolve directory of " + dest);
+    }
+    const std::string dest_dir(resolved);
+    if(dest_dir.compare(0, root.size(), root) != 0){
+        throw std::runtime_error(dest + " is not in the same mount as " + source);
+    }
+    return dest_dir.substr(root.size()) + "/" + dest_name;
+}
+
 int main(int argc, char *argv[]){
 
     std::string RTOSD;
     std::string NODE;
     std::string DIRECTORY;
     std::string FILE;
+    std::string CLONE;
+    std::string CLONE_DEST;
+    std::string FSCK;
+    std::string DU;
+    std::string DU_PATH = "/";
+    std::string IMPORT;
+    std::string EXPORT;
+    std::string FS;
+    size_t TOP = 20;
+    bool SEED_USAGE = false;
+    size_t THREADS = 32;
 
     po::options_description desc("Options");
     desc.add_options()
@@ -21,6 +76,17 @@ int main(int argc, char *argv[]){
         ("node", po::value<std::string>(&NODE), "Base 16 node reference to query")
         ("dir", po::value<std::string>(&DIRECTORY), "Base 16 directory reference to query")
         ("file", po::value<std::string>(&FILE), "Base 16 file reference to query")
+        ("clone", po::value<std::string>(&CLONE), "File in an rtosfs mount to clone, requires --to")
+        ("to", po::value<std::string>(&CLONE_DEST), "Path to create the clone at, in the same mount, or to import to, in --fs")
+        ("fsck", po::value<std::string>(&FSCK), "File System to check for consistency")
+        ("du", po::value<std::string>(&DU), "File System to report usage of")
+        ("path", po::value<std::string>(&DU_PATH), "Subtree to report usage of with --du")
+        ("top", po::value<size_t>(&TOP), "Number of heaviest directories to report with --du")
+        ("seed-usage", po::bool_switch(&SEED_USAGE), "Set the usage statfs reports to what --du counts, for File Systems created before usage was counted")
+        ("import", po::value<std::string>(&IMPORT), "Local file or directory to import, requires --fs and --to")
+        ("export", po::value<std::string>(&EXPORT), "Subtree to write to stdout as a tar archive, requires --fs")
+        ("fs", po::value<std::string>(&FS), "File System to import into or export from")
+        ("threads", po::value<size_t>(&THREADS), "Parallel requests to rtosd when walking a File System")
     ;
 
     try{
@@ -33,6 +99,43 @@ int main(int argc, char *argv[]){
         return -1;
     }
 
+    //Cloning goes through the mount, not rtosd
+    if(CLONE.size() > 0){
+        if(CLONE_DEST.size() == 0){
+            std::cout << desc << std::endl;
+            return -1;
+        }
+
+        struct rtosfs_clone_args args;
+        std::memset(&args, 0, sizeof(args));
+        try{
+            const std::string dest = mount_relative(CLONE, CLONE_DEST);
+            if(dest.size() >= sizeof(args.dest)){
+                std::cerr << "Destination path too long" << std::endl;
+                return -1;
+            }
+            std::memcpy(args.dest, dest.c_str(), dest.size());
+        }
+        catch(std::runtime_error &e){
+            std::cerr << e.what() << std::endl;
+            return -1;
+        }
+
+        const int fd = open(CLONE.c_str(), O_RDONLY);
+        if(fd < 0){
+            std::cerr << "Cannot open " << CLONE << ": " << strerror(errno) << std::endl;
+            return -1;
+        }
+        const int r = ioctl(fd, RTOSFS_IOC_CLONE, &args);
+        const int err = errno;
+        close(fd);
+        if(r != 0){
+            std::cerr << "Clone failed: " << strerror(err) << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
     if(RTOSD.size() == 0){
         std::cout << desc << std::endl;
         return -1;
@@ -41,15 +144,77 @@ int main(int argc, char *argv[]){
     std::shared_ptr<smpl::Remote_Address> rtosd_address(new smpl::Remote_UDS(RTOSD));
     std::shared_ptr<Object_Store> backend(new Remote_Store(rtosd_address));
 
-    if(NODE.size() > 0){
+    if(FSCK.size() > 0){
+        Fsck fsck(backend, std::max(THREADS, (size_t)1), std::cout, std::cerr);
+        return (fsck.check(FSCK) == 0) ? 0 : 1;
+    }
+    else if(IMPORT.size() > 0){
+        if( (FS.size() == 0) || (CLONE_DEST.size() == 0) ){
+            std::cout << desc << std::endl;
+            return -1;
+        }
+        Import import(backend, std::max(THREADS, (size_t)1), std::cerr);
+        const int r = import.run(FS, IMPORT, CLONE_DEST);
+        if(r != 0){
+            std::cerr << "Import failed: " << strerror(-r) << std::endl;
+            return -1;
+        }
+    }
+    else if(EXPORT.size() > 0){
+        if(FS.size() == 0){
+            std::cout << desc << std::endl;
+            return -1;
+        }
+        Export exporter(backend, std::max(THREADS, (size_t)1), std::cout, std::cerr);
+        try{
+            if(exporter.run(FS, EXPORT) != 0){
+                return 1;
+            }
+        }
+        catch(E_OBJECT_DNE e){
+            std::cerr << EXPORT << " does not exist" << std::endl;
+            return -1;
+        }
+    }
+    else if(DU.size() > 0){
+        Du du(backend, std::max(THREADS, (size_t)1));
+        try{
+            const Usage total = du.walk(DU, DU_PATH);
+            std::cout << "total backend: " << total.backend << " logical: " << total.logical
+                << " files: " << total.files << " dirs: " << total.directories << std::endl;
+
+            if(SEED_USAGE){
+                if(DU_PATH != "/"){
+                    std::cerr << "--seed-usage needs the whole File System, not --path" << std::endl;
+                    return -1;
+                }
+                Superblock usage;
+                usage.files = total.files;
+                usage.directories = total.directories;
+                usage.bytes = total.logical;
+                seed_usage(*backend, DU, usage);
+                std::cout << "Seeded usage of " << DU << std::endl;
+            }
+        }
+        catch(E_OBJECT_DNE e){
+            std::cerr << DU_PATH << " does not exist" << std::endl;
+            return -1;
+        }
+        du.report(std::cout, TOP);
+    }
+    else if(NODE.size() > 0){
         std::vector<Inode> inodes;
         {
             const std::string encoded = base16_decode(NODE);
             const Ref node_ref(encoded.c_str(), 32);
             const std::string raw = backend->fetch(node_ref).data();
-            assert(raw.size() % (sizeof(Inode)) == 0);
-            inodes.resize(raw.size() / sizeof(Inode));
-            std::memcpy(&inodes[0], raw.c_str(), raw.size());
+            try{
+                inodes = inode_generations(raw);
+            }
+            catch(E_BAD_INODE e){
+                std::cerr << "Not a node log" << std::endl;
+                return -1;
+            }
         }
 
         for(size_t i = 0; i < inodes.size(); i++){
@@ -0,0 +1,580 @@
+#include <boost/program_options.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <rtos/remote_store.h>
+
+#include <smpl.h>
+#include <smplsocket.h>
+
+#include "fault_store.h"
+#include "file_system.h"
+#include "memory_store.h"
+#include "trace.h"
+#include "work_pool.h"
+
+namespace po = boost::program_options;
+
+//File_System asks FUSE who is calling, here it is whoever recorded the event
+//being replayed on this thread
+thread_local struct fuse_context replay_context = {nullptr, getuid(), getgid(), 0, nullptr, 0};
+
+struct fuse_context *fuse_get_context(void){
+    return &replay_context;
+}
+
+//Heap allocations made by each thread, so an operation's can be told apart
+//from those of the threads File_System runs in the background
+thread_local uint64_t allocations = 0;
+
+void *operator new(size_t size){
+    allocations++;
+    void *p = std::malloc(size == 0 ? 1 : size);
+    if(p == nullptr){
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept{
+    std::free(p);
+}
+
+void operator delete(void *p, size_t size) noexcept{
+    (void) size;
+    std::free(p);
+}
+
+namespace{
+
+struct Op_Stats {
+    uint64_t count = 0;
+    uint64_t errors = 0;
+    //Replayed result differed from the recorded one in success or failure
+    uint64_t mismatches = 0;
+    uint64_t recorded = 0;
+    //Heap allocations made on the thread running the operation
+    uint64_t allocations = 0;
+    std::vector<uint64_t> latencies;
+};
+
+class Replay {
+
+    public:
+        Replay(File_System &fs, const size_t &threads):
+            _fs(fs)
+        {
+            for(size_t i = 0; i < std::max<size_t>(threads, 1); i++){
+                _pools.emplace_back(new Work_Pool(1));
+            }
+        }
+
+        //Runs event on the worker owning its path, so operations on one
+        //path happen in the order they were started in
+        void dispatch(const rtosfs::Trace_Event &event){
+            //These change two paths, everything before must be done
+            if( (event.op() == TRACE_RENAME) || (event.op() == TRACE_LINK) ){
+                wait();
+                _run(event);
+                return;
+            }
+            const size_t worker = std::hash<std::string>()(event.path()) % _pools.size();
+            _pools[worker]->submit([this, event](){ _run(event); });
+        }
+
+        void wait(){
+            for(const auto &p: _pools){
+                p->wait();
+            }
+        }
+
+        void report(const double &seconds){
+            std::lock_guard<std::mutex> l(_lock);
+            std::cout << std::left << std::setw(12) << "op" << std::right
+                << std::setw(10) << "count" << std::setw(8) << "errors" << std::setw(8) << "diff"
+                << std::setw(10) << "mean_us" << std::setw(10) << "p50_us" << std::setw(10) << "p99_us"
+                << std::setw(10) << "max_us" << std::setw(12) << "recorded_us" << std::setw(10) << "allocs" << std::endl;
+
+            uint64_t total = 0;
+            for(auto &s: _stats){
+                Op_Stats &stats = s.second;
+                std::sort(stats.latencies.begin(), stats.latencies.end());
+                uint64_t sum = 0;
+                for(const auto &l: stats.latencies){
+                    sum += l;
+                }
+                const auto percentile = [&stats](const double &p){
+                    return stats.latencies[std::min(stats.latencies.size() - 1, (size_t)(p * stats.latencies.size()))] / 1000.0;
+                };
+                std::cout << std::left << std::setw(12) << trace_op_name(s.first) << std::right << std::fixed << std::setprecision(1)
+                    << std::setw(10) << stats.count << std::setw(8) << stats.errors << std::setw(8) << stats.mismatches
+                    << std::setw(10) << (double)sum / stats.count / 1000.0
+                    << std::setw(10) << percentile(0.5)
+                    << std::setw(10) << percentile(0.99)
+                    << std::setw(10) << stats.latencies.back() / 1000.0
+                    << std::setw(12) << (double)stats.recorded / stats.count / 1000.0
+                    << std::setw(10) << (double)stats.allocations / stats.count << std::endl;
+                total += stats.count;
+            }
+
+            std::cout << std::setprecision(3) << total << " operations in " << seconds << "s, "
+                << total / seconds << " ops/s, "
+                << _read / seconds / (1024 * 1024) << " MB/s read, "
+                << _written / seconds / (1024 * 1024) << " MB/s written" << std::endl;
+        }
+
+    private:
+        File_System &_fs;
+        std::vector<std::unique_ptr<Work_Pool>> _pools;
+
+        std::mutex _lock;
+        std::map<uint32_t, Op_Stats> _stats;
+        //Recorded handles to the ones this replay was given for them
+        std::map<uint64_t, std::shared_ptr<fuse_file_info>> _handles;
+        uint64_t _read = 0;
+        uint64_t _written = 0;
+
+        std::shared_ptr<fuse_file_info> _handle(const uint64_t &fh){
+            std::lock_guard<std::mutex> l(_lock);
+            const auto h = _handles.find(fh);
+            if(h != _handles.end()){
+                return h->second;
+            }
+            //Opened before the trace started, File_System takes fh 0 as no
+            //handle
+            auto fi = std::make_shared<fuse_file_info>();
+            std::memset(fi.get(), 0, sizeof(fuse_file_info));
+            fi->lock_owner = fh;
+            return fi;
+        }
+
+        void _run(const rtosfs::Trace_Event &event){
+            replay_context.uid = event.uid();
+            replay_context.gid = event.gid();
+
+            //Data was not recorded, only how much of it there was
+            thread_local std::string buffer;
+            if(buffer.size() < event.size()){
+                buffer.resize(event.size(), '\0');
+            }
+
+            const char *path = event.path().c_str();
+            std::shared_ptr<fuse_file_info> fi;
+            if( (event.op() == TRACE_OPEN) || (event.op() == TRACE_CREATE) || (event.op() == TRACE_OPENDIR) ){
+                fi = std::make_shared<fuse_file_info>();
+                std::memset(fi.get(), 0, sizeof(fuse_file_info));
+                fi->flags = event.arg();
+                fi->lock_owner = event.fh();
+            }
+            else{
+                fi = _handle(event.fh());
+            }
+
+            const uint64_t allocated = allocations;
+            const auto start = std::chrono::steady_clock::now();
+            int result = 0;
+            switch(event.op()){
+                case TRACE_GETATTR:
+                case TRACE_FGETATTR:{
+                    struct stat stbuf;
+                    result = _fs.getattr(path, &stbuf);
+                    break;
+                }
+                case TRACE_READLINK:
+                    result = _fs.readlink(path, &buffer[0], event.size());
+                    break;
+                case TRACE_MKDIR:
+                    result = _fs.mkdir(path, event.arg());
+                    break;
+                case TRACE_UNLINK:
+                    result = _fs.unlink(path);
+                    break;
+                case TRACE_RMDIR:
+                    result = _fs.rmdir(path);
+                    break;
+                case TRACE_SYMLINK:
+                    result = _fs.symlink(event.target().c_str(), path);
+                    break;
+                case TRACE_RENAME:
+                    result = _fs.rename(path, event.target().c_str());
+                    break;
+                case TRACE_LINK:
+                    result = _fs.link(event.target().c_str(), path);
+                    break;
+                case TRACE_CHMOD:
+                    result = _fs.chmod(path, event.arg());
+                    break;
+                case TRACE_CHOWN:
+                    result = _fs.chown(path, event.arg(), event.arg2());
+                    break;
+                case TRACE_TRUNCATE:
+                case TRACE_FTRUNCATE:
+                    result = _fs.truncate(path, event.offset());
+                    break;
+                case TRACE_UTIME:{
+                    struct utimbuf buf;
+                    buf.actime = buf.modtime = time(nullptr);
+                    result = _fs.utime(path, &buf);
+                    break;
+                }
+                case TRACE_UTIMENS:{
+                    struct timespec tv[2];
+                    clock_gettime(CLOCK_REALTIME, &tv[0]);
+                    tv[1] = tv[0];
+                    result = _fs.utimens(path, tv);
+                    break;
+                }
+                case TRACE_OPEN:
+                    result = _fs.open(path, fi.get());
+                    break;
+                case TRACE_CREATE:
+                    result = _fs.create(path, event.arg(), fi.get());
+                    break;
+                case TRACE_OPENDIR:
+                    result = _fs.opendir(path, fi.get());
+                    break;
+                case TRACE_READ:
+                    result = _fs.read(path, &buffer[0], event.size(), event.offset(), fi.get());
+                    break;
+                case TRACE_WRITE:
+                    result = _fs.write(path, buffer.data(), event.size(), event.offset(), fi.get());
+                    break;
+                case TRACE_STATFS:{
+                    struct statvfs stbuf;
+                    result = _fs.statfs(path, &stbuf);
+                    break;
+                }
+                case TRACE_FLUSH:
+                    result = _fs.flush(path, fi.get());
+                    break;
+                case TRACE_FSYNC:
+                    result = _fs.fsync(path, 0, fi.get());
+                    break;
+                case TRACE_RELEASE:
+                    result = _fs.release(path, fi.get());
+                    break;
+                case TRACE_RELEASEDIR:
+                    result = _fs.releasedir(path, fi.get());
+                    break;
+                case TRACE_SETXATTR:
+                    result = _fs.setxattr(path, event.target().c_str(), buffer.data(), event.size(), event.arg());
+                    break;
+                case TRACE_GETXATTR:
+                    result = _fs.getxattr(path, event.target().c_str(), &buffer[0], event.size());
+                    break;
+                case TRACE_LISTXATTR:
+                    result = _fs.listxattr(path, &buffer[0], event.size());
+                    break;
+                case TRACE_REMOVEXATTR:
+                    result = _fs.removexattr(path, event.target().c_str());
+                    break;
+                case TRACE_READDIR:
+                    result = _fs.readdir(path, nullptr, [](void *, const char *, const struct stat *, off_t){ return 0; }, event.offset(), fi.get());
+                    break;
+                case TRACE_ACCESS:
+                    result = _fs.access(path, event.arg());
+                    break;
+                case TRACE_LOCK:{
+                    struct flock fl;
+                    std::memset(&fl, 0, sizeof(fl));
+                    fl.l_type = event.arg2();
+                    fl.l_whence = SEEK_SET;
+                    fl.l_start = event.offset();
+                    fl.l_len = event.size();
+                    //Whoever held the lock when this was recorded may never
+                    //release it here
+                    const int cmd = (event.arg() == F_SETLKW) ? F_SETLK : event.arg();
+                    result = _fs.lock(path, fi.get(), cmd, &fl);
+                    break;
+                }
+                case TRACE_FLOCK:
+                    result = _fs.flock(path, fi.get(), event.arg() | LOCK_NB);
+                    break;
+                case TRACE_FALLOCATE:
+                    result = _fs.fallocate(path, event.arg(), event.offset(), event.size(), fi.get());
+                    break;
+                case TRACE_IOCTL:
+                    //Arguments were not recorded
+                    break;
+                default:
+                    return;
+            }
+            const uint64_t latency = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            const uint64_t allocated_by_op = allocations - allocated;
+
+            std::lock_guard<std::mutex> l(_lock);
+            if( (result >= 0) && ( (event.op() == TRACE_OPEN) || (event.op() == TRACE_CREATE) || (event.op() == TRACE_OPENDIR) ) ){
+                _handles[event.fh()] = fi;
+            }
+            else if( (event.op() == TRACE_RELEASE) || (event.op() == TRACE_RELEASEDIR) ){
+                _handles.erase(event.fh());
+            }
+            if( (event.op() == TRACE_READ) && (result > 0) ){
+                _read += result;
+            }
+            else if( (event.op() == TRACE_WRITE) && (result > 0) ){
+                _written += result;
+            }
+
+            Op_Stats &stats = _stats[event.op()];
+            stats.count++;
+            stats.errors += (result < 0);
+            stats.mismatches += ((result < 0) != (event.result() < 0));
+            stats.recorded += event.duration();
+            stats.allocations += allocated_by_op;
+            stats.latencies.push_back(latency);
+        }
+
+};
+
+std::string parent(const std::string &path){
+    const size_t slash = path.rfind('/');
+    return ( (slash == 0) || (slash == std::string::npos) ) ? "/" : path.substr(0, slash);
+}
+
+std::vector<std::string> ancestors(const std::string &path){
+    std::vector<std::string> a;
+    for(size_t slash = path.find('/', 1); slash != std::string::npos; slash = path.find('/', slash + 1)){
+        a.push_back(path.substr(0, slash));
+    }
+    return a;
+}
+
+/* Creates what the trace uses before it creates it, as the File System it
+ * was recorded on already had it.
+ *
+ * Only successful operations are considered. Ancestors and anything listed
+ * are created as directories, anything read as a link as a symlink, and
+ * everything else as a file as large as the furthest read of it. Modes are
+ * permissive as the real ones were never recorded.
+ */
+size_t prepopulate(File_System &fs, const std::vector<rtosfs::Trace_Event> &events){
+    enum Kind { NEED_FILE, NEED_DIR, NEED_SYMLINK };
+
+    std::map<std::string, size_t> extents;
+    for(const auto &e: events){
+        if( (e.op() == TRACE_READ) && (e.result() > 0) ){
+            auto &extent = extents[e.path()];
+            extent = std::max<size_t>(extent, e.offset() + e.result());
+        }
+    }
+
+    std::set<std::string> seen;
+    seen.insert("/");
+    std::vector<std::pair<std::string, Kind>> needed;
+    std::map<std::string, const rtosfs::Trace_Event *> needed_by;
+    const auto need = [&](const std::string &path, const Kind &kind, const rtosfs::Trace_Event &e){
+        for(const auto &a: ancestors(path)){
+            if(seen.insert(a).second){
+                needed.emplace_back(a, NEED_DIR);
+                needed_by[a] = &e;
+            }
+        }
+        if(seen.insert(path).second){
+            needed.emplace_back(path, kind);
+            needed_by[path] = &e;
+        }
+    };
+
+    for(const auto &e: events){
+        if(e.result() < 0){
+            continue;
+        }
+        switch(e.op()){
+            case TRACE_MKDIR:
+            case TRACE_CREATE:
+            case TRACE_SYMLINK:
+                need(parent(e.path()), NEED_DIR, e);
+                seen.insert(e.path());
+                break;
+            case TRACE_LINK:
+                need(e.target(), NEED_FILE, e);
+                need(parent(e.path()), NEED_DIR, e);
+                seen.insert(e.path());
+                break;
+            case TRACE_RENAME:{
+                need(e.path(), NEED_FILE, e);
+                need(parent(e.target()), NEED_DIR, e);
+                //Whatever was under the source is now under the destination
+                const std::string prefix = e.path() + "/";
+                std::vector<std::string> moved;
+                for(auto s = seen.lower_bound(prefix); (s != seen.end()) && (s->compare(0, prefix.size(), prefix) == 0); s++){
+                    moved.push_back(e.target() + s->substr(e.path().size()));
+                }
+                seen.insert(moved.begin(), moved.end());
+                seen.insert(e.target());
+                break;
+            }
+            case TRACE_OPENDIR:
+            case TRACE_READDIR:
+            case TRACE_RELEASEDIR:
+            case TRACE_RMDIR:
+                need(e.path(), NEED_DIR, e);
+                break;
+            case TRACE_READLINK:
+                need(e.path(), NEED_SYMLINK, e);
+                break;
+            default:
+                need(e.path(), NEED_FILE, e);
+        }
+    }
+
+    //Anything with children is a directory, whatever it was first used as
+    for(auto &n: needed){
+        const auto child = seen.upper_bound(n.first + "/");
+        if( (child != seen.end()) && (child->compare(0, n.first.size() + 1, n.first + "/") == 0) ){
+            n.second = NEED_DIR;
+        }
+    }
+
+    size_t failed = 0;
+    for(const auto &n: needed){
+        const rtosfs::Trace_Event &e = *needed_by[n.first];
+        replay_context.uid = e.uid();
+        replay_context.gid = e.gid();
+
+        const char *path = n.first.c_str();
+        int result;
+        if(n.second == NEED_DIR){
+            result = fs.mkdir(path, 0777);
+        }
+        else if(n.second == NEED_SYMLINK){
+            result = fs.symlink(".", path);
+        }
+        else{
+            struct fuse_file_info fi;
+            std::memset(&fi, 0, sizeof(fi));
+            result = fs.create(path, 0666, &fi);
+            if(result == 0){
+                const auto extent = extents.find(n.first);
+                if(extent != extents.end()){
+                    result = fs.truncate(path, extent->second);
+                }
+                fs.release(path, &fi);
+            }
+        }
+        if(result < 0){
+            failed++;
+        }
+    }
+
+    replay_context.uid = getuid();
+    replay_context.gid = getgid();
+    if(failed > 0){
+        std::cerr << "Could not create " << failed << " of " << needed.size() << " paths used by the trace" << std::endl;
+    }
+    return needed.size();
+}
+
+}
+
+int main(int argc, char *argv[]){
+
+    std::string TRACE;
+    std::string RTOSD;
+    std::string FS;
+    size_t THREADS = 1;
+    bool TIMED = false;
+    Mount_Options OPTIONS;
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("trace", po::value<std::string>(&TRACE), "Trace recorded by rtosfs --trace to replay")
+        ("rtosd", po::value<std::string>(&RTOSD), "Unix Domain Socket of rtosd, replays against memory if not given")
+        ("fs", po::value<std::string>(&FS), "New File System to replay into, defaults to one named after the trace")
+        ("threads", po::value<size_t>(&THREADS), "Operations replayed at once, operations on the same path are always replayed in order")
+        ("timed", po::bool_switch(&TIMED), "Start each operation when it was started in the trace, rather than as soon as possible")
+        ("chunking", po::bool_switch(&OPTIONS.chunking), "Store new files as deduplicated content defined chunks")
+        ("readahead", po::value<size_t>(&OPTIONS.readahead), "Largest number of bytes prefetched ahead of a sequential reader, 0 disables readahead")
+        ("metadata-cache", po::value<size_t>(&OPTIONS.metadata_cache), "Bytes of inodes and directories cached in memory, 0 disables the cache and metadata prefetch")
+    ;
+    Fault_Arguments FAULT_ARGUMENTS(desc, "the backend");
+
+    try{
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    }
+    catch(...){
+        std::cout << desc << std::endl;
+        return -1;
+    }
+
+    if(TRACE.size() == 0){
+        std::cout << desc << std::endl;
+        return -1;
+    }
+
+    Fault_Options FAULTS;
+    try{
+        FAULTS = FAULT_ARGUMENTS.options();
+    }
+    catch(E_BAD_DISTRIBUTION e){
+        std::cout << desc << std::endl;
+        return -1;
+    }
+
+    std::vector<rtosfs::Trace_Event> events;
+    try{
+        Trace_Reader reader(TRACE);
+        rtosfs::Trace_Event event;
+        while(reader.next(event)){
+            events.push_back(event);
+        }
+    }
+    catch(E_BAD_TRACE e){
+        std::cerr << "Could not read trace " << TRACE << std::endl;
+        return -1;
+    }
+    //Recorded as they finished, replayed as they were started
+    std::stable_sort(events.begin(), events.end(), [](const rtosfs::Trace_Event &a, const rtosfs::Trace_Event &b){
+        return a.start() < b.start();
+    });
+
+    std::shared_ptr<Object_Store> backend;
+    if(RTOSD.size() > 0){
+        std::shared_ptr<smpl::Remote_Address> rtosd_address(new smpl::Remote_UDS(RTOSD));
+        backend = std::shared_ptr<Object_Store>(new Remote_Store(rtosd_address));
+    }
+    else{
+        backend = std::shared_ptr<Object_Store>(new Memory_Store());
+    }
+    if(FAULTS.enabled()){
+        backend = std::shared_ptr<Object_Store>(new Fault_Store(backend, FAULTS));
+    }
+    if(FS.size() == 0){
+        FS = "replay/" + TRACE + "/" + std::to_string(std::chrono::system_clock::now().time_since_epoch().count());
+    }
+
+    File_System fs(FS, backend, OPTIONS);
+    const size_t created = prepopulate(fs, events);
+    std::cerr << "Replaying " << events.size() << " operations, created " << created << " paths first" << std::endl;
+
+    Replay replay(fs, THREADS);
+    const auto start = std::chrono::steady_clock::now();
+    for(const auto &e: events){
+        if(TIMED){
+            std::this_thread::sleep_until(start + std::chrono::nanoseconds(e.start() - events.front().start()));
+        }
+        replay.dispatch(e);
+    }
+    replay.wait();
+    const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    replay.report(seconds);
+    return 0;
+}
@@ -0,0 +1,36 @@
+#include "scratch.h"
+
+#include <cassert>
+
+namespace{
+
+const size_t SCRATCH_SIZE = 64 * 1024;
+
+//Arenas need their initial block 8 byte aligned, a char array need not be
+alignas(8) thread_local char scratch[SCRATCH_SIZE];
+thread_local bool scratch_in_use = false;
+
+google::protobuf::ArenaOptions scratch_options(){
+    assert(!scratch_in_use);
+    scratch_in_use = true;
+
+    google::protobuf::ArenaOptions options;
+    options.initial_block = scratch;
+    options.initial_block_size = SCRATCH_SIZE;
+    return options;
+}
+
+}
+
+Scratch_Arena::Scratch_Arena():
+    _arena(scratch_options())
+{
+}
+
+Scratch_Arena::~Scratch_Arena(){
+    scratch_in_use = false;
+}
+
+google::protobuf::Arena *Scratch_Arena::get(){
+    return &_arena;
+}
@@ -0,0 +1,30 @@
+#ifndef __SCRATCH_H__
+#define __SCRATCH_H__
+
+#include <google/protobuf/arena.h>
+
+/* A protobuf Arena whose first block is a per-thread scratch buffer.
+ *
+ * Messages parsed on it that fit in the buffer are allocated from it, and
+ * nothing is freed message by message when it goes out of scope. String
+ * fields too long for std::string's inline buffer, such as 32 byte refs,
+ * still allocate their contents on the heap. Only one Scratch_Arena may be
+ * live on a thread at a time.
+ */
+class Scratch_Arena {
+
+    public:
+        Scratch_Arena();
+        ~Scratch_Arena();
+
+        Scratch_Arena(const Scratch_Arena &) = delete;
+        Scratch_Arena &operator=(const Scratch_Arena &) = delete;
+
+        google::protobuf::Arena *get();
+
+    private:
+        google::protobuf::Arena _arena;
+
+};
+
+#endif
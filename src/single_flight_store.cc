@@ -0,0 +1,120 @@
+#include "single_flight_store.h"
+
+#include "fetch_hints.h"
+
+#include <cstring>
+
+namespace{
+
+std::string request_key(const Ref &ref, const char &type, const size_t &a, const size_t &b){
+    std::string key(ref.buf(), 32);
+    key.push_back(type);
+    key.append((const char *)&a, sizeof(a));
+    key.append((const char *)&b, sizeof(b));
+    return key;
+}
+
+}
+
+Single_Flight_Store::Single_Flight_Store(const std::shared_ptr<Object_Store> &backend):
+    _backend(backend)
+{
+}
+
+void Single_Flight_Store::store(const Ref &ref, const Object &obj){
+    _backend->store(ref, obj);
+    _detach(ref);
+}
+
+Object Single_Flight_Store::fetch(const Ref &ref){
+    //Hinted fetches may be served from copies, the rest must not join them
+    const char type = Immutable_Fetch::active() ? 'i' : 'o';
+    return Object(_fly(ref, request_key(ref, type, 0, 0), [this, &ref](){
+        return _backend->fetch(ref).data();
+    }));
+}
+
+Object Single_Flight_Store::fetch(const Ref &ref, const size_t &start, const size_t &end){
+    return Object(_fly(ref, request_key(ref, 'r', start, end), [this, &ref, &start, &end](){
+        return _backend->fetch(ref, start, end).data();
+    }));
+}
+
+Object Single_Flight_Store::fetch_tail(const Ref &ref, const size_t &num_bytes){
+    std::string tail(num_bytes, '\0');
+    fetch_tail(ref, num_bytes, &tail[0]);
+    return Object(tail);
+}
+
+void Single_Flight_Store::fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf){
+    //A tail that may be stale must not be handed to a caller that needs
+    //the latest
+    const char type = Stale_Fetch::active() ? 's' : 't';
+    const std::string tail = _fly(ref, request_key(ref, type, num_bytes, 0), [this, &ref, &num_bytes](){
+        std::string tail(num_bytes, '\0');
+        _backend->fetch_tail(ref, num_bytes, &tail[0]);
+        return tail;
+    });
+    std::memcpy(buf, tail.data(), num_bytes);
+}
+
+void Single_Flight_Store::append(const Ref &ref, const char *data, const size_t &size){
+    _backend->append(ref, data, size);
+    _detach(ref);
+}
+
+Single_Flight_Store::Shard &Single_Flight_Store::_shard(const Ref &ref){
+    //Refs are random or hashes, any byte will do
+    return _shards[(unsigned char)ref.buf()[0] % SHARDS];
+}
+
+std::string Single_Flight_Store::_fly(const Ref &ref, const std::string &request, const std::function<std::string()> &fetch){
+    Shard &s = _shard(ref);
+    std::promise<std::string> promise;
+    std::shared_future<std::string> result;
+    bool leader = false;
+    uint64_t id;
+    {
+        std::lock_guard<std::mutex> l(s.lock);
+        const auto f = s.flights.find(request);
+        if(f != s.flights.end()){
+            result = f->second.result;
+        }
+        else{
+            leader = true;
+            id = s.next_id++;
+            result = promise.get_future().share();
+            s.flights[request] = Flight{id, result};
+        }
+    }
+
+    if(leader){
+        try{
+            promise.set_value(fetch());
+        }
+        catch(...){
+            promise.set_exception(std::current_exception());
+        }
+
+        std::lock_guard<std::mutex> l(s.lock);
+        const auto f = s.flights.find(request);
+        //A write may already have detached it, and another request taken
+        //its place
+        if( (f != s.flights.end()) && (f->second.id == id) ){
+            s.flights.erase(f);
+        }
+    }
+
+    //Rethrows whatever the request threw
+    return result.get();
+}
+
+void Single_Flight_Store::_detach(const Ref &ref){
+    Shard &s = _shard(ref);
+    const std::string prefix(ref.buf(), 32);
+    std::lock_guard<std::mutex> l(s.lock);
+    auto f = s.flights.lower_bound(prefix);
+    while( (f != s.flights.end()) && (f->first.compare(0, prefix.size(), prefix) == 0) ){
+        f = s.flights.erase(f);
+    }
+}
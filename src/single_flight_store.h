@@ -0,0 +1,59 @@
+#ifndef __SINGLE_FLIGHT_STORE_H__
+#define __SINGLE_FLIGHT_STORE_H__
+
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <rtos/object_store.h>
+
+/* Object_Store decorator coalescing concurrent identical fetches.
+ *
+ * A fetch of a ref, range or tail that is already being fetched waits for
+ * that request and gets its result, or its exception, instead of sending
+ * another. So a burst of lookups in one directory costs one request per
+ * inode tail and directory, however many threads make them.
+ *
+ * Stores and appends detach the requests in flight for their ref once they
+ * are done, so a fetch that starts after a write through this store never
+ * joins a request that could have missed it.
+ */
+class Single_Flight_Store : public Object_Store {
+
+    public:
+        Single_Flight_Store(const std::shared_ptr<Object_Store> &backend);
+
+        void store(const Ref &ref, const Object &obj);
+        Object fetch(const Ref &ref);
+        Object fetch(const Ref &ref, const size_t &start, const size_t &end);
+        Object fetch_tail(const Ref &ref, const size_t &num_bytes);
+        void fetch_tail(const Ref &ref, const size_t &num_bytes, char *buf);
+        void append(const Ref &ref, const char *data, const size_t &size);
+
+    private:
+        static const size_t SHARDS = 64;
+
+        struct Flight {
+            uint64_t id;
+            std::shared_future<std::string> result;
+        };
+
+        struct Shard {
+            std::mutex lock;
+            //Keyed by ref then request, so a ref's requests are adjacent
+            std::map<std::string, Flight> flights;
+            uint64_t next_id = 0;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        Shard _shards[SHARDS];
+
+        Shard &_shard(const Ref &ref);
+        std::string _fly(const Ref &ref, const std::string &request, const std::function<std::string()> &fetch);
+        void _detach(const Ref &ref);
+
+};
+
+#endif
@@ -0,0 +1,296 @@
+#include "superblock.h"
+
+#include <cstring>
+#include <set>
+
+namespace{
+
+//How often a running mount writes a record even if nothing changed
+const std::chrono::hours HEARTBEAT(1);
+//How long a mount may write nothing before others take it as crashed
+const uint64_t STALE_SECONDS = 24 * 60 * 60;
+//Retired mounts left on the list before they are folded into the base
+const size_t COMPACT_RETIRED = 16;
+
+Ref superblock_ref(const std::string &prefix){
+    return Ref("superblock/" + prefix);
+}
+
+uint64_t now_seconds(){
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+Usage_Base read_base(Object_Store &backend, const std::string &prefix){
+    Usage_Base b;
+    try{
+        backend.fetch_tail(superblock_ref(prefix), sizeof(Usage_Base), (char *)(&b));
+    }
+    catch(E_OBJECT_DNE e){
+        //File Systems created before usage was counted start from nothing,
+        //with the list every base starts from
+        std::memset(&b, 0, sizeof(b));
+        std::memcpy(b.mounts, Ref("superblock/" + prefix + "/mounts").buf(), 32);
+    }
+    return b;
+}
+
+//Mounts listed, one 32 byte id after another. Lists change, so this is
+//fetched without a hint and always comes from the primary.
+std::vector<std::string> mount_ids(Object_Store &backend, const Ref &list){
+    std::vector<std::string> ids;
+    std::set<std::string> seen;
+    try{
+        const std::string raw = backend.fetch(list).data();
+        for(size_t i = 0; i + 32 <= raw.size(); i += 32){
+            const std::string id = raw.substr(i, 32);
+            //Registering again after a compaction may list a mount twice
+            if(seen.insert(id).second){
+                ids.push_back(id);
+            }
+        }
+    }
+    catch(E_OBJECT_DNE e){
+    }
+    return ids;
+}
+
+bool read_mount(Object_Store &backend, const std::string &id, Mount_Usage &usage){
+    try{
+        backend.fetch_tail(Ref(id.c_str(), 32), sizeof(Mount_Usage), (char *)(&usage));
+        return true;
+    }
+    catch(E_OBJECT_DNE e){
+        return false;
+    }
+}
+
+bool retired(const Mount_Usage &usage, const uint64_t &now){
+    return (usage.state != MOUNT_OPEN) || (now > usage.written + STALE_SECONDS);
+}
+
+void add_mount(Superblock &total, const Mount_Usage &usage){
+    total.files += usage.files;
+    total.directories += usage.directories;
+    total.bytes += usage.bytes;
+}
+
+uint64_t clamp(const uint64_t &total){
+    //Never report a wrapped total, mounts may remove what was never counted
+    return ((int64_t)total < 0) ? 0 : total;
+}
+
+}
+
+Usage_Counters::Usage_Counters(const std::shared_ptr<Object_Store> &backend, const std::string &prefix, const std::chrono::milliseconds &interval):
+    _backend(backend),
+    _prefix(prefix),
+    _interval(interval),
+    _id(Ref())
+{
+    std::memset(&_others, 0, sizeof(_others));
+    std::memset(&_flushed, 0, sizeof(_flushed));
+    _refresh();
+    _flusher = std::thread(&Usage_Counters::_run, this);
+}
+
+Usage_Counters::~Usage_Counters(){
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _stopping = true;
+    }
+    _stop.notify_all();
+    _flusher.join();
+}
+
+void Usage_Counters::add(const int64_t &files, const int64_t &directories, const int64_t &bytes){
+    std::lock_guard<std::mutex> l(_lock);
+    _files += files;
+    _directories += directories;
+    _bytes += bytes;
+}
+
+Superblock Usage_Counters::current(){
+    std::lock_guard<std::mutex> l(_lock);
+    Superblock s;
+    s.files = clamp(_others.files + _flushed.files + _files);
+    s.directories = clamp(_others.directories + _flushed.directories + _directories);
+    s.bytes = clamp(_others.bytes + _flushed.bytes + _bytes);
+    return s;
+}
+
+void Usage_Counters::_refresh(){
+    const Usage_Base base = read_base(*_backend, _prefix);
+    _list.assign(base.mounts, 32);
+    const std::vector<std::string> ids = mount_ids(*_backend, Ref(base.mounts, 32));
+
+    Superblock others = base.usage;
+    std::map<std::string, Mount_Usage> retired_mounts;
+    bool listed = false;
+    const std::string self(_id.buf(), 32);
+    const uint64_t now = now_seconds();
+    for(const auto &id: ids){
+        if(id == self){
+            listed = true;
+            continue;
+        }
+
+        Mount_Usage usage;
+        const auto f = _final.find(id);
+        if(f != _final.end()){
+            usage = f->second;
+        }
+        else if(!read_mount(*_backend, id, usage)){
+            continue;
+        }
+        else if(usage.state != MOUNT_OPEN){
+            _final[id] = usage;
+        }
+        add_mount(others, usage);
+        if(retired(usage, now)){
+            retired_mounts[id] = usage;
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _others = others;
+    }
+
+    if( _registered && !listed ){
+        _register_again();
+    }
+    if(retired_mounts.size() >= COMPACT_RETIRED){
+        _compact(base, ids, retired_mounts);
+    }
+}
+
+void Usage_Counters::_restart_if_folded(){
+    Mount_Usage own;
+    if( read_mount(*_backend, std::string(_id.buf(), 32), own) && (own.state == MOUNT_FOLDED) ){
+        //Everything flushed so far is in the base now
+        std::lock_guard<std::mutex> l(_lock);
+        std::memset(&_flushed, 0, sizeof(_flushed));
+        _id = Ref();
+        _registered = false;
+    }
+}
+
+void Usage_Counters::_register_again(){
+    //A new list was made without us, either because we registered after it
+    //was read, or because we wrote nothing for so long we were retired
+    _restart_if_folded();
+    if(_registered){
+        _backend->append(Ref(_list.c_str(), 32), _id.buf(), 32);
+    }
+}
+
+void Usage_Counters::_compact(const Usage_Base &base, const std::vector<std::string> &ids, const std::map<std::string, Mount_Usage> &retired_mounts){
+    Usage_Base next = base;
+    for(const auto &r: retired_mounts){
+        add_mount(next.usage, r.second);
+        //Tells a mount that was only asleep it has been counted
+        if(r.second.state == MOUNT_OPEN){
+            Mount_Usage folded = r.second;
+            folded.state = MOUNT_FOLDED;
+            _backend->append(Ref(r.first.c_str(), 32), (const char *)(&folded), sizeof(folded));
+        }
+    }
+
+    std::string listed;
+    for(const auto &id: ids){
+        if(retired_mounts.count(id) == 0){
+            listed.append(id);
+        }
+    }
+    //A list of our own, so a concurrent compaction can never add to it
+    const Ref next_list;
+    _backend->store(next_list, Object(listed));
+    std::memcpy(next.mounts, next_list.buf(), 32);
+    _backend->append(superblock_ref(_prefix), (const char *)(&next), sizeof(next));
+
+    _list.assign(next.mounts, 32);
+    for(const auto &r: retired_mounts){
+        _final.erase(r.first);
+    }
+}
+
+void Usage_Counters::_flush(const bool &closing){
+    int64_t files, directories, bytes;
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        files = _files;
+        directories = _directories;
+        bytes = _bytes;
+    }
+
+    //Only a mount that wrote nothing for a while, e.g. one that was
+    //suspended, can have been folded, and must not write over the marker
+    if( _registered && (now_seconds() >= _flushed.written + STALE_SECONDS / 2) ){
+        _restart_if_folded();
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    const bool heartbeat = _registered && (now - _written >= HEARTBEAT);
+    if( (files != 0) || (directories != 0) || (bytes != 0) || heartbeat || (closing && _registered) ){
+        Mount_Usage usage = _flushed;
+        usage.files += files;
+        usage.directories += directories;
+        usage.bytes += bytes;
+        usage.state = closing ? MOUNT_CLOSED : MOUNT_OPEN;
+        usage.written = now_seconds();
+        _backend->append(_id, (const char *)(&usage), sizeof(usage));
+        _written = now;
+
+        //Listed only once it has a record, so every listed mount has one
+        if(!_registered){
+            _backend->append(Ref(_list.c_str(), 32), _id.buf(), 32);
+            _registered = true;
+        }
+
+        //Only what was flushed comes off, changes made meanwhile stay pending
+        std::lock_guard<std::mutex> l(_lock);
+        _files -= files;
+        _directories -= directories;
+        _bytes -= bytes;
+        _flushed = usage;
+    }
+
+    if(!closing){
+        _refresh();
+    }
+}
+
+void Usage_Counters::_run(){
+    bool stopping = false;
+    while(!stopping){
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _stop.wait_for(l, _interval, [this](){ return _stopping; });
+            stopping = _stopping;
+        }
+
+        try{
+            _flush(stopping);
+        }
+        catch(...){
+            //Pending changes are kept for the next attempt
+        }
+    }
+}
+
+void seed_usage(Object_Store &backend, const std::string &prefix, const Superblock &actual){
+    Usage_Base base = read_base(backend, prefix);
+    Superblock mounts;
+    std::memset(&mounts, 0, sizeof(mounts));
+    for(const auto &id: mount_ids(backend, Ref(base.mounts, 32))){
+        Mount_Usage usage;
+        if(read_mount(backend, id, usage)){
+            add_mount(mounts, usage);
+        }
+    }
+
+    base.usage.files = actual.files - mounts.files;
+    base.usage.directories = actual.directories - mounts.directories;
+    base.usage.bytes = actual.bytes - mounts.bytes;
+    backend.append(superblock_ref(prefix), (const char *)(&base), sizeof(base));
+}
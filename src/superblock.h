@@ -0,0 +1,121 @@
+#ifndef __SUPERBLOCK_H__
+#define __SUPERBLOCK_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <rtos/object_store.h>
+
+//Usage of a File System. Fields are added modulo 2^64, a seeded base may be
+//"negative".
+struct Superblock{
+    uint64_t files;
+    uint64_t directories;
+    //Sum of st_size of files and symlinks
+    uint64_t bytes;
+};
+
+//Raw record appended to a File System's superblock log, the last one is
+//current. It is the base the usage of every listed mount is added to, and
+//names the list of mounts not yet folded into it.
+struct Usage_Base{
+    Superblock usage;
+    char mounts[32];
+};
+
+enum MOUNT_STATE{
+    MOUNT_OPEN = 0,
+    MOUNT_CLOSED = 1,   //Stopped cleanly, the record is final
+    MOUNT_FOLDED = 2    //Added to a base by another mount, see Usage_Counters
+};
+
+//Raw record appended to a mount's usage log, the last one is current. Only
+//that mount writes it, so it simply holds everything the mount has changed.
+struct Mount_Usage{
+    int64_t files;
+    int64_t directories;
+    int64_t bytes;
+    uint64_t state;
+    //Seconds since the epoch
+    uint64_t written;
+};
+
+/* Usage counters of a File System, kept in its superblock log.
+ *
+ * Every mount that changes anything appends its own totals to a log of its
+ * own, then lists its random id in the mount list named by the base, so
+ * concurrent mounts never overwrite each other's counts. Usage is the base
+ * plus the latest record of every listed mount.
+ *
+ * Changes are counted in memory and flushed at most once per interval, which
+ * is also when the other mounts' records are read again, so current() never
+ * does any I/O. Mounts write a record at least hourly while they run. Changes
+ * not yet flushed when a mount crashes are lost, the counters are only an
+ * estimate for statfs.
+ *
+ * Mounts that stopped cleanly, or wrote nothing for a day, are retired. Once
+ * enough have, whichever mount sees it adds them to a new base, naming a new
+ * list of only the others, so the list stays about as long as the number of
+ * running mounts. Every base is the sum of exactly the mounts not on its own
+ * list, so mounts compacting at once never count anything twice. A mount
+ * that finds itself missing from the current list registers again, or, if
+ * it was retired while it was suspended, starts over under a new id.
+ */
+class Usage_Counters {
+
+    public:
+        Usage_Counters(const std::shared_ptr<Object_Store> &backend, const std::string &prefix, const std::chrono::milliseconds &interval);
+
+        //Flushes anything outstanding
+        ~Usage_Counters();
+
+        void add(const int64_t &files, const int64_t &directories, const int64_t &bytes);
+        Superblock current();
+
+    private:
+        std::shared_ptr<Object_Store> _backend;
+        const std::string _prefix;
+        const std::chrono::milliseconds _interval;
+
+        std::mutex _lock;
+        //Base plus every other mount as of the last refresh
+        Superblock _others;
+        Mount_Usage _flushed;
+        int64_t _files = 0;
+        int64_t _directories = 0;
+        int64_t _bytes = 0;
+
+        //Only used by the flusher thread
+        Ref _id;
+        bool _registered = false;
+        //Mount list of the base as of the last refresh
+        std::string _list;
+        std::chrono::steady_clock::time_point _written;
+        //Last record of every listed mount known to be final, by id
+        std::map<std::string, Mount_Usage> _final;
+
+        std::condition_variable _stop;
+        bool _stopping = false;
+        std::thread _flusher;
+
+        void _refresh();
+        void _restart_if_folded();
+        void _register_again();
+        void _compact(const Usage_Base &base, const std::vector<std::string> &ids, const std::map<std::string, Mount_Usage> &retired);
+        void _flush(const bool &closing);
+        void _run();
+
+};
+
+//Makes the usage of the File System at prefix read as actual, e.g. as
+//counted by Du for a File System created before usage was counted. Changes
+//mounts have not flushed yet are counted again once they are.
+void seed_usage(Object_Store &backend, const std::string &prefix, const Superblock &actual);
+
+#endif
@@ -0,0 +1,96 @@
+#include "trace.h"
+
+#include <cstring>
+
+namespace{
+
+const char TRACE_MAGIC[8] = {'R', 'T', 'O', 'S', 'T', 'R', 'C', '1'};
+
+//Buffered events are written once there are this many bytes of them
+const size_t TRACE_BUFFER = 1024 * 1024;
+
+}
+
+std::string trace_op_name(const uint32_t &op){
+    static const char *names[] = {
+        "unknown", "getattr", "readlink", "mkdir", "unlink", "rmdir", "symlink",
+        "rename", "link", "chmod", "chown", "truncate", "utime", "open", "read",
+        "write", "statfs", "flush", "release", "fsync", "setxattr", "getxattr",
+        "listxattr", "removexattr", "opendir", "readdir", "releasedir", "access",
+        "create", "ftruncate", "fgetattr", "lock", "utimens", "ioctl", "flock",
+        "fallocate"
+    };
+    return (op < sizeof(names) / sizeof(names[0])) ? names[op] : names[0];
+}
+
+Trace_Recorder::Trace_Recorder(const std::string &path):
+    _start(std::chrono::steady_clock::now())
+{
+    _file = std::fopen(path.c_str(), "wb");
+    if( (_file == nullptr) || (std::fwrite(TRACE_MAGIC, sizeof(TRACE_MAGIC), 1, _file) != 1) ){
+        if(_file != nullptr){
+            std::fclose(_file);
+        }
+        throw E_BAD_TRACE();
+    }
+}
+
+Trace_Recorder::~Trace_Recorder(){
+    std::lock_guard<std::mutex> l(_lock);
+    _flush();
+    std::fclose(_file);
+}
+
+uint64_t Trace_Recorder::now() const{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _start).count();
+}
+
+void Trace_Recorder::record(const rtosfs::Trace_Event &event){
+    const std::string serialized = event.SerializeAsString();
+    char length[4];
+    for(size_t i = 0; i < 4; i++){
+        length[i] = (serialized.size() >> (8 * i)) & 0xff;
+    }
+
+    std::lock_guard<std::mutex> l(_lock);
+    _buffer.append(length, sizeof(length));
+    _buffer.append(serialized);
+    if(_buffer.size() >= TRACE_BUFFER){
+        _flush();
+    }
+}
+
+void Trace_Recorder::_flush(){
+    //A full disk only costs us the trace, never the operation
+    std::fwrite(_buffer.data(), 1, _buffer.size(), _file);
+    std::fflush(_file);
+    _buffer.clear();
+}
+
+Trace_Reader::Trace_Reader(const std::string &path){
+    _file = std::fopen(path.c_str(), "rb");
+    char magic[sizeof(TRACE_MAGIC)];
+    if( (_file == nullptr) || (std::fread(magic, sizeof(magic), 1, _file) != 1) || (std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0) ){
+        if(_file != nullptr){
+            std::fclose(_file);
+        }
+        throw E_BAD_TRACE();
+    }
+}
+
+Trace_Reader::~Trace_Reader(){
+    std::fclose(_file);
+}
+
+bool Trace_Reader::next(rtosfs::Trace_Event &event){
+    unsigned char length[4];
+    if(std::fread(length, sizeof(length), 1, _file) != 1){
+        return false;
+    }
+    const size_t size = length[0] | (length[1] << 8) | (length[2] << 16) | ((size_t)length[3] << 24);
+    std::string serialized(size, '\0');
+    if( (size > 0) && (std::fread(&serialized[0], size, 1, _file) != 1) ){
+        return false;
+    }
+    return event.ParseFromString(serialized);
+}
@@ -0,0 +1,104 @@
+#ifndef __TRACE_H__
+#define __TRACE_H__
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+
+#include "disk_format.pb.h"
+
+class E_BAD_TRACE {};
+
+/* Operations recorded in traces, and the Trace_Event fields each one sets
+ * besides path, uid, gid, timing and result. Values are stored in traces,
+ * never renumber.
+ */
+enum TRACE_OP{
+    TRACE_GETATTR = 1,
+    TRACE_READLINK = 2,     //size
+    TRACE_MKDIR = 3,        //arg mode
+    TRACE_UNLINK = 4,
+    TRACE_RMDIR = 5,
+    TRACE_SYMLINK = 6,      //path is the new link, target what it points to
+    TRACE_RENAME = 7,       //target is the destination
+    TRACE_LINK = 8,         //path is the new link, target the existing file
+    TRACE_CHMOD = 9,        //arg mode
+    TRACE_CHOWN = 10,       //arg uid, arg2 gid
+    TRACE_TRUNCATE = 11,    //offset
+    TRACE_UTIME = 12,
+    TRACE_OPEN = 13,        //arg flags, fh
+    TRACE_READ = 14,        //size, offset, fh
+    TRACE_WRITE = 15,       //size, offset, fh
+    TRACE_STATFS = 16,
+    TRACE_FLUSH = 17,       //fh
+    TRACE_RELEASE = 18,     //fh
+    TRACE_FSYNC = 19,       //fh
+    TRACE_SETXATTR = 20,    //target name, size, arg flags
+    TRACE_GETXATTR = 21,    //target name, size
+    TRACE_LISTXATTR = 22,   //size
+    TRACE_REMOVEXATTR = 23, //target name
+    TRACE_OPENDIR = 24,     //fh
+    TRACE_READDIR = 25,     //offset, fh
+    TRACE_RELEASEDIR = 26,  //fh
+    TRACE_ACCESS = 27,      //arg mode
+    TRACE_CREATE = 28,      //arg mode, fh
+    TRACE_FTRUNCATE = 29,   //offset, fh
+    TRACE_FGETATTR = 30,    //fh
+    TRACE_LOCK = 31,        //arg cmd, arg2 l_type, offset l_start, size l_len, fh
+    TRACE_UTIMENS = 32,
+    TRACE_IOCTL = 33,       //arg cmd, fh
+    TRACE_FLOCK = 34,       //arg op, fh
+    TRACE_FALLOCATE = 35    //arg mode, offset, size length, fh
+};
+
+std::string trace_op_name(const uint32_t &op);
+
+/* Appends Trace_Events to a trace file.
+ *
+ * A trace is TRACE_MAGIC followed by each event as a 4 byte little endian
+ * length and the serialized event. Events are buffered and written in
+ * batches, so recording costs a serialization and a short critical section
+ * per operation. Events are in the order operations finished.
+ */
+class Trace_Recorder {
+
+    public:
+        //Throws E_BAD_TRACE if path cannot be created
+        Trace_Recorder(const std::string &path);
+
+        //Writes out anything buffered
+        ~Trace_Recorder();
+
+        //Nanoseconds since the trace was started
+        uint64_t now() const;
+
+        void record(const rtosfs::Trace_Event &event);
+
+    private:
+        const std::chrono::steady_clock::time_point _start;
+        std::mutex _lock;
+        FILE *_file;
+        std::string _buffer;
+
+        void _flush();
+
+};
+
+//Reads back what a Trace_Recorder wrote
+class Trace_Reader {
+
+    public:
+        //Throws E_BAD_TRACE if path cannot be read or is not a trace
+        Trace_Reader(const std::string &path);
+        ~Trace_Reader();
+
+        //False at the end of the trace, or a truncated last event
+        bool next(rtosfs::Trace_Event &event);
+
+    private:
+        FILE *_file;
+
+};
+
+#endif
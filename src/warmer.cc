@@ -0,0 +1,196 @@
+#include "warmer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sys/stat.h>
+#include <vector>
+
+#include "prefetcher.h"
+#include "work_pool.h"
+
+namespace{
+
+const size_t WARM_THREADS = 4;
+//Loads issued between checks for foreground activity
+const size_t WARM_BATCH = 64;
+//Warming waits until there has been no lookup for this long
+const int64_t FOREGROUND_QUIET_US = 2000;
+
+const size_t MAX_MANIFEST_ENTRIES = 256 * 1024;
+//Inodes counted before saving and pruning early
+const size_t MAX_TRACKED = 2 * MAX_MANIFEST_ENTRIES;
+const std::chrono::minutes SAVE_INTERVAL(10);
+
+//Entries without a mode predate it being recorded, they may be directories
+bool maybe_dir(const uint32_t &mode){
+    return (mode == 0) || S_ISDIR(mode);
+}
+
+int64_t now_us(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+Warmer::Warmer(const std::shared_ptr<Object_Store> &backend, const std::string &manifest):
+    _backend(backend),
+    _manifest(manifest)
+{
+    if(_manifest.empty()){
+        return;
+    }
+
+    rtosfs::Warm_Manifest previous;
+    {
+        std::ifstream in(_manifest, std::ios::binary);
+        if(in){
+            previous.ParseFromIstream(&in);
+        }
+    }
+
+    //Previous runs still count, but for less each time
+    for(const auto &e: previous.entries()){
+        //Manifests from before only directories were warmed list files too
+        if(!maybe_dir(e.mode())){
+            continue;
+        }
+        Shard &shard = _shards[(unsigned char)e.inode_ref()[0] % 16];
+        shard.hits[e.inode_ref()] = Hits{e.hits() / 2, e.mode()};
+    }
+    for(auto &shard: _shards){
+        _tracked += shard.hits.size();
+    }
+
+    _warming = std::thread(&Warmer::_warm, this, previous);
+    _saving = std::thread(&Warmer::_save, this);
+}
+
+Warmer::~Warmer(){
+    if(_manifest.empty()){
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _stopping = true;
+    }
+    _stop.notify_all();
+    _warming.join();
+    _saving.join();
+}
+
+void Warmer::lookup(const std::string &inode_ref, const uint32_t &mode){
+    if(_manifest.empty()){
+        return;
+    }
+    _last_lookup = now_us();
+    if(!maybe_dir(mode)){
+        return;
+    }
+
+    bool added = false;
+    {
+        Shard &shard = _shards[(unsigned char)inode_ref[0] % 16];
+        std::lock_guard<std::mutex> l(shard.lock);
+        const auto h = shard.hits.emplace(inode_ref, Hits{0, 0});
+        h.first->second.hits++;
+        if(mode != 0){
+            h.first->second.mode = mode;
+        }
+        added = h.second;
+    }
+
+    if( added && (++_tracked > MAX_TRACKED) && !_prune.exchange(true) ){
+        std::lock_guard<std::mutex> l(_lock);
+        _stop.notify_all();
+    }
+}
+
+bool Warmer::_foreground_busy() const{
+    return now_us() - _last_lookup < FOREGROUND_QUIET_US;
+}
+
+void Warmer::_warm(const rtosfs::Warm_Manifest &manifest){
+    //Saved hottest first
+    Work_Pool pool(WARM_THREADS);
+    const auto &entries = manifest.entries();
+    for(int i = 0; i < entries.size(); i += WARM_BATCH){
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            while( !_stopping && _foreground_busy() ){
+                _stop.wait_for(l, std::chrono::microseconds(FOREGROUND_QUIET_US));
+            }
+            if(_stopping){
+                return;
+            }
+        }
+
+        const int end = std::min(entries.size(), i + (int)WARM_BATCH);
+        for(int j = i; j < end; j++){
+            const auto &e = entries.Get(j);
+            if(!maybe_dir(e.mode())){
+                continue;
+            }
+            const std::string inode_ref = e.inode_ref();
+            const auto backend = _backend;
+            pool.submit([backend, inode_ref](){
+                load_metadata(*backend, inode_ref, true);
+            });
+        }
+        pool.wait();
+    }
+}
+
+void Warmer::_save(){
+    bool stopping = false;
+    while(!stopping){
+        {
+            std::unique_lock<std::mutex> l(_lock);
+            _stop.wait_for(l, SAVE_INTERVAL, [this](){ return _stopping || _prune; });
+            stopping = _stopping;
+        }
+
+        std::vector<rtosfs::Warm_Entry> hot;
+        for(auto &shard: _shards){
+            std::lock_guard<std::mutex> l(shard.lock);
+            for(const auto &h: shard.hits){
+                rtosfs::Warm_Entry e;
+                e.set_inode_ref(h.first);
+                e.set_mode(h.second.mode);
+                e.set_hits(h.second.hits);
+                hot.push_back(e);
+            }
+        }
+        const size_t keep = std::min(hot.size(), MAX_MANIFEST_ENTRIES);
+        std::partial_sort(hot.begin(), hot.begin() + keep, hot.end(), [](const rtosfs::Warm_Entry &a, const rtosfs::Warm_Entry &b){
+            return a.hits() > b.hits();
+        });
+
+        //Forget everything that did not make the manifest, inodes first looked
+        //up since the copy above are kept
+        for(size_t i = keep; i < hot.size(); i++){
+            Shard &shard = _shards[(unsigned char)hot[i].inode_ref()[0] % 16];
+            std::lock_guard<std::mutex> l(shard.lock);
+            if(shard.hits.erase(hot[i].inode_ref()) > 0){
+                _tracked--;
+            }
+        }
+        _prune = false;
+
+        rtosfs::Warm_Manifest manifest;
+        for(size_t i = 0; i < keep; i++){
+            manifest.add_entries()->Swap(&hot[i]);
+        }
+
+        //Replace the manifest atomically so a crash never leaves half of one
+        const std::string tmp = _manifest + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if(!out || !manifest.SerializeToOstream(&out)){
+                continue;
+            }
+        }
+        std::rename(tmp.c_str(), _manifest.c_str());
+    }
+}
@@ -0,0 +1,78 @@
+#ifndef __WARMER_H__
+#define __WARMER_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <rtos/object_store.h>
+
+#include "disk_format.pb.h"
+
+/* Mount time cache warming from a manifest of hot inodes.
+ *
+ * Every path lookup that reaches a directory is counted, and the most looked
+ * up directories are written to the manifest file periodically and on
+ * unmount. The next mount loads the manifest and fetches those directories
+ * through backend in the background, hottest first, so they are in its
+ * cache before they are asked for.
+ *
+ * Only directories are warmed. Their objects never change, so they stay
+ * cached until evicted, while the inode tails fetched to find them are only
+ * trusted for a lease, far less than warming a full manifest takes. Entries
+ * recorded before modes were are warmed too, as they may be directories.
+ * Backend must be the metadata cache, without one warming does nothing, so
+ * File_System turns it off.
+ *
+ * Only the MAX_MANIFEST_ENTRIES most looked up directories are kept track of
+ * past each save, which happens early if lookups of new ones pile up faster.
+ *
+ * Warming backs off whenever a lookup has happened in the last few
+ * milliseconds so foreground operations get the backend first.
+ */
+class Warmer {
+
+    public:
+        //Does nothing if manifest is empty
+        Warmer(const std::shared_ptr<Object_Store> &backend, const std::string &manifest);
+        ~Warmer();
+
+        //Called on every lookup of the inode at inode_ref, mode as recorded in
+        //its directory entry. Ones known not to be directories are not counted.
+        void lookup(const std::string &inode_ref, const uint32_t &mode);
+
+    private:
+        struct Hits {
+            uint64_t hits;
+            uint32_t mode;
+        };
+
+        struct Shard {
+            std::mutex lock;
+            std::unordered_map<std::string, Hits> hits;
+        };
+
+        std::shared_ptr<Object_Store> _backend;
+        const std::string _manifest;
+        Shard _shards[16];
+        std::atomic<int64_t> _last_lookup{0};
+        //Inodes in _shards, and whether _save has been woken early to prune them
+        std::atomic<size_t> _tracked{0};
+        std::atomic<bool> _prune{false};
+
+        std::mutex _lock;
+        std::condition_variable _stop;
+        bool _stopping = false;
+        std::thread _warming;
+        std::thread _saving;
+
+        void _warm(const rtosfs::Warm_Manifest &manifest);
+        void _save();
+        bool _foreground_busy() const;
+
+};
+
+#endif
@@ -0,0 +1,59 @@
+#include "work_pool.h"
+
+Work_Pool::Work_Pool(const size_t &threads){
+    for(size_t i = 0; i < threads; i++){
+        _threads.push_back(std::thread(&Work_Pool::_worker, this));
+    }
+}
+
+Work_Pool::~Work_Pool(){
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _stopping = true;
+    }
+    _work_ready.notify_all();
+    for(auto &t: _threads){
+        t.join();
+    }
+}
+
+void Work_Pool::submit(const std::function<void()> &work){
+    {
+        std::lock_guard<std::mutex> l(_lock);
+        _queue.push_back(work);
+    }
+    _work_ready.notify_one();
+}
+
+void Work_Pool::wait(){
+    std::unique_lock<std::mutex> l(_lock);
+    while( !_queue.empty() || (_running > 0) ){
+        _idle.wait(l);
+    }
+}
+
+void Work_Pool::_worker(){
+    std::unique_lock<std::mutex> l(_lock);
+    while(true){
+        if(_queue.empty()){
+            if(_stopping){
+                return;
+            }
+            _work_ready.wait(l);
+            continue;
+        }
+
+        const auto work = _queue.front();
+        _queue.pop_front();
+        _running++;
+        l.unlock();
+
+        work();
+
+        l.lock();
+        _running--;
+        if( _queue.empty() && (_running == 0) ){
+            _idle.notify_all();
+        }
+    }
+}
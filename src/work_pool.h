@@ -0,0 +1,38 @@
+#ifndef __WORK_POOL_H__
+#define __WORK_POOL_H__
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Fixed set of threads running submitted work in submission order
+class Work_Pool {
+
+    public:
+        Work_Pool(const size_t &threads);
+
+        //Runs everything already submitted before returning
+        ~Work_Pool();
+
+        void submit(const std::function<void()> &work);
+
+        //Blocks until all work submitted so far has run
+        void wait();
+
+    private:
+        std::mutex _lock;
+        std::condition_variable _work_ready;
+        std::condition_variable _idle;
+        std::deque<std::function<void()>> _queue;
+        size_t _running = 0;
+        bool _stopping = false;
+        std::vector<std::thread> _threads;
+
+        void _worker();
+
+};
+
+#endif